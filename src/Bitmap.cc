@@ -1,24 +1,45 @@
 
 #include "Bitmap.h"
+#include "vision_simd.h"
 #include "vision_util.h"
 namespace vision {
 
+template<class P, class Q>
+static auto isImageInFormat(Bitmap *bitmap, int x, int y, Bitmap *templateImage, int shiftSum)->bool{
+  int nowShift = 0;
+  for(int i=0;i<templateImage->height_;i++){
+    for(int j=0;j<templateImage->width_;j++){
+      nowShift += computePixelShiftSum<P, Q>(computeCoordColor(bitmap,x+j,y+i),computeCoordColor(templateImage,j,i));
+      if(nowShift>shiftSum){
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
 //TODO 在模板图像宽度和高度都小于目标bitmap的情况下，可以优化
 auto isImage(Bitmap *bitmap, int x, int y, Bitmap *templateImage, int shiftSum)->bool{
   if(x<0 || y<0) return false;
   if(x+templateImage->width_>bitmap->width_ || y+templateImage->height_>bitmap->height_) return false;
   int nowShift = 0;
-  for(int i=0;i<templateImage->height_;i++){
-    for(int j=0;j<templateImage->width_;j++){
-      nowShift += computeColorShiftSum(computeCoordColor(bitmap,x+j,y+i),computeCoordColor(templateImage,j,i));
+  if(bitmap->pixelStride_ == 4 && templateImage->pixelStride_ == 4 &&
+    pixelFormatBytes(bitmap->format_) >= 3 && pixelFormatBytes(templateImage->format_) >= 3){
+    bool swapped = channelOffset(bitmap->format_, CHANNEL_RED) != channelOffset(templateImage->format_, CHANNEL_RED);
+    // the sum only grows, so checking the budget once per row gives the same answer
+    for(int i=0;i<templateImage->height_;i++){
+      nowShift += computeRowShiftSum(computeCoordColor(bitmap,x,y+i),computeCoordColor(templateImage,0,i),templateImage->width_,swapped);
       if(nowShift>shiftSum){
         return false;
       }
     }
+    return true;
   }
-  return true;
+  return visitPixelFormats(bitmap->format_, templateImage->format_, [&](auto pixel, auto templatePixel){
+    return isImageInFormat<decltype(pixel), decltype(templatePixel)>(bitmap, x, y, templateImage, shiftSum);
+  });
 }
 
 
 
-} //namespace vision
\ No newline at end of file
+} //namespace vision
@@ -1,6 +1,14 @@
 #ifndef __VISION_BITMAP_H__
 #define __VISION_BITMAP_H__
+
+#include "vision_pixel.h"
+#include <memory>
+
 namespace vision {
+struct ColorIndex;
+struct SumTable;
+struct LumaPlane;
+
 class Bitmap{
 public:
 	unsigned char* origin_;
@@ -8,6 +16,25 @@ public:
 	unsigned int height_;
 	int rowShift_;
 	int pixelStride_;
+	// how the channels sit in a pixel, pixelStride_ may add padding
+	PixelFormat format_ = PIXEL_RGBA;
+	// bumped whenever the pixels change, data derived from older pixels is stale
+	unsigned int generation_ = 0;
+	// derived data is only cached for bitmaps whose owner calls invalidate()
+	bool cacheable_ = false;
+	// built on first use, see colorIndex()
+	std::shared_ptr<const ColorIndex> colorIndex_;
+	// built on first use, see sumTable()
+	std::shared_ptr<const SumTable> sumTable_;
+	// built on first use, see lumaPlane()
+	std::shared_ptr<const LumaPlane> lumaPlane_;
+
+	// The owner calls this after writing new pixels, which also opts the
+	// bitmap in to the per frame caches.
+	void invalidate(){
+		generation_++;
+		cacheable_ = true;
+	}
 };
 
 bool isImage(Bitmap*bitmap,int x,int y,Bitmap* templateImage,int shiftSum);
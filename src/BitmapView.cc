@@ -0,0 +1,58 @@
+#include "BitmapView.h"
+
+#include <utility>
+
+namespace vision {
+
+BitmapView::BitmapView()
+	: Bitmap()
+{
+	origin_ = nullptr;
+	width_ = 0;
+	height_ = 0;
+	rowShift_ = 0;
+	pixelStride_ = 4;
+}
+
+BitmapView::BitmapView(unsigned char* origin,unsigned int width,unsigned int height,int rowShift,int pixelStride,PixelFormat format,Release release)
+	: BitmapView()
+{
+	reset(origin,width,height,rowShift,pixelStride,format,std::move(release));
+}
+
+BitmapView::~BitmapView()
+{
+	release();
+}
+
+void BitmapView::reset(unsigned char* origin,unsigned int width,unsigned int height,int rowShift,int pixelStride,PixelFormat format,Release release)
+{
+	this->release();
+	origin_ = origin;
+	width_ = width;
+	height_ = height;
+	rowShift_ = rowShift;
+	pixelStride_ = pixelStride;
+	format_ = format;
+	release_ = std::move(release);
+	// the caches are keyed by the generation as well as the origin, a
+	// recycled buffer at the same address must not hit the old entries
+	if(cacheable_)
+		invalidate();
+}
+
+void BitmapView::release()
+{
+	auto release = std::move(release_);
+	release_ = nullptr;
+	origin_ = nullptr;
+	width_ = 0;
+	height_ = 0;
+	colorIndex_.reset();
+	sumTable_.reset();
+	lumaPlane_.reset();
+	if(release)
+		release();
+}
+
+} // namespace vision
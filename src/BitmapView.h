@@ -0,0 +1,33 @@
+#ifndef SVISION_BITMAP_VIEW_H
+#define SVISION_BITMAP_VIEW_H
+
+#include "Bitmap.h"
+
+#include <functional>
+
+namespace vision{
+
+// A Bitmap over pixels owned by someone else, nothing is copied. The
+// release callback runs once when the view lets go of the pixels.
+class BitmapView :public Bitmap
+{
+	std::function<void()> release_;
+public:
+	using Release = std::function<void()>;
+	BitmapView();
+	// rowShift and pixelStride are in bytes, pixelStride is at least the
+	// size of a format pixel
+	BitmapView(unsigned char* origin,unsigned int width,unsigned int height,int rowShift,int pixelStride,PixelFormat format = PIXEL_RGBA,Release release = nullptr);
+	BitmapView(const BitmapView&) = delete;
+	BitmapView& operator=(const BitmapView&) = delete;
+	~BitmapView();
+	// Points the view at another buffer, e.g. the next capture, after
+	// releasing the current one. Counts as new pixels for the frame caches.
+	void reset(unsigned char* origin,unsigned int width,unsigned int height,int rowShift,int pixelStride,PixelFormat format = PIXEL_RGBA,Release release = nullptr);
+	// Runs the release callback now and leaves an empty view.
+	void release();
+};
+
+} // namespace vision
+
+#endif //SVISION_BITMAP_VIEW_H
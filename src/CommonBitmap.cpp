@@ -1,33 +1,86 @@
 
 
 #include "CommonBitmap.h"
+#include "vision_luma.h"
 #include<lodepng.h>
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <utility>
 
 namespace vision {
 
 CommonBitmap::CommonBitmap()
-	: Bitmap(),error_(nullptr)
+	: Bitmap(),error_(nullptr),channelSums_{0, 0, 0},samplesReady_(false),lumaPattern_(false)
 {
 	origin_ = nullptr;
 	pixelStride_ = 4;
 }
 
+// templates are shared between threads through the image cache
+static std::mutex derivedMutex;
+
+void CommonBitmap::resetDerived()
+{
+	for(auto &level:pyramid_) level.clear();
+	owner_.reset();
+	samples_.clear();
+	samplesReady_ = false;
+	luma_.clear();
+	lumaPattern_ = false;
+	invalidate();
+}
+
+void CommonBitmap::computeChannelSums()
+{
+	for(auto &sum:channelSums_) sum = 0;
+	visitPixelFormat(format_, [this](auto format)
+	{
+		using P = decltype(format);
+		for(unsigned int i=0;i<height_;i++)
+		{
+			const unsigned char* pixel = origin_ + i * rowShift_;
+			for(unsigned int j=0;j<width_;j++)
+			{
+				channelSums_[CHANNEL_RED] += pixel[P::red];
+				channelSums_[CHANNEL_GREEN] += pixel[P::green];
+				channelSums_[CHANNEL_BLUE] += pixel[P::blue];
+				pixel += pixelStride_;
+			}
+		}
+	});
+}
+
 
 bool CommonBitmap::toBoolResult(unsigned int error)
+{
+	return toBoolResult(error ? lodepng_error_text(error) : nullptr);
+}
+
+bool CommonBitmap::toBoolResult(const char* error)
 {
 	if(error)
 	{
-		this->error_ = lodepng_error_text(error);;
+		this->error_ = error;
 		return false;
 	}
+	// every decoder produces tight RGBA
+	format_ = PIXEL_RGBA;
+	pixelStride_ = 4;
 	rowShift_ = pixelStride_ * width_;
 	origin_ = data_.data();
+	computeChannelSums();
 	return true;
 }
-bool CommonBitmap::load(const unsigned char* data, unsigned int size)
+bool CommonBitmap::load(const unsigned char* data, unsigned int size, ImageFormat format)
 {
-	lodepng::State state;
 	data_.clear();
+	resetDerived();
+	if(format == IMAGE_RAW)
+		return toBoolResult(decodeRaw(data,size,data_,width_,height_));
+	if(format == IMAGE_QOI)
+		return toBoolResult(decodeQoi(data,size,data_,width_,height_));
+	lodepng::State state;
 	auto error = lodepng::decode(this->data_,this->width_,this->height_,state,data,size);
 	return toBoolResult(error);
 }
@@ -35,6 +88,18 @@ bool CommonBitmap::load(const unsigned char* data, unsigned int size)
 bool CommonBitmap::load(const char* path)
 {
 	data_.clear();
+	resetDerived();
+	auto format = imageFormatOf(path);
+	if(format == IMAGE_RAW)
+		return toBoolResult(decodeRawFile(path,data_,width_,height_));
+	if(format == IMAGE_QOI)
+	{
+		std::vector<unsigned char> file;
+		auto error = lodepng::load_file(file,path);
+		if(error)
+			return toBoolResult(error);
+		return toBoolResult(decodeQoi(file.data(),file.size(),data_,width_,height_));
+	}
 	auto error = lodepng::decode(this->data_,this->width_,this->height_,path);
 	return toBoolResult(error);
 }
@@ -42,9 +107,11 @@ bool CommonBitmap::load(const char* path)
 void CommonBitmap::load(Bitmap * source, int x, int y, int width, int height)
 {
 	data_.clear();
+	resetDerived();
 	width_ = width;
 	height_ = height;
 	pixelStride_ = source->pixelStride_;
+	format_ = source->format_;
 	rowShift_ = pixelStride_ * width_;
 	data_.resize(rowShift_ * height_);
 	origin_ = data_.data();
@@ -52,9 +119,174 @@ void CommonBitmap::load(Bitmap * source, int x, int y, int width, int height)
 	{
 		memcpy(data_.data() + i * rowShift_,source->origin_ + (y + i) * source->rowShift_ + x * pixelStride_,rowShift_);
 	}
+	computeChannelSums();
+}
 
+void CommonBitmap::wrap(const unsigned char* pixels, unsigned int width, unsigned int height, std::shared_ptr<const void> owner, const uint64_t* channelSums)
+{
+	data_.clear();
+	resetDerived();
+	owner_ = std::move(owner);
+	width_ = width;
+	height_ = height;
+	format_ = PIXEL_RGBA;
+	pixelStride_ = 4;
+	rowShift_ = pixelStride_ * width_;
+	// templates are only read, the pointer is not const for Bitmap's sake
+	origin_ = const_cast<unsigned char*>(pixels);
+	if(channelSums)
+		std::copy(channelSums, channelSums + 3, channelSums_);
+	else
+		computeChannelSums();
+}
+
+void CommonBitmap::loadDownsampled(Bitmap * source, int x, int y, int width, int height, int scale)
+{
+	data_.clear();
+	resetDerived();
+	width_ = width;
+	height_ = height;
+	pixelStride_ = source->pixelStride_;
+	format_ = source->format_;
+	rowShift_ = pixelStride_ * width_;
+	data_.resize(rowShift_ * height_);
+	origin_ = data_.data();
+	int area = scale * scale;
+	std::vector<unsigned int> sums(rowShift_);
+	for(int i=0;i<height;i++)
+	{
+		std::fill(sums.begin(), sums.end(), 0);
+		for(int k=0;k<scale;k++)
+		{
+			const unsigned char* row = source->origin_ + (y + i * scale + k) * source->rowShift_ + x * pixelStride_;
+			for(int j=0;j<width;j++)
+			{
+				for(int m=0;m<scale;m++)
+				{
+					for(int c=0;c<pixelStride_;c++)
+						sums[j * pixelStride_ + c] += row[(j * scale + m) * pixelStride_ + c];
+				}
+			}
+		}
+		unsigned char* out = origin_ + i * rowShift_;
+		for(int j=0;j<rowShift_;j++)
+			out[j] = (sums[j] + area / 2) / area;
+	}
+	computeChannelSums();
+}
+
+CommonBitmap* CommonBitmap::pyramidLevel(int level, int phaseX, int phaseY)
+{
+	if(level <= 0)
+		return this;
+	if(level > MAX_PYRAMID_LEVEL)
+		return nullptr;
+	int scale = 1 << level;
+	std::lock_guard<std::mutex> lock(derivedMutex);
+	auto &phases = pyramid_[level-1];
+	if(phases.empty())
+		phases.resize(scale * scale);
+	auto &result = phases[phaseY * scale + phaseX];
+	if(!result)
+	{
+		result = std::make_shared<CommonBitmap>();
+		int width = phaseX < (int)width_ ? (width_ - phaseX) / scale : 0;
+		int height = phaseY < (int)height_ ? (height_ - phaseY) / scale : 0;
+		result->loadDownsampled(this, phaseX, phaseY, width, height, scale);
+	}
+	return result.get();
+}
+
+// sum of the channel differences to the right and lower neighbours
+static int pixelContrast(Bitmap* image, int x, int y)
+{
+	const unsigned char* pixel = image->origin_ + y * image->rowShift_ + x * image->pixelStride_;
+	int contrast = 0;
+	for(int c=0;c<3;c++)
+	{
+		int offset = channelOffset(image->format_, c);
+		if(x + 1 < (int)image->width_)
+			contrast += abs(pixel[offset] - pixel[image->pixelStride_ + offset]);
+		if(y + 1 < (int)image->height_)
+			contrast += abs(pixel[offset] - pixel[image->rowShift_ + offset]);
+	}
+	return contrast;
 }
-} // namespace vision
 
+void CommonBitmap::buildLuma()
+{
+	if(!luma_.empty() || width_ == 0 || height_ == 0)
+		return;
+	luma_.resize((size_t)width_ * height_);
+	computeLuma(this, luma_.data());
+	// a luma step of d stands for at most 2 * d of channel steps
+	uint64_t colorContrast = 0, lumaContrast = 0;
+	visitPixelFormat(format_, [this, &colorContrast, &lumaContrast](auto format)
+	{
+		using P = decltype(format);
+		for(unsigned int i=0;i<height_;i++)
+		{
+			const unsigned char* pixel = origin_ + i * rowShift_;
+			const unsigned char* luma = luma_.data() + (size_t)i * width_;
+			for(unsigned int j=1;j<width_;j++)
+			{
+				colorContrast += computePixelShiftSum<P, P>(pixel, pixel + pixelStride_);
+				lumaContrast += 2 * abs(luma[j] - luma[j - 1]);
+				pixel += pixelStride_;
+			}
+		}
+	});
+	lumaPattern_ = colorContrast > 0 && 2 * lumaContrast >= colorContrast;
+}
 
+const unsigned char* CommonBitmap::luma()
+{
+	std::lock_guard<std::mutex> lock(derivedMutex);
+	buildLuma();
+	return luma_.empty() ? nullptr : luma_.data();
+}
 
+bool CommonBitmap::isLumaPattern()
+{
+	std::lock_guard<std::mutex> lock(derivedMutex);
+	buildLuma();
+	return lumaPattern_;
+}
+
+const std::vector<SamplePoint>& CommonBitmap::samplePoints()
+{
+	std::lock_guard<std::mutex> lock(derivedMutex);
+	if(samplesReady_)
+		return samples_;
+	samplesReady_ = true;
+	if((int)(width_ * height_) < 4 * MAX_SAMPLE_POINTS)
+		return samples_;
+	std::vector<std::pair<int, SamplePoint>> best;
+	for(int cy=0;cy<SAMPLE_GRID;cy++)
+	{
+		for(int cx=0;cx<SAMPLE_GRID;cx++)
+		{
+			int x0 = width_ * cx / SAMPLE_GRID, x1 = width_ * (cx + 1) / SAMPLE_GRID;
+			int y0 = height_ * cy / SAMPLE_GRID, y1 = height_ * (cy + 1) / SAMPLE_GRID;
+			std::pair<int, SamplePoint> cell{-1, SamplePoint{0, 0}};
+			for(int y=y0;y<y1;y++)
+			{
+				for(int x=x0;x<x1;x++)
+				{
+					int contrast = pixelContrast(this, x, y);
+					if(contrast > cell.first)
+						cell = {contrast, SamplePoint{x, y}};
+				}
+			}
+			if(cell.first >= 0)
+				best.push_back(cell);
+		}
+	}
+	std::stable_sort(best.begin(), best.end(), [](const std::pair<int, SamplePoint>& a, const std::pair<int, SamplePoint>& b){
+		return a.first > b.first;
+	});
+	for(size_t i=0;i<best.size() && i<MAX_SAMPLE_POINTS;i++)
+		samples_.push_back(best[i].second);
+	return samples_;
+}
+} // namespace vision
@@ -2,24 +2,74 @@
 #define SVISION_PNG_IMAGE_H
 
 #include"Bitmap.h"
+#include"vision_codec.h"
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 
 namespace vision{
+constexpr int MAX_PYRAMID_LEVEL = 2;
+// distinctive pixels checked before a full template compare
+constexpr int MAX_SAMPLE_POINTS = 16;
+// samples are picked one per cell of a SAMPLE_GRID x SAMPLE_GRID grid
+constexpr int SAMPLE_GRID = 4;
+
+struct SamplePoint{
+	int x;
+	int y;
+};
+
 class CommonBitmap :public Bitmap
 {
 	std::vector<unsigned char> data_;
+	// keeps wrapped pixels alive, see wrap()
+	std::shared_ptr<const void> owner_;
 	const char* error_;
+	// level l holds 4^l images, one per phase of the template inside a 2^l block
+	std::vector<std::shared_ptr<CommonBitmap>> pyramid_[MAX_PYRAMID_LEVEL];
+	// sum of red, green and blue over the image, taken at load
+	uint64_t channelSums_[3];
+	std::vector<SamplePoint> samples_;
+	bool samplesReady_;
+	std::vector<unsigned char> luma_;
+	bool lumaPattern_;
+	void buildLuma();
+	void computeChannelSums();
+	void resetDerived();
 public:
 	CommonBitmap();
 	bool toBoolResult(unsigned int error);
-	bool load(const unsigned char* data, unsigned int size);
+	bool toBoolResult(const char* error);
+	bool load(const unsigned char* data, unsigned int size, ImageFormat format = IMAGE_PNG);
+	// the format is picked by the extension of path
 	bool load(const char* path);
 	void load(Bitmap * source,int x,int y,int width,int height);
+	// Uses tight 4-byte RGBA pixels held by owner in place. channelSums are
+	// computed when not given.
+	void wrap(const unsigned char* pixels,unsigned int width,unsigned int height,std::shared_ptr<const void> owner,const uint64_t* channelSums = nullptr);
+	// box filtered copy, every output pixel averages a scale*scale block of source
+	void loadDownsampled(Bitmap * source,int x,int y,int width,int height,int scale);
+	// this image without its first phaseX columns and phaseY rows, shrunk by
+	// 2^level, built on first use. Empty when nothing is left after shrinking.
+	CommonBitmap* pyramidLevel(int level,int phaseX,int phaseY);
 	const char* errorText(){
 		return error_;
 	}
+	const uint64_t* channelSums() const{
+		return channelSums_;
+	}
+	// High contrast pixels spread over the image, highest contrast first,
+	// picked on first use. Empty for images small enough to compare whole.
+	const std::vector<SamplePoint>& samplePoints();
+	// width_ * height_ lumas row after row, see vision_luma.h. Computed on
+	// first use, nullptr for an empty image.
+	const unsigned char* luma();
+	// Whether the lumas keep at least half of the contrast between
+	// neighbouring pixels, only then do they reject positions about as
+	// early as the full colors.
+	bool isLumaPattern();
 };
 
 
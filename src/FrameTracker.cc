@@ -0,0 +1,235 @@
+#include "FrameTracker.h"
+#include "vision_simd.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace vision {
+
+// whether a comes before b in the read order
+static bool isBefore(int order,const Point& a,const Point& b)
+{
+	bool columns = order <= DOWN_UP_RIGHT_LEFT;
+	bool outerReversed = columns ? (order == UP_DOWN_RIGHT_LEFT || order == DOWN_UP_RIGHT_LEFT)
+		: (order == LEFT_RIGHT_DOWN_UP || order == RIGHT_LEFT_DOWN_UP);
+	bool innerReversed = columns ? (order == DOWN_UP_LEFT_RIGHT || order == DOWN_UP_RIGHT_LEFT)
+		: (order == RIGHT_LEFT_UP_DOWN || order == RIGHT_LEFT_DOWN_UP);
+	int outerA = columns ? a.x : a.y;
+	int outerB = columns ? b.x : b.y;
+	if(outerA != outerB)
+		return outerReversed ? outerA > outerB : outerA < outerB;
+	int innerA = columns ? a.y : a.x;
+	int innerB = columns ? b.y : b.x;
+	return innerReversed ? innerA > innerB : innerA < innerB;
+}
+
+FrameTracker::FrameTracker(int tile)
+	:tile_(tile > 0 ? tile : DEFAULT_FRAME_TILE),width_(0),height_(0),pixelStride_(0),format_(PIXEL_RGBA),
+	columns_(0),rows_(0),frame_(0),dirtyTiles_(0),key_()
+{
+}
+
+int FrameTracker::update(Bitmap* bitmap)
+{
+	frame_++;
+	key_ = FrameKey::of(bitmap);
+	if(bitmap->origin_ == nullptr || bitmap->width_ == 0 || bitmap->height_ == 0)
+	{
+		width_ = height_ = columns_ = rows_ = dirtyTiles_ = 0;
+		previous_.clear();
+		changed_.clear();
+		answers_.clear();
+		return 0;
+	}
+	const size_t rowBytes = (size_t)bitmap->width_ * bitmap->pixelStride_;
+	if((int)bitmap->width_ != width_ || (int)bitmap->height_ != height_ || bitmap->pixelStride_ != pixelStride_ ||
+		bitmap->format_ != format_ || previous_.empty())
+	{
+		width_ = bitmap->width_;
+		height_ = bitmap->height_;
+		pixelStride_ = bitmap->pixelStride_;
+		format_ = bitmap->format_;
+		columns_ = (width_ + tile_ - 1) / tile_;
+		rows_ = (height_ + tile_ - 1) / tile_;
+		previous_.resize(rowBytes * height_);
+		for(int y = 0; y < height_; y++)
+			memcpy(previous_.data() + y * rowBytes, bitmap->origin_ + (size_t)y * bitmap->rowShift_, rowBytes);
+		changed_.assign((size_t)columns_ * rows_, frame_);
+		answers_.clear();
+		dirtyTiles_ = columns_ * rows_;
+		return dirtyTiles_;
+	}
+	dirtyTiles_ = 0;
+	for(int row = 0; row < rows_; row++)
+	{
+		int top = row * tile_;
+		int bottom = std::min(top + tile_, height_);
+		for(int column = 0; column < columns_; column++)
+		{
+			size_t offset = (size_t)column * tile_ * pixelStride_;
+			int bytes = (std::min((column + 1) * tile_, width_) - column * tile_) * pixelStride_;
+			bool dirty = false;
+			for(int y = top; y < bottom && !dirty; y++)
+				dirty = bytesDiffer(bitmap->origin_ + (size_t)y * bitmap->rowShift_ + offset,
+					previous_.data() + y * rowBytes + offset, bytes);
+			if(!dirty)
+				continue;
+			// only the tiles that changed are copied
+			for(int y = top; y < bottom; y++)
+				memcpy(previous_.data() + y * rowBytes + offset, bitmap->origin_ + (size_t)y * bitmap->rowShift_ + offset, bytes);
+			changed_[row * columns_ + column] = frame_;
+			dirtyTiles_++;
+		}
+	}
+	return dirtyTiles_;
+}
+
+bool FrameTracker::isTracked(const Bitmap* bitmap) const
+{
+	return width_ > 0 && key_ == FrameKey::of(bitmap);
+}
+
+bool FrameTracker::changedSince(uint64_t frame,int x,int y,int x1,int y1) const
+{
+	x = std::max(x, 0);
+	y = std::max(y, 0);
+	x1 = std::min(x1, width_);
+	y1 = std::min(y1, height_);
+	if(x1 <= x || y1 <= y)
+		return false;
+	for(int row = y / tile_; row <= (y1 - 1) / tile_; row++)
+	{
+		for(int column = x / tile_; column <= (x1 - 1) / tile_; column++)
+		{
+			if(changed_[row * columns_ + column] > frame)
+				return true;
+		}
+	}
+	return false;
+}
+
+bool FrameTracker::isDirty(int x,int y,int x1,int y1) const
+{
+	return frame_ > 0 && changedSince(frame_ - 1, x, y, x1, y1);
+}
+
+// Searches again the positions of [x, x1) * [y, y1) that read a tile changed
+// after frame. Returns -1 when they are too many to be worth splitting up.
+int FrameTracker::searchChanged(uint64_t frame,int x,int y,int x1,int y1,const QueryExtent& extent,int order,
+	const TrackedSearch& search,Point* out) const
+{
+	struct Rect{
+		int x;
+		int y;
+		int x1;
+		int y1;
+	};
+	// runs of changed tiles per tile row, a run continues the one of the
+	// row above when it spans the same columns
+	std::vector<Rect> tiles;
+	size_t rowStart = 0;
+	int left = std::max(x + extent.left, 0) / tile_;
+	int right = (std::min(x1 - 1 + extent.right, width_ - 1)) / tile_;
+	int top = std::max(y + extent.top, 0) / tile_;
+	int bottom = (std::min(y1 - 1 + extent.bottom, height_ - 1)) / tile_;
+	for(int row = top; row <= bottom; row++)
+	{
+		size_t rowEnd = tiles.size();
+		for(int column = left; column <= right; column++)
+		{
+			if(changed_[row * columns_ + column] <= frame)
+				continue;
+			int end = column;
+			while(end + 1 <= right && changed_[row * columns_ + end + 1] > frame)
+				end++;
+			auto above = std::find_if(tiles.begin() + rowStart, tiles.begin() + rowEnd, [&](const Rect& rect){
+				return rect.x == column && rect.x1 == end + 1 && rect.y1 == row;
+			});
+			if(above != tiles.begin() + rowEnd)
+				above->y1 = row + 1;
+			else
+				tiles.push_back(Rect{column, row, end + 1, row + 1});
+			column = end;
+		}
+		// runs that were not continued stay before rowStart
+		rowStart = std::stable_partition(tiles.begin() + rowStart, tiles.end(), [&](const Rect& rect){
+			return rect.y1 <= row;
+		}) - tiles.begin();
+	}
+	// the positions whose window overlaps a run
+	std::vector<Rect> positions;
+	int64_t area = 0;
+	for(auto& rect : tiles)
+	{
+		Rect position{
+			std::max(rect.x * tile_ - extent.right, x),
+			std::max(rect.y * tile_ - extent.bottom, y),
+			std::min(std::min(rect.x1 * tile_, width_) - extent.left, x1),
+			std::min(std::min(rect.y1 * tile_, height_) - extent.top, y1),
+		};
+		if(position.x1 <= position.x || position.y1 <= position.y)
+			continue;
+		area += (int64_t)(position.x1 - position.x) * (position.y1 - position.y);
+		positions.push_back(position);
+	}
+	if(area * 100 > (int64_t)(x1 - x) * (y1 - y) * FULL_RESCAN_PERCENT)
+		return -1;
+	int found = 0;
+	for(auto& position : positions)
+	{
+		Point point;
+		int index = search(position.x, position.y, position.x1, position.y1, &point);
+		if(index && (!found || isBefore(order, point, *out) ||
+			(point.x == out->x && point.y == out->y && index < found)))
+		{
+			found = index;
+			*out = point;
+		}
+	}
+	return found;
+}
+
+int FrameTracker::find(const std::string& key,Bitmap* bitmap,int x,int y,int x1,int y1,const QueryExtent& extent,
+	int order,const TrackedSearch& search,Point* out)
+{
+	if(!isTracked(bitmap) || order > RIGHT_LEFT_DOWN_UP)
+		return search(x, y, x1, y1, out);
+	int found = -1;
+	Point point;
+	auto it = answers_.find(key);
+	if(it != answers_.end())
+	{
+		Answer& answer = it->second;
+		if(!changedSince(answer.frame, x + extent.left, y + extent.top, x1 + extent.right, y1 + extent.bottom))
+		{
+			answer.frame = frame_;
+			*out = answer.point;
+			return answer.found;
+		}
+		// A remembered match that still reads the same pixels still matches,
+		// and the unchanged positions before it still do not. Without one no
+		// unchanged position matches.
+		const Point& last = answer.point;
+		if(!answer.found || !changedSince(answer.frame, last.x + extent.left, last.y + extent.top,
+			last.x + extent.right + 1, last.y + extent.bottom + 1))
+		{
+			found = searchChanged(answer.frame, x, y, x1, y1, extent, order, search, &point);
+			if(found >= 0 && answer.found && (!found || isBefore(order, last, point)))
+			{
+				found = answer.found;
+				point = last;
+			}
+		}
+	}
+	if(found < 0)
+		found = search(x, y, x1, y1, &point);
+	if(!found)
+		point = Point(-1, -1);
+	if(answers_.size() >= MAX_TRACKED_QUERIES && it == answers_.end())
+		answers_.clear();
+	answers_[key] = Answer{frame_, found, point};
+	*out = point;
+	return found;
+}
+
+} // namespace vision
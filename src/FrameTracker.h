@@ -0,0 +1,87 @@
+#ifndef SVISION_FRAME_TRACKER_H
+#define SVISION_FRAME_TRACKER_H
+
+#include "Bitmap.h"
+#include "vision_index.h"
+#include "vision_util.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vision{
+
+constexpr int DEFAULT_FRAME_TILE = 32;
+// queries remembered per tracker, all of them are dropped past this
+constexpr size_t MAX_TRACKED_QUERIES = 256;
+// a re-scan of more than this share of the searched positions runs as one full search
+constexpr int FULL_RESCAN_PERCENT = 50;
+
+// The pixels a match at (x, y) reads: [x + left, x + right] * [y + top, y + bottom]
+struct QueryExtent{
+	int left;
+	int top;
+	int right;
+	int bottom;
+};
+
+// Searches [x, x1) * [y, y1) of the tracked bitmap, returns 0 when nothing
+// matches or the 1-based index of the target that matched at out
+using TrackedSearch = std::function<int(int x,int y,int x1,int y1,Point* out)>;
+
+// Compares each frame with the previous one tile by tile and remembers the
+// answers of repeated queries. A query whose pixels are all in tiles that
+// did not change since its last answer is answered from memory, otherwise
+// only the positions that read a changed tile are searched again.
+class FrameTracker
+{
+	struct Answer{
+		uint64_t frame;
+		int found;
+		Point point;
+	};
+	int tile_;
+	int width_;
+	int height_;
+	int pixelStride_;
+	PixelFormat format_;
+	int columns_;
+	int rows_;
+	// the last frame, rows of width_ * pixelStride_ bytes
+	std::vector<unsigned char> previous_;
+	// the update each tile last changed in
+	std::vector<uint64_t> changed_;
+	uint64_t frame_;
+	int dirtyTiles_;
+	FrameKey key_;
+	std::unordered_map<std::string,Answer> answers_;
+	bool isTracked(const Bitmap* bitmap) const;
+	// whether a tile of the pixel rectangle changed after frame
+	bool changedSince(uint64_t frame,int x,int y,int x1,int y1) const;
+	int searchChanged(uint64_t frame,int x,int y,int x1,int y1,const QueryExtent& extent,int order,
+		const TrackedSearch& search,Point* out) const;
+public:
+	explicit FrameTracker(int tile = DEFAULT_FRAME_TILE);
+	// Takes bitmap as the new frame and returns how many tiles differ from
+	// the last one. Every tile differs when the size or the layout changed.
+	int update(Bitmap* bitmap);
+	// whether a tile of [x, x1) * [y, y1) changed in the last update
+	bool isDirty(int x,int y,int x1,int y1) const;
+	int dirtyTiles() const{
+		return dirtyTiles_;
+	}
+	int tileSize() const{
+		return tile_;
+	}
+	// search answers the query key, which names the target and the search
+	// area, on bitmap. Bitmaps other than the last updated frame are
+	// searched in full and not remembered.
+	int find(const std::string& key,Bitmap* bitmap,int x,int y,int x1,int y1,const QueryExtent& extent,
+		int order,const TrackedSearch& search,Point* out);
+};
+
+} // namespace vision
+
+#endif //SVISION_FRAME_TRACKER_H
@@ -0,0 +1,100 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vision {
+
+MappedFile::MappedFile()
+	: data_(nullptr),size_(0)
+#ifdef _WIN32
+	,handle_(nullptr)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+const char* MappedFile::open(const char* path)
+{
+	close();
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+		return "failed to open file for reading";
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return "file is empty";
+	}
+	handle_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if(handle_ == nullptr)
+		return "failed to map file";
+	data_ = (const unsigned char*)MapViewOfFile(handle_, FILE_MAP_READ, 0, 0, 0);
+	if(data_ == nullptr)
+	{
+		close();
+		return "failed to map file";
+	}
+	size_ = (size_t)size.QuadPart;
+	return nullptr;
+}
+
+void MappedFile::close()
+{
+	if(data_)
+		UnmapViewOfFile(data_);
+	if(handle_)
+		CloseHandle(handle_);
+	data_ = nullptr;
+	handle_ = nullptr;
+	size_ = 0;
+}
+
+#else
+
+const char* MappedFile::open(const char* path)
+{
+	close();
+	int fd = ::open(path, O_RDONLY);
+	if(fd < 0)
+		return "failed to open file for reading";
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return "file is empty";
+	}
+	// the mapping stays valid after the descriptor is closed
+	void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(data == MAP_FAILED)
+		return "failed to map file";
+	data_ = (const unsigned char*)data;
+	size_ = info.st_size;
+	return nullptr;
+}
+
+void MappedFile::close()
+{
+	if(data_)
+		munmap((void*)data_, size_);
+	data_ = nullptr;
+	size_ = 0;
+}
+
+#endif // _WIN32
+
+} // namespace vision
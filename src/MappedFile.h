@@ -0,0 +1,34 @@
+#ifndef SVISION_MAPPED_FILE_H
+#define SVISION_MAPPED_FILE_H
+
+#include <cstddef>
+
+namespace vision{
+
+// A whole file mapped read only
+class MappedFile
+{
+	const unsigned char* data_;
+	size_t size_;
+#ifdef _WIN32
+	void* handle_;
+#endif
+public:
+	MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+	// nullptr, or the reason the file could not be mapped
+	const char* open(const char* path);
+	void close();
+	const unsigned char* data() const{
+		return data_;
+	}
+	size_t size() const{
+		return size_;
+	}
+};
+
+} // namespace vision
+
+#endif //SVISION_MAPPED_FILE_H
@@ -0,0 +1,248 @@
+#include "SharedFrameBitmap.h"
+
+#include <atomic>
+#include <climits>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vision {
+
+SharedFrameBitmap::SharedFrameBitmap()
+	: Bitmap(),file_(false),error_(nullptr),mapping_(nullptr),mappedSize_(0),sequence_(0)
+#ifdef _WIN32
+	,handle_(nullptr)
+#else
+	,fd_(-1)
+#endif
+{
+	origin_ = nullptr;
+	width_ = 0;
+	height_ = 0;
+	rowShift_ = 0;
+	pixelStride_ = 4;
+}
+
+SharedFrameBitmap::~SharedFrameBitmap()
+{
+	close();
+}
+
+bool SharedFrameBitmap::fail(const char* error)
+{
+	error_ = error;
+	origin_ = nullptr;
+	width_ = 0;
+	height_ = 0;
+	return false;
+}
+
+#ifdef _WIN32
+
+bool SharedFrameBitmap::open(const char* name,bool file)
+{
+	close();
+	name_ = name;
+	file_ = file;
+	handle_ = file ? CreateFileA(name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr) : OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+	if(handle_ == INVALID_HANDLE_VALUE)
+		handle_ = nullptr;
+	if(handle_ == nullptr)
+		return fail("cannot open the frame region");
+	if(!map())
+		return false;
+	refresh();
+	return error_ == nullptr;
+}
+
+bool SharedFrameBitmap::map()
+{
+	HANDLE mapping = handle_;
+	if(file_)
+	{
+		// a file mapping object has the size of the file when it was created
+		mapping = CreateFileMappingA(handle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if(mapping == nullptr)
+			return fail("cannot map the frame region");
+	}
+	mapping_ = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if(file_)
+		CloseHandle(mapping);
+	if(mapping_ == nullptr)
+		return fail("cannot map the frame region");
+	MEMORY_BASIC_INFORMATION info;
+	mappedSize_ = VirtualQuery(mapping_, &info, sizeof(info)) ? info.RegionSize : 0;
+	if(mappedSize_ < sizeof(SharedFrameHeader))
+		return fail("the frame region is smaller than its header");
+	return true;
+}
+
+void SharedFrameBitmap::unmap()
+{
+	if(mapping_)
+		UnmapViewOfFile(mapping_);
+	mapping_ = nullptr;
+	mappedSize_ = 0;
+}
+
+bool SharedFrameBitmap::checkSize()
+{
+	// a file cannot be truncated while a view of it is mapped, and named
+	// mappings keep the size they were created with
+	return true;
+}
+
+void SharedFrameBitmap::close()
+{
+	unmap();
+	if(handle_)
+		CloseHandle(handle_);
+	handle_ = nullptr;
+	fail(nullptr);
+}
+
+#else
+
+bool SharedFrameBitmap::open(const char* name,bool file)
+{
+	close();
+	name_ = name;
+	file_ = file;
+#if __ANDROID__
+	// bionic has no shm_open, producers share a file (or an ashmem fd path) instead
+	if(!file)
+		return fail("shared memory names are not supported, open a file");
+	fd_ = ::open(name, O_RDONLY);
+#else
+	fd_ = file ? ::open(name, O_RDONLY) : shm_open(name, O_RDONLY, 0);
+#endif
+	if(fd_ < 0)
+		return fail("cannot open the frame region");
+	if(!map())
+		return false;
+	refresh();
+	return error_ == nullptr;
+}
+
+bool SharedFrameBitmap::map()
+{
+	struct stat info;
+	if(fstat(fd_, &info) != 0)
+		return fail("cannot read the size of the frame region");
+	if((size_t)info.st_size < sizeof(SharedFrameHeader))
+		return fail("the frame region is smaller than its header");
+	void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+	if(mapping == MAP_FAILED)
+		return fail("cannot map the frame region");
+	mapping_ = (unsigned char*)mapping;
+	mappedSize_ = info.st_size;
+	return true;
+}
+
+void SharedFrameBitmap::unmap()
+{
+	if(mapping_)
+		munmap(mapping_, mappedSize_);
+	mapping_ = nullptr;
+	mappedSize_ = 0;
+}
+
+bool SharedFrameBitmap::checkSize()
+{
+	struct stat info;
+	if(fstat(fd_, &info) != 0)
+		return fail("cannot read the size of the frame region");
+	if((size_t)info.st_size == mappedSize_)
+		return true;
+	// reading the pages past the end of a truncated file raises SIGBUS
+	unmap();
+	return map();
+}
+
+void SharedFrameBitmap::close()
+{
+	unmap();
+	if(fd_ >= 0)
+		::close(fd_);
+	fd_ = -1;
+	fail(nullptr);
+}
+
+#endif // _WIN32
+
+// Copies the header, again while the producer was rewriting it before or
+// during the copy
+bool SharedFrameBitmap::readHeader(SharedFrameHeader* frame)
+{
+	auto header = (const volatile SharedFrameHeader*)mapping_;
+	for(int i = 0; i < SHARED_FRAME_READ_TRIES; i++)
+	{
+		frame->sequence = header->sequence;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		// an odd sequence, the producer is between its two stores
+		if(frame->sequence & 1)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		frame->magic = header->magic;
+		frame->version = header->version;
+		frame->width = header->width;
+		frame->height = header->height;
+		frame->stride = header->stride;
+		frame->pixelStride = header->pixelStride;
+		frame->format = header->format;
+		frame->offset = header->offset;
+		// a producer that started the next frame during the copy changed
+		// sequence before any of the fields
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(header->sequence == frame->sequence)
+			return true;
+	}
+	return fail("the shared frame header keeps changing");
+}
+
+bool SharedFrameBitmap::refresh()
+{
+	if(mapping_ == nullptr && !map())
+		return false;
+	SharedFrameHeader frame;
+	if(!readHeader(&frame))
+		return false;
+	uint64_t sequence = frame.sequence;
+	if(frame.magic != SHARED_FRAME_MAGIC || frame.version != SHARED_FRAME_VERSION)
+		return fail("the region does not hold a shared frame");
+	if(frame.format > PIXEL_GRAY8 || frame.width == 0 || frame.height == 0 ||
+		frame.pixelStride < (uint32_t)pixelFormatBytes((PixelFormat)frame.format) ||
+		(uint64_t)frame.width * frame.pixelStride > frame.stride ||
+		(uint64_t)frame.stride * frame.height > INT_MAX)
+		return fail("invalid shared frame layout");
+	uint64_t end = frame.offset + (uint64_t)frame.stride * (frame.height - 1) + (uint64_t)frame.width * frame.pixelStride;
+	// the producer may have grown or truncated the region for a new frame
+	if((sequence != sequence_ || end > mappedSize_) && !checkSize())
+		return false;
+	if(end > mappedSize_)
+		return fail("the frame is larger than its region");
+	origin_ = mapping_ + frame.offset;
+	width_ = frame.width;
+	height_ = frame.height;
+	rowShift_ = frame.stride;
+	pixelStride_ = frame.pixelStride;
+	format_ = (PixelFormat)frame.format;
+	error_ = nullptr;
+	bool changed = sequence != sequence_ || !cacheable_;
+	sequence_ = sequence;
+	if(changed)
+		invalidate();
+	return changed;
+}
+
+} // namespace vision
@@ -0,0 +1,89 @@
+#ifndef SVISION_SHARED_FRAME_BITMAP_H
+#define SVISION_SHARED_FRAME_BITMAP_H
+
+#include "Bitmap.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace vision{
+
+constexpr uint32_t SHARED_FRAME_MAGIC = 0x52465653; // "SVFR"
+// 3: sequence is odd while the producer rewrites the header
+constexpr uint32_t SHARED_FRAME_VERSION = 3;
+// reads of a header the producer keeps rewriting before refresh gives up
+constexpr int SHARED_FRAME_READ_TRIES = 64;
+
+// Layout the producer writes at the start of the region. Pixels live at
+// offset from the start of the region, so a producer can double buffer by
+// filling the other buffer and then publishing its offset.
+// sequence guards the other fields like a seqlock, to publish a frame the
+// producer
+//   1. stores sequence + 1, an odd value, then a release fence,
+//   2. writes the fields,
+//   3. stores sequence + 2 with release ordering.
+// A reader copies the fields between two reads of sequence and keeps the
+// copy only when both reads are the same even value, so sequence is even
+// and grows by two for every published frame.
+struct SharedFrameHeader{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	// bytes per row and per pixel, pixelStride is at least the size of a
+	// format pixel
+	uint32_t stride;
+	uint32_t pixelStride;
+	// a PixelFormat
+	uint32_t format;
+	uint32_t reserved;
+	uint64_t offset;
+	uint64_t sequence;
+};
+
+// A Bitmap over frames another process publishes in POSIX shared memory or
+// a plain file, the pixels are read in place.
+class SharedFrameBitmap :public Bitmap
+{
+	std::string name_;
+	bool file_;
+	const char* error_;
+	unsigned char* mapping_;
+	size_t mappedSize_;
+	uint64_t sequence_;
+#ifdef _WIN32
+	void* handle_;
+#else
+	int fd_;
+#endif
+	bool map();
+	void unmap();
+	// maps the region again when its size changed since it was mapped
+	bool checkSize();
+	bool readHeader(SharedFrameHeader* frame);
+	bool fail(const char* error);
+public:
+	SharedFrameBitmap();
+	SharedFrameBitmap(const SharedFrameBitmap&) = delete;
+	SharedFrameBitmap& operator=(const SharedFrameBitmap&) = delete;
+	~SharedFrameBitmap();
+	// name is a shm_open name, or a file path when file is true
+	bool open(const char* name,bool file);
+	void close();
+	// Picks up the latest published frame, mapping the region again when
+	// the producer resized it. Returns true when the sequence changed, the
+	// frame caches are invalidated then. Leaves an empty bitmap and returns
+	// false when the header is not valid.
+	bool refresh();
+	uint64_t sequence() const{
+		return sequence_;
+	}
+	const char* errorText(){
+		return error_;
+	}
+};
+
+} // namespace vision
+
+#endif //SVISION_SHARED_FRAME_BITMAP_H
@@ -0,0 +1,119 @@
+#include "ThreadPool.h"
+#include <memory>
+
+namespace vision {
+
+ThreadPool::ThreadPool(int threads)
+	:stopping_(false)
+{
+	for(int i=0;i<threads;i++)
+		workers_.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	wake_.notify_all();
+	for(auto &worker:workers_)
+		worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		tasks_.push_back(std::move(task));
+	}
+	wake_.notify_one();
+}
+
+void ThreadPool::work()
+{
+	while(true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			wake_.wait(lock, [this]{ return stopping_ || !tasks_.empty(); });
+			if(tasks_.empty())
+				return;
+			task = std::move(tasks_.front());
+			tasks_.pop_front();
+		}
+		task();
+	}
+}
+
+static std::mutex scanPoolMutex;
+static std::shared_ptr<ThreadPool> scanPool;
+static int scanThreads = 1;
+
+void setScanThreadCount(int count)
+{
+	if(count < 1)
+		count = 1;
+	std::shared_ptr<ThreadPool> old;
+	{
+		std::lock_guard<std::mutex> lock(scanPoolMutex);
+		if(count == scanThreads)
+			return;
+		old = std::move(scanPool);
+		scanThreads = count;
+		if(count > 1)
+			scanPool = std::make_shared<ThreadPool>(count - 1);
+	}
+	// scans still holding the old pool keep it alive until they finish
+}
+
+int scanThreadCount()
+{
+	std::lock_guard<std::mutex> lock(scanPoolMutex);
+	return scanThreads;
+}
+
+auto scanThreadPool()->std::shared_ptr<ThreadPool>
+{
+	std::lock_guard<std::mutex> lock(scanPoolMutex);
+	return scanPool;
+}
+
+static std::mutex searchPoolMutex;
+static std::shared_ptr<ThreadPool> searchPool;
+static int searchThreads = 1;
+
+void setSearchThreadCount(int count)
+{
+	if(count < 1)
+		count = 1;
+	std::shared_ptr<ThreadPool> old;
+	{
+		std::lock_guard<std::mutex> lock(searchPoolMutex);
+		if(count == searchThreads)
+			return;
+		old = std::move(searchPool);
+		searchThreads = count;
+	}
+	// The old pool runs the searches it was given before its workers join,
+	// which must not hold up the caller. Its tasks do not own it.
+	if(old)
+		std::thread([old = std::move(old)]() mutable { old.reset(); }).detach();
+}
+
+int searchThreadCount()
+{
+	std::lock_guard<std::mutex> lock(searchPoolMutex);
+	return searchThreads;
+}
+
+auto searchThreadPool()->std::shared_ptr<ThreadPool>
+{
+	std::lock_guard<std::mutex> lock(searchPoolMutex);
+	if(!searchPool)
+		searchPool = std::make_shared<ThreadPool>(searchThreads);
+	return searchPool;
+}
+
+} // namespace vision
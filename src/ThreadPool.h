@@ -0,0 +1,49 @@
+#ifndef __VISION_THREAD_POOL_H__
+#define __VISION_THREAD_POOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vision {
+
+class ThreadPool
+{
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::deque<std::function<void()>> tasks_;
+	std::vector<std::thread> workers_;
+	bool stopping_;
+	void work();
+public:
+	explicit ThreadPool(int threads);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	void submit(std::function<void()> task);
+	int size() const{
+		return static_cast<int>(workers_.size());
+	}
+};
+
+// Threads used by a single scan, the caller counts as one of them. 1, the
+// default, keeps every scan on the calling thread.
+void setScanThreadCount(int count);
+int scanThreadCount();
+// pool of scanThreadCount()-1 workers, nullptr while scans are single threaded
+auto scanThreadPool()->std::shared_ptr<ThreadPool>;
+
+// Threads running asynchronous searches, 1 by default. Each of them still
+// splits its scan over the scan pool.
+void setSearchThreadCount(int count);
+int searchThreadCount();
+// created on first use
+auto searchThreadPool()->std::shared_ptr<ThreadPool>;
+
+} // namespace vision
+
+#endif // __VISION_THREAD_POOL_H__
@@ -0,0 +1,110 @@
+#ifndef __VISION_LRU_CACHE_H__
+#define __VISION_LRU_CACHE_H__
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace vision {
+
+struct CacheStats{
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+  size_t size;
+  size_t cost;
+  size_t capacity;
+};
+
+// String keyed LRU cache shared between lua states, bounded by the sum of the
+// entries' cost. Values are handed out as shared_ptr so an evicted entry stays
+// alive until the last caller is done with it.
+template<class TValue>
+class LruCache{
+public:
+  using ValuePtr = std::shared_ptr<TValue>;
+
+  explicit LruCache(size_t capacity)
+    :capacity_(capacity){}
+
+  auto get(std::string_view key)->ValuePtr{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if(it == index_.end()){
+      misses_++;
+      return nullptr;
+    }
+    hits_++;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->value;
+  }
+
+  void put(std::string_view key, ValuePtr value, size_t cost = 1){
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if(it != index_.end()){
+      auto entry = it->second;
+      cost_ -= entry->cost;
+      index_.erase(it);
+      entries_.erase(entry);
+    }
+    if(cost > capacity_) return;
+    entries_.push_front(Entry{std::string(key), std::move(value), cost});
+    index_.emplace(entries_.front().key, entries_.begin());
+    cost_ += cost;
+    trim();
+  }
+
+  void clear(){
+    std::lock_guard<std::mutex> lock(mutex_);
+    index_.clear();
+    entries_.clear();
+    cost_ = 0;
+  }
+
+  void setCapacity(size_t capacity){
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+    trim();
+  }
+
+  auto stats()->CacheStats{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return CacheStats{hits_, misses_, evictions_, entries_.size(), cost_, capacity_};
+  }
+
+private:
+  struct Entry{
+    std::string key;
+    ValuePtr value;
+    size_t cost;
+  };
+
+  void trim(){
+    while(cost_ > capacity_ && !entries_.empty()){
+      auto &last = entries_.back();
+      cost_ -= last.cost;
+      index_.erase(last.key);
+      entries_.pop_back();
+      evictions_++;
+    }
+  }
+
+  std::mutex mutex_;
+  std::list<Entry> entries_;
+  // keys view the string owned by the list node, list nodes never move
+  std::unordered_map<std::string_view, typename std::list<Entry>::iterator> index_;
+  size_t capacity_;
+  size_t cost_ = 0;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+  size_t evictions_ = 0;
+};
+
+} // namespace vision
+
+#endif // __VISION_LRU_CACHE_H__
@@ -4,17 +4,28 @@
 
 #include "CommonBitmap.h"
 #include "lodepng.h"
+#include "lru_cache.h"
 #include "lua_util.h"
+#include <cstdio>
 #include <filesystem>
 #include <lauxlib.h>
 #include <lua.h>
 #include <lua.hpp>
+#include <memory>
 #include <vector>
 
 #include "Bitmap.h"
+#include "BitmapView.h"
+#include "FrameTracker.h"
+#include "SharedFrameBitmap.h"
 #include "vision.h"
+#include "vision_async.h"
+#include "vision_batch.h"
+#include "vision_codec.h"
 #include "vision_color.h"
 #include "vision_feature.h"
+#include "vision_image.h"
+#include "vision_pack.h"
 #include "vision_util.h"
 
 
@@ -31,8 +42,13 @@ name(lua_upvalueindex(1),0,ByUpData)\
 name(1,1,)
 
 static constexpr char COORDINATES_OVERFLOW[] = "The coordinates are off screen";
+static constexpr int DEFAULT_FIND_ALL_COUNT = 100;
 static ResourceProvider resourceProvider = nullptr;
 
+auto setResourceProvider(ResourceProvider provider) -> void{
+  resourceProvider = std::move(provider);
+}
+
 DEFINE_METHOD(getColor);
 DEFINE_METHOD(getColorCount);
 DEFINE_METHOD(isColor);
@@ -40,15 +56,62 @@ DEFINE_METHOD(whichColor);
 DEFINE_METHOD(findColor);
 DEFINE_METHOD(isFeature);
 DEFINE_METHOD(findFeature);
+DEFINE_METHOD(findFeatures);
 DEFINE_METHOD(isImage);
 DEFINE_METHOD(whichImage);
 DEFINE_METHOD(findImage);
+DEFINE_METHOD(findAllColor);
+DEFINE_METHOD(findAllFeature);
+DEFINE_METHOD(findAllImage);
+DEFINE_METHOD(invalidate);
+DEFINE_METHOD(batch);
+DEFINE_METHOD(findColorAsync);
+DEFINE_METHOD(findFeatureAsync);
+DEFINE_METHOD(findImageAsync);
 
 static auto loadImage(lua_State*L)->int;
+static auto featureCacheStats(lua_State*L)->int;
+static auto setFeatureCacheSize(lua_State*L)->int;
+static auto imageCacheStats(lua_State*L)->int;
+static auto setImageCacheSize(lua_State*L)->int;
+static auto flushImageCache(lua_State*L)->int;
+static auto setThreadCount(lua_State*L)->int;
+static auto getThreadCount(lua_State*L)->int;
 static auto indexMethod(lua_State*L)->int;
 static auto saveImageTo(lua_State*L)->int;
 static auto cloneImage(lua_State*L)->int;
 static auto getImageSize(lua_State*L)->int;
+static auto wrapImage(lua_State*L)->int;
+static auto releaseView(lua_State*L)->int;
+static auto finishView(lua_State*L)->int;
+static auto openSharedFrame(lua_State*L)->int;
+static auto openPack(lua_State*L)->int;
+static auto refreshFrame(lua_State*L)->int;
+static auto closeFrame(lua_State*L)->int;
+static auto newFrameTracker(lua_State*L)->int;
+static auto updateTracker(lua_State*L)->int;
+static auto isTrackerDirty(lua_State*L)->int;
+static auto trackedFindColor(lua_State*L)->int;
+static auto trackedFindFeature(lua_State*L)->int;
+static auto trackedFindImage(lua_State*L)->int;
+static auto pollSearches(lua_State*L)->int;
+static auto isSearchDone(lua_State*L)->int;
+static auto searchResult(lua_State*L)->int;
+static auto awaitSearch(lua_State*L)->int;
+static auto finishSearch(lua_State*L)->int;
+
+// The completed searches of one Lua state, kept in its registry
+struct SearchQueue{
+  std::shared_ptr<CompletionQueue> queue = std::make_shared<CompletionQueue>();
+};
+
+// What bitmap:findXAsync returns, the bitmap searched is its user value
+struct SearchHandle{
+  SearchPtr search;
+  // the values findX returns
+  int results;
+  explicit SearchHandle(int results):results(results){}
+};
 
 
 
@@ -60,9 +123,33 @@ static auto getImageSize(lua_State*L)->int;
   {"findColor", findColor},\
   {"isFeature", isFeature},\
   {"findFeature", findFeature},\
+  {"findFeatures", findFeatures},\
   {"isImage", isImage},\
   {"whichImage", whichImage},\
   {"findImage", findImage},\
+  {"findAllColor", findAllColor},\
+  {"findAllFeature", findAllFeature},\
+  {"findAllImage", findAllImage},\
+  {"invalidate", invalidate},\
+  {"batch", batch},\
+  {"findColorAsync", findColorAsync},\
+  {"findFeatureAsync", findFeatureAsync},\
+  {"findImageAsync", findImageAsync},\
+
+#define MODULE_FUNCTIONS \
+  {"loadImage",loadImage},\
+  {"wrapImage",wrapImage},\
+  {"openSharedFrame",openSharedFrame},\
+  {"openPack",openPack},\
+  {"newFrameTracker",newFrameTracker},\
+  {"pollSearches",pollSearches},\
+  {"featureCacheStats",featureCacheStats},\
+  {"setFeatureCacheSize",setFeatureCacheSize},\
+  {"imageCacheStats",imageCacheStats},\
+  {"setImageCacheSize",setImageCacheSize},\
+  {"flushImageCache",flushImageCache},\
+  {"setThreadCount",setThreadCount},\
+  {"getThreadCount",getThreadCount},\
 
 #define COMMON_BITMAP_METHODS \
   BASE_METHODS \
@@ -107,9 +194,18 @@ void eachCompareColorMethodByUpData(CompareColorMethodReceiver receiver, void *d
     {"findColor", findColorByUpData},
     {"isFeature", isFeatureByUpData},
     {"findFeature", findFeatureByUpData},
+    {"findFeatures", findFeaturesByUpData},
     {"isImage", isImageByUpData},
     {"whichImage", whichImageByUpData},
     {"findImage", findImageByUpData},
+    {"findAllColor", findAllColorByUpData},
+    {"findAllFeature", findAllFeatureByUpData},
+    {"findAllImage", findAllImageByUpData},
+    {"invalidate", invalidateByUpData},
+    {"batch", batchByUpData},
+    {"findColorAsync", findColorAsyncByUpData},
+    {"findFeatureAsync", findFeatureAsyncByUpData},
+    {"findImageAsync", findImageAsyncByUpData},
   };
 
   for(auto &method:methods){
@@ -133,7 +229,65 @@ void ensureInjectCommonBitmap(lua_State*L){
     };
     luaL_setfuncs(L, methods, 0);
   }
+  lua_pop(L,1);
+  if(luaL_newClassMetatable(BitmapView, L)){
+    lua_pushvalue(L, -2);
+    lua_setmetatable(L, -2);
+    luaL_Reg methods[] = {
+      {"__index",indexMethod},
+      {"__gc",finishView},
+      {"release",releaseView},
+      {nullptr, nullptr}
+    };
+    luaL_setfuncs(L, methods, 0);
+  }
+  lua_pop(L,1);
+  if(luaL_newClassMetatable(SharedFrameBitmap, L)){
+    lua_pushvalue(L, -2);
+    lua_setmetatable(L, -2);
+    luaL_Reg methods[] = {
+      {"__index",indexMethod},
+      {"__gc",lua::finish<SharedFrameBitmap>},
+      {"refresh",refreshFrame},
+      {"close",closeFrame},
+      {nullptr, nullptr}
+    };
+    luaL_setfuncs(L, methods, 0);
+  }
   lua_pop(L,2);
+  if(luaL_newClassMetatable(FrameTracker, L)){
+    luaL_Reg methods[] = {
+      {"__gc",lua::finish<FrameTracker>},
+      {"update",updateTracker},
+      {"isDirty",isTrackerDirty},
+      {"findColor",trackedFindColor},
+      {"findFeature",trackedFindFeature},
+      {"findImage",trackedFindImage},
+      {nullptr, nullptr}
+    };
+    luaL_setfuncs(L, methods, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_pop(L,1);
+  if(luaL_newClassMetatable(SearchHandle, L)){
+    luaL_Reg methods[] = {
+      {"__gc",finishSearch},
+      {"isDone",isSearchDone},
+      {"result",searchResult},
+      {"await",awaitSearch},
+      {nullptr, nullptr}
+    };
+    luaL_setfuncs(L, methods, 0);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_pop(L,1);
+  if(luaL_newClassMetatable(SearchQueue, L)){
+    lua_pushcfunction(L, lua::finish<SearchQueue>);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_pop(L,1);
 }
 
 static void pushFindOrderTable(struct lua_State*L){
@@ -149,8 +303,17 @@ static void pushFindOrderTable(struct lua_State*L){
 }
 
 int injectOther(struct lua_State*L){
-  lua_pushcfunction(L, loadImage);
-  lua_setglobal(L, "loadImage");
+  luaL_Reg functions[] = {
+    MODULE_FUNCTIONS
+    {nullptr, nullptr}
+  };
+  for(auto &function:functions){
+    if(function.name == nullptr) {
+      break;
+    }
+    lua_pushcfunction(L, function.func);
+    lua_setglobal(L, function.name);
+  }
   ensureInjectCommonBitmap(L);
   lua_geti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
   pushFindOrderTable(L);
@@ -166,7 +329,7 @@ auto luaopen_slv(struct lua_State *L) -> int{
     {"saveImage",saveImageTo},
     {"cloneImage",cloneImage},
     {"getImageSize",getImageSize},
-    {"loadImage",loadImage},
+    MODULE_FUNCTIONS
     {nullptr, nullptr}
   };
   luaL_newlib(L, methods);
@@ -215,6 +378,68 @@ static auto ensureFindOrder(lua_State*L,int index)->int{
 
 
 
+static auto ensurePyramidLevel(lua_State*L,int index)->int{
+  auto level = luaL_optinteger(L, index, 0);
+  if(level >= 0 && level <= MAX_PYRAMID_LEVEL){
+    return static_cast<int>(level);
+  }
+  luaL_error(L, "Pyramid level must be between 0 and %d", MAX_PYRAMID_LEVEL);
+  return 0;
+}
+
+static auto ensureMaxCount(lua_State*L,int index)->int{
+  auto count = luaL_optinteger(L, index, DEFAULT_FIND_ALL_COUNT);
+  if(count < 1 || count > INT32_MAX){
+    luaL_error(L, "Max count must be positive");
+  }
+  return static_cast<int>(count);
+}
+
+static auto ensureSpacing(lua_State*L,int index)->int{
+  auto spacing = luaL_optinteger(L, index, 0);
+  if(spacing < 0 || spacing > INT32_MAX){
+    luaL_error(L, "Spacing must not be negative");
+  }
+  return static_cast<int>(spacing);
+}
+
+// array of {x=,y=} tables, with index= when indexes are given
+static void pushPoints(lua_State*L,const std::vector<Point>&points,const std::vector<int>*indexes = nullptr){
+  lua_createtable(L, points.size(), 0);
+  for(size_t i = 0; i < points.size(); i++){
+    lua_createtable(L, 0, indexes ? 3 : 2);
+    lua_pushinteger(L, points[i].x);
+    lua_setfield(L, -2, "x");
+    lua_pushinteger(L, points[i].y);
+    lua_setfield(L, -2, "y");
+    if(indexes){
+      lua_pushinteger(L, indexes->at(i));
+      lua_setfield(L, -2, "index");
+    }
+    lua_rawseti(L, -2, i + 1);
+  }
+}
+
+// calls function with the concrete color type of a decoded color string
+template<class TFunction>
+static auto visitColor(ColorComposition*color,TFunction&&function){
+  if(color->next == nullptr){
+    switch (color->color.type) {
+      case TColorType::ALONE:
+        return function((Color*)color->color.data);
+      case TColorType::COLOR_GAMUT:
+        return function((ColorGamut*)color->color.data);
+      case TColorType::NOT:
+        return function((ColorNot*)color->color.data);
+      case TColorType::COLOR_GAMUT_NOT:
+        return function((ColorGamutNot*)color->color.data);
+      default:
+        break;
+    }
+  }
+  return function(color);
+}
+
 static auto checkIntColor(lua_State*L,int index)->Color{
   auto v = luaL_checkinteger(L, index);
   if(v < 0 || v > 0xFFFFFF){
@@ -444,13 +669,13 @@ auto isFeature##last(lua_State*L)->int{\
   auto sim = ensureSimilarity(L, originIndex+2);\
   size_t size = 0;\
   const char * featureString = luaL_checklstring(L,originIndex+1,&size);\
-  FeatureCompositionRoot feature;\
-  if(!decodeFeature(featureString, size, &feature)){\
+  auto feature = getCachedFeature(featureString, size);\
+  if(!feature){\
     luaL_error(L, "Invalid feature string");\
   }\
-  auto shiftSum = (1-sim)*255*feature.count;\
-  bool result = isFeature(bitmap, &feature, shiftSum);\
-  freeFeatureComposition(&feature);\
+  auto shiftSum = (1-sim)*255*feature->count;\
+  BoundFeature bound(feature.get(), bitmap);\
+  bool result = isFeature(bitmap, 0, 0, &bound, shiftSum);\
   lua_pushboolean(L, result);\
   return 1;\
 }
@@ -470,14 +695,15 @@ auto findFeature##last(lua_State*L)->int{\
   int order = ensureFindOrder(L, originIndex+7);\
   size_t featureSize = 0;\
   const char * featureString = luaL_checklstring(L,originIndex+5,&featureSize);\
-  FeatureCompositionRoot feature;\
-  if(!decodeFeature(featureString, featureSize, &feature)){\
+  auto feature = getCachedFeature(featureString, featureSize);\
+  if(!feature){\
     luaL_error(L, "Invalid feature string");\
   }\
-  auto shiftSum = (1-sim)*MAX_COLOR_SHIFT*feature.count;\
+  auto shiftSum = (1-sim)*MAX_COLOR_SHIFT*feature->count;\
   Point out(-1,-1);\
-  bool result = findFeature(bitmap, x, y, x1, y1, &feature, shiftSum, order, &out);\
-  freeFeatureComposition(&feature);\
+  BoundFeature bound(feature.get(), bitmap);\
+  bound.orderBySelectivity(bitmap, x, y, x1, y1);\
+  bool result = findFeature(bitmap, x, y, x1, y1, &bound, shiftSum, order, &out);\
   if(!result){\
     out.x = -1;\
     out.y = -1;\
@@ -487,43 +713,217 @@ auto findFeature##last(lua_State*L)->int{\
   return 2;\
 }
 
+// findFeatures(x, y, x1, y1, {feature, ...}, sim, order) looks for all the
+// features in one pass, x, y and the index of the feature that matched first
+#define FIND_FEATURES(bitmapIndex,originIndex,last)\
+auto findFeatures##last(lua_State*L)->int{\
+  checkUserData(L, bitmapIndex);\
+  auto bitmap = lua::toObject<Bitmap>(L, bitmapIndex);\
+  int x = luaL_checkinteger(L, originIndex+1);\
+  int y = luaL_checkinteger(L, originIndex+2);\
+  int x1 = luaL_checkinteger(L, originIndex+3);\
+  int y1 = luaL_checkinteger(L, originIndex+4);\
+  if(x1 == -1) x1 = bitmap->width_;\
+  if(y1 == -1) y1 = bitmap->height_;\
+  checkCoordinates(bitmap, L, x, y, x1, y1);\
+  luaL_checktype(L, originIndex+5, LUA_TTABLE);\
+  auto sim = ensureSimilarity(L, originIndex+6);\
+  int order = ensureFindOrder(L, originIndex+7);\
+  size_t count = lua_rawlen(L, originIndex+5);\
+  if(count > MAX_FEATURE_SET_SIZE){\
+    luaL_error(L, "At most %d features", (int)MAX_FEATURE_SET_SIZE);\
+  }\
+  std::vector<FeaturePtr> features;\
+  std::vector<int> shiftSums;\
+  for(size_t i = 1; i <= count; i++){\
+    lua_rawgeti(L, originIndex+5, i);\
+    size_t featureSize = 0;\
+    const char* featureString = lua_tolstring(L, -1, &featureSize);\
+    auto feature = featureString ? getCachedFeature(featureString, featureSize) : nullptr;\
+    lua_pop(L, 1);\
+    if(!feature){\
+      features.~vector();\
+      shiftSums.~vector();\
+      luaL_error(L, "Invalid feature string");\
+    }\
+    shiftSums.push_back((1-sim)*MAX_COLOR_SHIFT*feature->count);\
+    features.push_back(std::move(feature));\
+  }\
+  Point out(-1,-1);\
+  int index = 0;\
+  {\
+    FeatureSet set(bitmap, features, shiftSums);\
+    for(size_t i = 0; i < set.size(); i++){\
+      set.feature(i)->orderBySelectivity(bitmap, x, y, x1, y1);\
+    }\
+    index = findFeatures(bitmap, x, y, x1, y1, &set, order, &out);\
+  }\
+  if(!index){\
+    out.x = -1;\
+    out.y = -1;\
+  }\
+  lua_pushinteger(L, out.x);\
+  lua_pushinteger(L, out.y);\
+  lua_pushinteger(L, index ? index : -1);\
+  return 3;\
+}
+
+#define FIND_ALL_COLOR(bitmapIndex,originIndex,last)\
+auto findAllColor##last(lua_State*L)->int{\
+  checkUserData(L, bitmapIndex);\
+  auto bitmap = lua::toObject<Bitmap>(L, bitmapIndex);\
+  int x = luaL_checkinteger(L, originIndex+1);\
+  int y = luaL_checkinteger(L, originIndex+2);\
+  int x1 = luaL_checkinteger(L, originIndex+3);\
+  int y1 = luaL_checkinteger(L, originIndex+4);\
+  if(x1 == -1) x1 = bitmap->width_;\
+  if(y1 == -1) y1 = bitmap->height_;\
+  checkCoordinates(bitmap, L, x, y,x1,y1);\
+  int shift = ensureSimilarityAndToShift(L, originIndex+6);\
+  int order = ensureFindOrder(L, originIndex+7);\
+  int maxCount = ensureMaxCount(L, originIndex+8);\
+  int spacing = ensureSpacing(L, originIndex+9);\
+  std::vector<Point> points;\
+  if(lua_isinteger(L, originIndex+5)){\
+    Color color = checkIntColor(L, originIndex+5);\
+    findAllColor(bitmap, x, y, x1, y1, &color, shift, order, maxCount, spacing, &points);\
+  }else if(lua_isstring(L,originIndex+5)){\
+    size_t size = 0;\
+    auto *str = lua_tolstring(L, originIndex+5, &size);\
+    auto color = decodeColor(str , size);\
+    if(color == nullptr){\
+      luaL_error(L, "Invalid color string");\
+    }\
+    visitColor(color, [&](auto c){\
+      return findAllColor(bitmap, x, y, x1, y1, c, shift, order, maxCount, spacing, &points);\
+    });\
+    freeColorComposition(color);\
+  }else{\
+    luaL_error(L, "Invalid color type");\
+  }\
+  pushPoints(L, points);\
+  return 1;\
+}
+
+#define FIND_ALL_FEATURE(bitmapIndex,originIndex,last)\
+auto findAllFeature##last(lua_State*L)->int{\
+  checkUserData(L, bitmapIndex);\
+  auto bitmap = lua::toObject<Bitmap>(L, bitmapIndex);\
+  int x = luaL_checkinteger(L, originIndex+1);\
+  int y = luaL_checkinteger(L, originIndex+2);\
+  int x1 = luaL_checkinteger(L, originIndex+3);\
+  int y1 = luaL_checkinteger(L, originIndex+4);\
+  if(x1 == -1) x1 = bitmap->width_;\
+  if(y1 == -1) y1 = bitmap->height_;\
+  checkCoordinates(bitmap, L, x, y, x1, y1);\
+  auto sim = ensureSimilarity(L, originIndex+6);\
+  int order = ensureFindOrder(L, originIndex+7);\
+  int maxCount = ensureMaxCount(L, originIndex+8);\
+  int spacing = ensureSpacing(L, originIndex+9);\
+  size_t featureSize = 0;\
+  const char * featureString = luaL_checklstring(L,originIndex+5,&featureSize);\
+  auto feature = getCachedFeature(featureString, featureSize);\
+  if(!feature){\
+    luaL_error(L, "Invalid feature string");\
+  }\
+  auto shiftSum = (1-sim)*MAX_COLOR_SHIFT*feature->count;\
+  BoundFeature bound(feature.get(), bitmap);\
+  bound.orderBySelectivity(bitmap, x, y, x1, y1);\
+  std::vector<Point> points;\
+  findAllFeature(bitmap, x, y, x1, y1, &bound, shiftSum, order, maxCount, spacing, &points);\
+  pushPoints(L, points);\
+  return 1;\
+}
 
 
 auto loadImage(const std::string&path,std::string &cache, CommonBitmap*image)->bool{
   if(path.empty()){
     return false;
   }
+  if(auto packed = findPackedImage(path)){
+    image->load(packed.get(), 0, 0, packed->width_, packed->height_);
+    return true;
+  }
   if(path[0] == std::filesystem::path::preferred_separator){
     return image->load(path.c_str());
   }
   if(resourceProvider == nullptr || !resourceProvider(path, cache)){
     return image->load(path.c_str());
   }
-  return image->load((const unsigned char*)cache.data(), cache.size());
+  return image->load((const unsigned char*)cache.data(), cache.size(), imageFormatOf(path.c_str()));
+}
+
+using ImagePtr = std::shared_ptr<CommonBitmap>;
+constexpr size_t DEFAULT_IMAGE_CACHE_BYTES = 64 * 1024 * 1024;
+
+static auto imageCache()->LruCache<CommonBitmap>&{
+  static LruCache<CommonBitmap> cache(DEFAULT_IMAGE_CACHE_BYTES);
+  return cache;
+}
+
+// Templates are keyed by path plus a fingerprint of their source: a hash of
+// the bytes the resource provider returned, or the file's size and mtime,
+// so a changed resource is decoded again instead of served stale. Names
+// found in an opened pack skip all of that.
+auto loadCachedImage(const std::string&path,std::string &cache)->ImagePtr{
+  if(path.empty()){
+    return nullptr;
+  }
+  if(auto packed = findPackedImage(path)){
+    return packed;
+  }
+  std::string key = path;
+  key.push_back('\0');
+  bool fromProvider = path[0] != std::filesystem::path::preferred_separator &&
+    resourceProvider != nullptr && resourceProvider(path, cache);
+  if(fromProvider){
+    key += std::to_string(cache.size());
+    key.push_back(':');
+    key += std::to_string(std::hash<std::string_view>{}(cache));
+  }else{
+    std::error_code error;
+    auto fileSize = std::filesystem::file_size(path, error);
+    if(error){
+      return nullptr;
+    }
+    auto time = std::filesystem::last_write_time(path, error);
+    key += std::to_string(fileSize);
+    key.push_back(':');
+    key += std::to_string(time.time_since_epoch().count());
+  }
+  auto &images = imageCache();
+  if(auto image = images.get(key)){
+    return image;
+  }
+  auto image = std::make_shared<CommonBitmap>();
+  bool loaded = fromProvider ? image->load((const unsigned char*)cache.data(), cache.size(), imageFormatOf(path.c_str()))
+    : image->load(path.c_str());
+  if(!loaded){
+    return nullptr;
+  }
+  images.put(key, image, sizeof(CommonBitmap) + image->rowShift_ * image->height_);
+  return image;
 }
 
-auto loadImages(const char*names,size_t size,std::vector<CommonBitmap>&images)->bool{
+auto loadImages(const char*names,size_t size,std::vector<ImagePtr>&images)->bool{
   size_t start = 0;
   std::string name;
   std::string data;
-  for(size_t i = 0; i < size; i++){
-    data.clear();
-    if(names[i] == '|'){
-      auto &p = images.emplace_back();
-      name = std::string(names + start, i - start);
-      if(!loadImage(name, data, &p)){
+  for(size_t i = 0; i <= size; i++){
+    if(i == size || names[i] == '|'){
+      if(i == size && start >= size){
+        break;
+      }
+      data.clear();
+      name.assign(names + start, i - start);
+      auto image = loadCachedImage(name, data);
+      if(!image){
         return false;
       }
+      images.push_back(std::move(image));
       start = i + 1;
     }
   }
-  if(start < size){
-    auto &p = images.emplace_back();
-    name = std::string(names + start, size - start);
-    if(!loadImage(name, data, &p)){
-      return false;
-    }
-  }
   return true;
 }
 
@@ -538,14 +938,14 @@ auto isImage##last(lua_State*L)->int{\
   if(lua_isstring(L, originIndex+3)){\
     size_t size = 0;\
     const char*imageNames = luaL_checklstring(L, originIndex+3, &size);\
-    std::vector<CommonBitmap> images;\
+    std::vector<ImagePtr> images;\
     if(!loadImages(imageNames, size, images)){\
       images.~vector();\
       luaL_error(L, "Invalid image string");\
     }\
     auto onePointShiftSum = (1-sim)*MAX_COLOR_SHIFT;\
     for(auto&image:images){\
-      if(isImage(bitmap, x, y, &image ,image.width_*image.height_*onePointShiftSum)){\
+      if(isImage(bitmap, x, y, image.get() ,image->width_*image->height_*onePointShiftSum)){\
         lua_pushboolean(L, true);\
         return 1;\
       }\
@@ -568,15 +968,15 @@ auto whichImage##last(lua_State*L)->int{\
   if(lua_isstring(L, originIndex+3)){\
     size_t size = 0;\
     const char*imageNames = luaL_checklstring(L, originIndex+3, &size);\
-    std::vector<CommonBitmap> images;\
+    std::vector<ImagePtr> images;\
     if(!loadImages(imageNames, size, images)){\
       images.~vector();\
       luaL_error(L, "Invalid image string");\
     }\
     auto onePointShiftSum = (1-sim)*MAX_COLOR_SHIFT;\
     for(size_t i = 0; i < images.size(); i++){\
-      auto& image = images.at(1);\
-      if(isImage(bitmap, x, y, &image ,image.width_*image.height_*onePointShiftSum)){\
+      auto& image = images.at(i);\
+      if(isImage(bitmap, x, y, image.get() ,image->width_*image->height_*onePointShiftSum)){\
         lua_pushinteger(L, i+1);\
         return 1;\
       }\
@@ -593,14 +993,15 @@ auto whichImage##last(lua_State*L)->int{\
 
 class BitmapFinder{
   Bitmap * mBitmap;
-  Bitmap* tBitmap;
-  int mShiftSum;
+  ImageTarget mTarget;
+  std::shared_ptr<const SumTable> mSums;
+  std::shared_ptr<const LumaPlane> mLuma;
   Point result;
 public:
-  BitmapFinder(Bitmap*bitmap,Bitmap*templateBitmap,int shiftSum)
-    :mBitmap(bitmap),tBitmap(templateBitmap),mShiftSum(shiftSum){}
+  BitmapFinder(Bitmap*bitmap,CommonBitmap*templateBitmap,int shiftSum)
+    :mBitmap(bitmap),mTarget(templateBitmap, shiftSum),mSums(sumTable(bitmap)),mLuma(lumaPlane(bitmap)){}
   bool compare(int x, int y, const unsigned char* color){
-    if(isImage(mBitmap, x, y, tBitmap, mShiftSum)){
+    if(isImage(mBitmap, x, y, mTarget, mSums.get(), mLuma.get())){
       result.x = x;
       result.y = y;
       return true;
@@ -614,20 +1015,22 @@ public:
 
 class BitmapsFinder{
   Bitmap * mBitmap;
-  std::vector<CommonBitmap>* mImages;
-  std::vector<int> mShiftSums;
+  std::vector<ImagePtr>* mImages;
+  std::vector<ImageTarget> mTargets;
+  std::shared_ptr<const SumTable> mSums;
+  std::shared_ptr<const LumaPlane> mLuma;
   Point result;
   int resultImage = 0;
 public:
-  BitmapsFinder(Bitmap*bitmap,std::vector<CommonBitmap>*images,int onePointShiftSum)
-    :mBitmap(bitmap),mImages(images){
+  BitmapsFinder(Bitmap*bitmap,std::vector<ImagePtr>*images,double onePointShiftSum)
+    :mBitmap(bitmap),mImages(images),mSums(sumTable(bitmap)),mLuma(lumaPlane(bitmap)){
       for(auto&image:*images){
-        mShiftSums.push_back(image.width_*image.height_*onePointShiftSum);
+        mTargets.emplace_back(image.get(), image->width_*image->height_*onePointShiftSum);
       }
     }
   bool compare(int x, int y, const unsigned char* color){
     for(size_t i = 0; i < mImages->size(); i++){
-      if(isImage(mBitmap, x, y, &mImages->at(i), mShiftSums.at(i))){
+      if(isImage(mBitmap, x, y, mTargets[i], mSums.get(), mLuma.get())){
         result.x = x;
         result.y = y;
         resultImage = i+1;
@@ -645,9 +1048,22 @@ public:
   }
 };
 
+static int findResultIndex(BitmapsFinder* finder){
+  return finder->getResultImage();
+}
+
+// both finders only keep their last hit, so column orders can run blocked
+static bool scanRect(Bitmap*bitmap,int x,int y,int x1,int y1,int order,BitmapFinder*finder){
+  return blockedOrderFindColor(bitmap, x, y, x1, y1, order, finder);
+}
+
+static bool scanRect(Bitmap*bitmap,int x,int y,int x1,int y1,int order,BitmapsFinder*finder){
+  return blockedOrderFindColor(bitmap, x, y, x1, y1, order, finder);
+}
+
 auto findImage(Bitmap*bitmap,int x,int y,int x1,int y1,CommonBitmap*image,int shiftSum,int direction,Point*out)->bool{
   BitmapFinder finder(bitmap, image, shiftSum);
-	bool result = orderFindColor(bitmap, x, y, x1, y1, direction, &finder);
+	bool result = parallelOrderFindColor(bitmap, x, y, x1, y1, direction, &finder);
 	if (result && out)
 	{
 		Point& point = finder.getResult();
@@ -657,9 +1073,9 @@ auto findImage(Bitmap*bitmap,int x,int y,int x1,int y1,CommonBitmap*image,int sh
 	return result;
 }
 
-auto findImage(Bitmap*bitmap,int x,int y,int x1,int y1,std::vector<CommonBitmap>*images,int onePointShift,int direction,Point*out)->int{
+auto findImage(Bitmap*bitmap,int x,int y,int x1,int y1,std::vector<ImagePtr>*images,double onePointShift,int direction,Point*out)->int{
   BitmapsFinder finder(bitmap, images, onePointShift);
-  bool result = orderFindColor(bitmap, x, y, x1, y1, direction, &finder);
+  bool result = parallelOrderFindColor(bitmap, x, y, x1, y1, direction, &finder);
   if (result && out)
   {
     Point& point = finder.getResult();
@@ -683,19 +1099,33 @@ auto findImage##last(lua_State*L)->int{\
   checkCoordinates(bitmap, L, x, y, x1, y1);\
   auto sim = ensureSimilarity(L, originIndex+6);\
   int direction = ensureFindOrder(L, originIndex+7);\
+  int pyramid = ensurePyramidLevel(L, originIndex+8);\
   if(lua_isstring(L, originIndex+5)){\
     size_t size = 0;\
     const char*imageNames = luaL_checklstring(L, originIndex+5, &size);\
-    std::vector<CommonBitmap> images;\
+    std::vector<ImagePtr> images;\
     if(!loadImages(imageNames, size, images)){\
       images.~vector();\
       luaL_error(L, "Invalid image string");\
     }\
     auto onePointShiftSum = (1-sim)*MAX_COLOR_SHIFT;\
     Point out(-1,-1);\
-    if(images.size() == 1){\
+    if(pyramid > 0){\
+      std::vector<CommonBitmap*> templates;\
+      std::vector<int> shiftSums;\
+      for(auto&image:images){\
+        templates.push_back(image.get());\
+        shiftSums.push_back(image->width_*image->height_*onePointShiftSum);\
+      }\
+      if(auto r = findImagePyramid(bitmap, x, y, x1, y1, templates.data(), shiftSums.data(), templates.size(), pyramid, direction, &out)){\
+        lua_pushinteger(L, out.x);\
+        lua_pushinteger(L, out.y);\
+        lua_pushinteger(L, r);\
+        return 3;\
+      }\
+    }else if(images.size() == 1){\
       auto&image = images.at(0);\
-      if(findImage(bitmap, x, y, x1, y1, &image ,image.width_*image.height_*onePointShiftSum, direction, &out)){\
+      if(findImage(bitmap, x, y, x1, y1, image.get() ,image->width_*image->height_*onePointShiftSum, direction, &out)){\
         lua_pushinteger(L, out.x);\
         lua_pushinteger(L, out.y);\
         lua_pushinteger(L, 1);\
@@ -718,6 +1148,406 @@ auto findImage##last(lua_State*L)->int{\
   return 3;\
 }
 
+#define FIND_ALL_IMAGE(bitmapIndex,originIndex,last)\
+auto findAllImage##last(lua_State*L)->int{\
+  checkUserData(L, bitmapIndex);\
+  auto bitmap = lua::toObject<Bitmap>(L, bitmapIndex);\
+  int x = luaL_checkinteger(L, originIndex+1);\
+  int y = luaL_checkinteger(L, originIndex+2);\
+  int x1 = luaL_checkinteger(L, originIndex+3);\
+  int y1 = luaL_checkinteger(L, originIndex+4);\
+  if(x1 == -1) x1 = bitmap->width_;\
+  if(y1 == -1) y1 = bitmap->height_;\
+  checkCoordinates(bitmap, L, x, y, x1, y1);\
+  auto sim = ensureSimilarity(L, originIndex+6);\
+  int direction = ensureFindOrder(L, originIndex+7);\
+  int maxCount = ensureMaxCount(L, originIndex+8);\
+  int spacing = ensureSpacing(L, originIndex+9);\
+  if(!lua_isstring(L, originIndex+5)){\
+    luaL_error(L, "Invalid image type");\
+  }\
+  size_t size = 0;\
+  const char*imageNames = luaL_checklstring(L, originIndex+5, &size);\
+  std::vector<ImagePtr> images;\
+  if(!loadImages(imageNames, size, images)){\
+    images.~vector();\
+    luaL_error(L, "Invalid image string");\
+  }\
+  std::vector<Point> points;\
+  std::vector<int> indexes;\
+  BitmapsFinder finder(bitmap, &images, (1-sim)*MAX_COLOR_SHIFT);\
+  AllFinder<BitmapsFinder> all(&finder, x, y, x1, y1, maxCount, spacing, &points, &indexes);\
+  orderFindColor(bitmap, x, y, x1, y1, direction, &all);\
+  pushPoints(L, points, &indexes);\
+  return 1;\
+}
+
+// the host calls this after refreshing the pixels of a bitmap it reuses
+#define INVALIDATE(bitmapIndex,originIndex,last)\
+auto invalidate##last(lua_State*L)->int{\
+  checkUserData(L, bitmapIndex);\
+  auto bitmap = lua::toObject<Bitmap>(L, bitmapIndex);\
+  bitmap->invalidate();\
+  return 0;\
+}
+
+// The element i of the query descriptor at index. The checks below report
+// errors instead of raising them, a batch frees its colors first.
+static bool batchInteger(lua_State*L,int index,int i,int* out){
+  bool valid = lua_rawgeti(L, index, i) == LUA_TNUMBER && lua_isinteger(L, -1);
+  if(valid){
+    *out = (int)lua_tointeger(L, -1);
+  }
+  lua_pop(L, 1);
+  return valid;
+}
+
+static auto batchSimilarity(lua_State*L,int index,int i,const char** error)->double{
+  double sim = 1;
+  int type = lua_rawgeti(L, index, i);
+  if(type == LUA_TNUMBER){
+    sim = lua_tonumber(L, -1);
+  }else if(type != LUA_TNIL){
+    sim = -1;
+  }
+  lua_pop(L, 1);
+  if(sim < 0 || sim > 1){
+    *error = "Similarity must be between 0 and 1";
+  }
+  return sim;
+}
+
+static auto batchRect(lua_State*L,int index,Bitmap* bitmap,BatchQuery* query)->const char*{
+  if(!batchInteger(L, index, 2, &query->x) || !batchInteger(L, index, 3, &query->y) ||
+    !batchInteger(L, index, 4, &query->x1) || !batchInteger(L, index, 5, &query->y1)){
+    return "Coordinates must be integers";
+  }
+  if(query->x1 == -1) query->x1 = bitmap->width_;
+  if(query->y1 == -1) query->y1 = bitmap->height_;
+  if(!isInBitmapScope(bitmap, query->x, query->y, query->x1, query->y1)){
+    return COORDINATES_OVERFLOW;
+  }
+  query->order = 1;
+  int type = lua_rawgeti(L, index, 8);
+  if(type != LUA_TNIL){
+    query->order = lua_isinteger(L, -1) ? (int)lua_tointeger(L, -1) : -1;
+  }
+  lua_pop(L, 1);
+  if(query->order < 0 || query->order > 8){
+    return "Order must be between 0 and 8";
+  }
+  return nullptr;
+}
+
+static auto batchColor(lua_State*L,int index,int i,QueryBatch* batch,BatchQuery* query)->const char*{
+  const char* error = nullptr;
+  lua_rawgeti(L, index, i);
+  if(lua_isinteger(L, -1)){
+    auto value = lua_tointeger(L, -1);
+    if(value < 0 || value > 0xFFFFFF){
+      error = "Invalid color value";
+    }
+    query->value = (Color)value;
+  }else if(lua_type(L, -1) == LUA_TSTRING){
+    // the descriptor keeps the string alive until the batch ends
+    size_t size = 0;
+    auto str = lua_tolstring(L, -1, &size);
+    query->color = batch->color(str, size);
+    if(query->color == nullptr){
+      error = "Invalid color string";
+    }
+  }else{
+    error = "Invalid color type";
+  }
+  lua_pop(L, 1);
+  return error;
+}
+
+static auto batchFeature(lua_State*L,int index,int i,QueryBatch* batch,BatchQuery* query)->const char*{
+  const char* error = nullptr;
+  if(lua_rawgeti(L, index, i) == LUA_TSTRING){
+    size_t size = 0;
+    auto str = lua_tolstring(L, -1, &size);
+    query->feature = batch->feature(str, size);
+  }
+  if(query->feature == nullptr){
+    error = "Invalid feature string";
+  }
+  lua_pop(L, 1);
+  return error;
+}
+
+// {name, ...} takes the arguments of bitmap:name(...), one of getColor,
+// isColor, findColor, isFeature and findFeature
+static auto parseBatchQuery(lua_State*L,int index,Bitmap* bitmap,QueryBatch* batch)->const char*{
+  if(!lua_istable(L, index)){
+    return "Query must be a table";
+  }
+  BatchQuery query{};
+  const char* error = nullptr;
+  lua_rawgeti(L, index, 1);
+  const char* name = lua_type(L, -1) == LUA_TSTRING ? lua_tostring(L, -1) : "";
+  lua_pop(L, 1);
+  if(strcmp(name, "getColor") == 0){
+    query.type = BATCH_GET_COLOR;
+    if(!batchInteger(L, index, 2, &query.x) || !batchInteger(L, index, 3, &query.y)){
+      return "Coordinates must be integers";
+    }
+    if(!isInBitmapScope(bitmap, query.x, query.y)){
+      return COORDINATES_OVERFLOW;
+    }
+  }else if(strcmp(name, "isColor") == 0){
+    query.type = BATCH_IS_COLOR;
+    if(!batchInteger(L, index, 2, &query.x) || !batchInteger(L, index, 3, &query.y)){
+      return "Coordinates must be integers";
+    }
+    if(!isInBitmapScope(bitmap, query.x, query.y)){
+      return COORDINATES_OVERFLOW;
+    }
+    if((error = batchColor(L, index, 4, batch, &query))){
+      return error;
+    }
+    query.shift = (int)((1 - batchSimilarity(L, index, 5, &error)) * MAX_COLOR_SHIFT);
+  }else if(strcmp(name, "findColor") == 0){
+    query.type = BATCH_FIND_COLOR;
+    if((error = batchRect(L, index, bitmap, &query)) || (error = batchColor(L, index, 6, batch, &query))){
+      return error;
+    }
+    query.shift = (int)((1 - batchSimilarity(L, index, 7, &error)) * MAX_COLOR_SHIFT);
+  }else if(strcmp(name, "isFeature") == 0){
+    query.type = BATCH_IS_FEATURE;
+    if((error = batchFeature(L, index, 2, batch, &query))){
+      return error;
+    }
+    query.shift = (1 - batchSimilarity(L, index, 3, &error)) * 255 * query.feature->feature->count;
+  }else if(strcmp(name, "findFeature") == 0){
+    query.type = BATCH_FIND_FEATURE;
+    if((error = batchRect(L, index, bitmap, &query)) || (error = batchFeature(L, index, 6, batch, &query))){
+      return error;
+    }
+    query.shift = (1 - batchSimilarity(L, index, 7, &error)) * MAX_COLOR_SHIFT * query.feature->feature->count;
+  }else{
+    return "Unknown query";
+  }
+  if(error == nullptr){
+    batch->add(query);
+  }
+  return error;
+}
+
+// Runs every query of the table at index and returns their results in
+// order: a color for getColor, a boolean for isColor and isFeature, and
+// {x, y} for findColor and findFeature
+static auto runBatch(lua_State*L,Bitmap* bitmap,int index)->int{
+  const char* error = nullptr;
+  size_t failed = 0;
+  size_t count = lua_rawlen(L, index);
+  std::vector<BatchQueryType> types;
+  std::vector<BatchResult> results;
+  {
+    QueryBatch batch(bitmap);
+    for(size_t i = 1; i <= count && error == nullptr; i++){
+      lua_rawgeti(L, index, i);
+      error = parseBatchQuery(L, lua_gettop(L), bitmap, &batch);
+      lua_pop(L, 1);
+      failed = i;
+    }
+    if(error == nullptr){
+      batch.run(&results);
+      for(size_t i = 0; i < batch.size(); i++){
+        types.push_back(batch.query(i).type);
+      }
+    }
+  }
+  // nothing was allocated when a query failed
+  if(error){
+    luaL_error(L, "Query %d: %s", (int)failed, error);
+  }
+  lua_createtable(L, (int)results.size(), 0);
+  for(size_t i = 0; i < results.size(); i++){
+    auto& result = results[i];
+    switch (types[i]) {
+      case BATCH_GET_COLOR:
+        lua_pushinteger(L, (int)result.color);
+        break;
+      case BATCH_FIND_COLOR:
+      case BATCH_FIND_FEATURE:
+        lua_createtable(L, 2, 0);
+        lua_pushinteger(L, result.point.x);
+        lua_rawseti(L, -2, 1);
+        lua_pushinteger(L, result.point.y);
+        lua_rawseti(L, -2, 2);
+        break;
+      default:
+        lua_pushboolean(L, result.found);
+        break;
+    }
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+// batch{{"isColor", x, y, color, sim}, {"findColor", x, y, x1, y1, color, sim, order}, ...}
+#define BATCH(bitmapIndex,originIndex,last)\
+auto batch##last(lua_State*L)->int{\
+  checkUserData(L, bitmapIndex);\
+  auto bitmap = lua::toObject<Bitmap>(L, bitmapIndex);\
+  luaL_checktype(L, originIndex+1, LUA_TTABLE);\
+  return runBatch(L, bitmap, originIndex+1);\
+}
+
+// registry keys of the SearchQueue of the state and of the weak table
+// from each running search to its handle
+static char SEARCH_QUEUE_KEY;
+static char SEARCH_HANDLES_KEY;
+
+static auto searchQueue(lua_State*L)->std::shared_ptr<CompletionQueue>{
+  if(lua_rawgetp(L, LUA_REGISTRYINDEX, &SEARCH_QUEUE_KEY) == LUA_TNIL){
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_createtable(L, 0, 1);
+    lua_pushstring(L, "v");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &SEARCH_HANDLES_KEY);
+    luaL_pushNewObject(SearchQueue, L);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &SEARCH_QUEUE_KEY);
+  }
+  auto queue = lua::toObject<SearchQueue>(L, -1)->queue;
+  lua_pop(L, 1);
+  return queue;
+}
+
+// Submits job and pushes its handle. The handle holds the bitmap at
+// bitmapIndex until it is collected, and its collection waits for the job.
+static auto pushSearch(lua_State*L,int bitmapIndex,AsyncJob job,int results)->int{
+  auto queue = searchQueue(L);
+  auto handle = luaL_pushNewObject(SearchHandle, L, results);
+  lua_pushvalue(L, bitmapIndex);
+  lua_setuservalue(L, -2);
+  handle->search = submitSearch(std::move(job), lua::toObject<Bitmap>(L, bitmapIndex), std::move(queue));
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &SEARCH_HANDLES_KEY);
+  lua_pushvalue(L, -2);
+  lua_rawsetp(L, -2, handle->search.get());
+  lua_pop(L, 1);
+  return 1;
+}
+
+// findColorAsync(x, y, x1, y1, color, sim, order) starts findColor on the
+// search pool and returns its handle. The pixels must not change until the
+// search is done.
+#define FIND_COLOR_ASYNC(bitmapIndex,originIndex,last)\
+auto findColorAsync##last(lua_State*L)->int{\
+  checkUserData(L, bitmapIndex);\
+  auto bitmap = lua::toObject<Bitmap>(L, bitmapIndex);\
+  int x = luaL_checkinteger(L, originIndex+1);\
+  int y = luaL_checkinteger(L, originIndex+2);\
+  int x1 = luaL_checkinteger(L, originIndex+3);\
+  int y1 = luaL_checkinteger(L, originIndex+4);\
+  if(x1 == -1) x1 = bitmap->width_;\
+  if(y1 == -1) y1 = bitmap->height_;\
+  checkCoordinates(bitmap, L, x, y,x1,y1);\
+  int shift = ensureSimilarityAndToShift(L, originIndex+6);\
+  int order = ensureFindOrder(L, originIndex+7);\
+  if(lua_isinteger(L, originIndex+5)){\
+    Color value = checkIntColor(L, originIndex+5);\
+    return pushSearch(L, bitmapIndex, [=](Point* out)->int{\
+      Color color = value;\
+      return findColor(bitmap, x, y, x1, y1, &color, shift, order, out);\
+    }, 2);\
+  }\
+  if(!lua_isstring(L, originIndex+5)){\
+    luaL_error(L, "Invalid color type");\
+  }\
+  size_t size = 0;\
+  auto *str = lua_tolstring(L, originIndex+5, &size);\
+  auto decoded = decodeColor(str , size);\
+  if(decoded == nullptr){\
+    luaL_error(L, "Invalid color string");\
+  }\
+  std::shared_ptr<ColorComposition> color(decoded, freeColorComposition);\
+  return pushSearch(L, bitmapIndex, [=](Point* out)->int{\
+    return visitColor(color.get(), [&](auto c){\
+      return findColor(bitmap, x, y, x1, y1, c, shift, order, out);\
+    });\
+  }, 2);\
+}
+
+// findFeatureAsync(x, y, x1, y1, feature, sim, order), findFeature on the
+// search pool
+#define FIND_FEATURE_ASYNC(bitmapIndex,originIndex,last)\
+auto findFeatureAsync##last(lua_State*L)->int{\
+  checkUserData(L, bitmapIndex);\
+  auto bitmap = lua::toObject<Bitmap>(L, bitmapIndex);\
+  int x = luaL_checkinteger(L, originIndex+1);\
+  int y = luaL_checkinteger(L, originIndex+2);\
+  int x1 = luaL_checkinteger(L, originIndex+3);\
+  int y1 = luaL_checkinteger(L, originIndex+4);\
+  if(x1 == -1) x1 = bitmap->width_;\
+  if(y1 == -1) y1 = bitmap->height_;\
+  checkCoordinates(bitmap, L, x, y, x1, y1);\
+  auto sim = ensureSimilarity(L, originIndex+6);\
+  int order = ensureFindOrder(L, originIndex+7);\
+  size_t featureSize = 0;\
+  const char * featureString = luaL_checklstring(L,originIndex+5,&featureSize);\
+  auto feature = getCachedFeature(featureString, featureSize);\
+  if(!feature){\
+    luaL_error(L, "Invalid feature string");\
+  }\
+  auto shiftSum = (1-sim)*MAX_COLOR_SHIFT*feature->count;\
+  return pushSearch(L, bitmapIndex, [=](Point* out)->int{\
+    BoundFeature bound(feature.get(), bitmap);\
+    bound.orderBySelectivity(bitmap, x, y, x1, y1);\
+    return findFeature(bitmap, x, y, x1, y1, &bound, shiftSum, order, out);\
+  }, 2);\
+}
+
+// findImageAsync(x, y, x1, y1, images, sim, order, pyramid), findImage on
+// the search pool
+#define FIND_IMAGE_ASYNC(bitmapIndex,originIndex,last)\
+auto findImageAsync##last(lua_State*L)->int{\
+  checkUserData(L, bitmapIndex);\
+  auto bitmap = lua::toObject<Bitmap>(L, bitmapIndex);\
+  int x = luaL_checkinteger(L, originIndex+1);\
+  int y = luaL_checkinteger(L, originIndex+2);\
+  int x1 = luaL_checkinteger(L, originIndex+3);\
+  int y1 = luaL_checkinteger(L, originIndex+4);\
+  if(x1 == -1) x1 = bitmap->width_;\
+  if(y1 == -1) y1 = bitmap->height_;\
+  checkCoordinates(bitmap, L, x, y, x1, y1);\
+  auto sim = ensureSimilarity(L, originIndex+6);\
+  int direction = ensureFindOrder(L, originIndex+7);\
+  int pyramid = ensurePyramidLevel(L, originIndex+8);\
+  if(!lua_isstring(L, originIndex+5)){\
+    luaL_error(L, "Invalid image type");\
+  }\
+  size_t size = 0;\
+  const char*imageNames = luaL_checklstring(L, originIndex+5, &size);\
+  std::vector<ImagePtr> images;\
+  if(!loadImages(imageNames, size, images)){\
+    images.~vector();\
+    luaL_error(L, "Invalid image string");\
+  }\
+  auto onePointShiftSum = (1-sim)*MAX_COLOR_SHIFT;\
+  return pushSearch(L, bitmapIndex, [=](Point* out)mutable->int{\
+    if(pyramid > 0){\
+      std::vector<CommonBitmap*> templates;\
+      std::vector<int> shiftSums;\
+      for(auto&image:images){\
+        templates.push_back(image.get());\
+        shiftSums.push_back(image->width_*image->height_*onePointShiftSum);\
+      }\
+      return findImagePyramid(bitmap, x, y, x1, y1, templates.data(), shiftSums.data(), templates.size(), pyramid, direction, out);\
+    }\
+    if(images.size() == 1){\
+      auto&image = images.at(0);\
+      return findImage(bitmap, x, y, x1, y1, image.get() ,image->width_*image->height_*onePointShiftSum, direction, out) ? 1 : 0;\
+    }\
+    return findImage(bitmap, x, y, x1, y1, &images ,onePointShiftSum, direction, out);\
+  }, 3);\
+}
+
 DEFINE_METHOD_X(GET_COLOR)
 DEFINE_METHOD_X(GET_COLOR_COUNT)
 DEFINE_METHOD_X(WHICH_COLOR)
@@ -725,9 +1555,18 @@ DEFINE_METHOD_X(IS_COLOR)
 DEFINE_METHOD_X(FIND_COLOR)
 DEFINE_METHOD_X(IS_FEATURE)
 DEFINE_METHOD_X(FIND_FEATURE)
+DEFINE_METHOD_X(FIND_FEATURES)
 DEFINE_METHOD_X(IS_IMAGE)
 DEFINE_METHOD_X(WHICH_IMAGE)
 DEFINE_METHOD_X(FIND_IMAGE)
+DEFINE_METHOD_X(FIND_ALL_COLOR)
+DEFINE_METHOD_X(FIND_ALL_FEATURE)
+DEFINE_METHOD_X(FIND_ALL_IMAGE)
+DEFINE_METHOD_X(INVALIDATE)
+DEFINE_METHOD_X(BATCH)
+DEFINE_METHOD_X(FIND_COLOR_ASYNC)
+DEFINE_METHOD_X(FIND_FEATURE_ASYNC)
+DEFINE_METHOD_X(FIND_IMAGE_ASYNC)
 
 
 
@@ -743,6 +1582,75 @@ int loadImage(lua_State*L){
   return 0;
 }
 
+static void pushCacheStats(lua_State*L,const CacheStats&stats){
+  lua_createtable(L, 0, 5);
+  lua_pushinteger(L, stats.hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushinteger(L, stats.misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushinteger(L, stats.evictions);
+  lua_setfield(L, -2, "evictions");
+  lua_pushinteger(L, stats.size);
+  lua_setfield(L, -2, "size");
+  lua_pushinteger(L, stats.capacity);
+  lua_setfield(L, -2, "capacity");
+}
+
+int featureCacheStats(lua_State*L){
+  pushCacheStats(L, vision::featureCacheStats());
+  return 1;
+}
+
+int setFeatureCacheSize(lua_State*L){
+  auto size = luaL_checkinteger(L, 1);
+  if(size < 0){
+    luaL_error(L, "Cache size must not be negative");
+  }
+  vision::setFeatureCacheSize(static_cast<size_t>(size));
+  return 0;
+}
+
+int imageCacheStats(lua_State*L){
+  auto stats = imageCache().stats();
+  pushCacheStats(L, stats);
+  lua_pushinteger(L, stats.cost);
+  lua_setfield(L, -2, "bytes");
+  return 1;
+}
+
+int setImageCacheSize(lua_State*L){
+  auto size = luaL_checkinteger(L, 1);
+  if(size < 0){
+    luaL_error(L, "Cache size must not be negative");
+  }
+  imageCache().setCapacity(static_cast<size_t>(size));
+  return 0;
+}
+
+int flushImageCache(lua_State*L){
+  imageCache().clear();
+  return 0;
+}
+
+// setThreadCount(scanThreads[, searchThreads]), searchThreads run the
+// findXAsync searches
+int setThreadCount(lua_State*L){
+  auto count = luaL_checkinteger(L, 1);
+  auto searchCount = luaL_optinteger(L, 2, searchThreadCount());
+  if(count < 1 || count > 256 || searchCount < 1 || searchCount > 256){
+    luaL_error(L, "Thread count must be between 1 and 256");
+  }
+  setScanThreadCount(static_cast<int>(count));
+  setSearchThreadCount(static_cast<int>(searchCount));
+  return 0;
+}
+
+int getThreadCount(lua_State*L){
+  lua_pushinteger(L, scanThreadCount());
+  lua_pushinteger(L, searchThreadCount());
+  return 2;
+}
+
 int indexMethod(lua_State*L){
   lua_getmetatable(L, 1);
   lua_pushvalue(L, 2);
@@ -760,21 +1668,445 @@ int indexMethod(lua_State*L){
   return 1;
 }
 
+// save(path [, format]), format is "png", "raw" or "qoi" and defaults to
+// the one of the extension of path
 int saveImageTo(lua_State*L){
+  static const char* const formats[] = {"png", "raw", "qoi", nullptr};
   auto image = lua::toObject<Bitmap>(L, 1);
   size_t size = 0;
   const char* path = luaL_checklstring(L, 2, &size);
   std::string cPath  = std::string(path, size);
-  auto error = lodepng::encode(cPath, image->origin_, image->width_, image->height_);
-  if(error){
+  auto format = lua_isnoneornil(L, 3) ? imageFormatOf(cPath.c_str())
+    : (ImageFormat)luaL_checkoption(L, 3, nullptr, formats);
+  if(auto error = saveImage(image, cPath.c_str(), format)){
     lua_pushboolean(L, false);
-    lua_pushstring(L, lodepng_error_text(error));
+    lua_pushstring(L, error);
     return 2;
   }
   lua_pushboolean(L, true);
   return 1;
 }
 
+// wrapImage(pixels, width, height [, stride [, pixelStride | format [, owner]]])
+// pixels is a lightuserdata or an integer address. format is one of
+// "rgba", "bgra", "rgb" and "gray" with the pixel size as stride, a bare
+// pixelStride is "rgb" for 3 and "rgba" otherwise. The view keeps owner
+// alive and calls it when it is a function, once the view is released
+// or collected.
+int wrapImage(lua_State*L){
+  static const char* const formats[] = {"rgba", "bgra", "rgb", "gray", nullptr};
+  unsigned char* pixels = nullptr;
+  if(lua_islightuserdata(L, 1)){
+    pixels = (unsigned char*)lua_touserdata(L, 1);
+  }else if(lua_isinteger(L, 1)){
+    pixels = (unsigned char*)(uintptr_t)lua_tointeger(L, 1);
+  }
+  if(pixels == nullptr){
+    luaL_error(L, "Pixels must be a lightuserdata or an address");
+  }
+  auto width = luaL_checkinteger(L, 2);
+  auto height = luaL_checkinteger(L, 3);
+  auto format = PIXEL_RGBA;
+  lua_Integer pixelStride;
+  if(lua_type(L, 5) == LUA_TSTRING){
+    format = (PixelFormat)luaL_checkoption(L, 5, nullptr, formats);
+    pixelStride = pixelFormatBytes(format);
+  }else{
+    pixelStride = luaL_optinteger(L, 5, 4);
+    format = pixelStride == 3 ? PIXEL_RGB24 : PIXEL_RGBA;
+  }
+  if(width <= 0 || height <= 0 || width > INT32_MAX / 16 || height > INT32_MAX){
+    luaL_error(L, "Invalid image size");
+  }
+  if(pixelStride < pixelFormatBytes(format) || pixelStride > 16){
+    luaL_error(L, "Pixel stride must be between the pixel size and 16");
+  }
+  auto stride = luaL_optinteger(L, 4, width * pixelStride);
+  // pixel offsets are computed in int
+  if(stride < width * pixelStride || stride > INT32_MAX / height){
+    luaL_error(L, "Stride must hold a row of pixels");
+  }
+  luaL_pushNewObject(BitmapView, L, pixels, (unsigned int)width, (unsigned int)height, (int)stride, (int)pixelStride, format);
+  if(!lua_isnoneornil(L, 6)){
+    lua_pushvalue(L, 6);
+    lua_setuservalue(L, -2);
+  }
+  return 1;
+}
+
+// lets go of the owner stored by wrapImage, false with the error on the
+// stack when calling it failed
+static auto releaseViewOwner(lua_State*L,int index)->bool{
+  bool released = true;
+  if(lua_getuservalue(L, index) == LUA_TFUNCTION){
+    released = lua_pcall(L, 0, 0, 0) == LUA_OK;
+  }else{
+    lua_pop(L, 1);
+  }
+  lua_pushnil(L);
+  lua_setuservalue(L, index);
+  return released;
+}
+
+int releaseView(lua_State*L){
+  auto view = luaL_checkObject(BitmapView, L, 1);
+  waitForSearches(view);
+  view->release();
+  if(!releaseViewOwner(L, 1)){
+    return lua_error(L);
+  }
+  return 0;
+}
+
+int finishView(lua_State*L){
+  lua::finish<BitmapView>(L);
+  // errors cannot leave a finalizer
+  if(!releaseViewOwner(L, 1)){
+    lua_pop(L, 1);
+  }
+  return 0;
+}
+
+// openSharedFrame(name [, file]) maps the frames a producer publishes in
+// the shm_open region name, or in the file at name when file is true
+int openSharedFrame(lua_State*L){
+  const char* name = luaL_checkstring(L, 1);
+  bool file = lua_toboolean(L, 2);
+  auto frame = luaL_pushNewObject(SharedFrameBitmap, L);
+  if(!frame->open(name, file)){
+    lua_pushnil(L);
+    lua_pushstring(L, frame->errorText());
+    return 2;
+  }
+  return 1;
+}
+
+// openPack(path) serves the images of a pack built by svpack to
+// loadImage and every image string, true or nil and the error
+int openPack(lua_State*L){
+  const char* path = luaL_checkstring(L, 1);
+  auto pack = std::make_shared<TemplatePack>();
+  if(auto error = pack->open(path)){
+    lua_pushnil(L);
+    lua_pushstring(L, error);
+    return 2;
+  }
+  registerPack(std::move(pack));
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// true when a new frame was published since the last refresh, and its sequence
+int refreshFrame(lua_State*L){
+  auto frame = luaL_checkObject(SharedFrameBitmap, L, 1);
+  // refresh may map the region again under a running search
+  waitForSearches(frame);
+  bool changed = frame->refresh();
+  if(frame->errorText()){
+    lua_pushnil(L);
+    lua_pushstring(L, frame->errorText());
+    return 2;
+  }
+  lua_pushboolean(L, changed);
+  lua_pushinteger(L, (lua_Integer)frame->sequence());
+  return 2;
+}
+
+int closeFrame(lua_State*L){
+  auto frame = luaL_checkObject(SharedFrameBitmap, L, 1);
+  waitForSearches(frame);
+  frame->close();
+  return 0;
+}
+
+// newFrameTracker([tileSize]) remembers the answers of tracker:findColor,
+// findFeature and findImage between the frames passed to tracker:update
+int newFrameTracker(lua_State*L){
+  auto tile = luaL_optinteger(L, 1, DEFAULT_FRAME_TILE);
+  if(tile < 1 || tile > 1024){
+    luaL_error(L, "Tile size must be between 1 and 1024");
+  }
+  luaL_pushNewObject(FrameTracker, L, (int)tile);
+  return 1;
+}
+
+// tracker:update(bitmap) takes the current pixels of bitmap as the next
+// frame, the number of tiles that changed
+int updateTracker(lua_State*L){
+  auto tracker = luaL_checkObject(FrameTracker, L, 1);
+  checkUserData(L, 2);
+  auto bitmap = lua::toObject<Bitmap>(L, 2);
+  lua_pushinteger(L, tracker->update(bitmap));
+  return 1;
+}
+
+int isTrackerDirty(lua_State*L){
+  auto tracker = luaL_checkObject(FrameTracker, L, 1);
+  int x = luaL_checkinteger(L, 2);
+  int y = luaL_checkinteger(L, 3);
+  int x1 = luaL_checkinteger(L, 4);
+  int y1 = luaL_checkinteger(L, 5);
+  lua_pushboolean(L, tracker->isDirty(x, y, x1, y1));
+  return 1;
+}
+
+// The arguments every tracker:findX(bitmap, x, y, x1, y1, target, sim, order, ...) shares
+struct TrackedArea{
+  FrameTracker* tracker;
+  Bitmap* bitmap;
+  int x;
+  int y;
+  int x1;
+  int y1;
+  int order;
+};
+
+// Checks everything but the target and the similarity. The arguments after
+// the area become the query key, so they must be plain values.
+static void checkTrackedArea(lua_State*L,TrackedArea* area){
+  area->tracker = luaL_checkObject(FrameTracker, L, 1);
+  checkUserData(L, 2);
+  area->bitmap = lua::toObject<Bitmap>(L, 2);
+  area->x = luaL_checkinteger(L, 3);
+  area->y = luaL_checkinteger(L, 4);
+  area->x1 = luaL_checkinteger(L, 5);
+  area->y1 = luaL_checkinteger(L, 6);
+  if(area->x1 == -1) area->x1 = area->bitmap->width_;
+  if(area->y1 == -1) area->y1 = area->bitmap->height_;
+  checkCoordinates(area->bitmap, L, area->x, area->y, area->x1, area->y1);
+  area->order = ensureFindOrder(L, 9);
+  for(int i = 7, top = lua_gettop(L); i <= top; i++){
+    int type = lua_type(L, i);
+    if(type != LUA_TSTRING && type != LUA_TNUMBER && type != LUA_TNIL){
+      luaL_error(L, "Invalid argument %d", i - 1);
+    }
+  }
+}
+
+// Answers the query through the tracker and pushes x, y (and the index when
+// results is 3) as bitmap:findX would. search runs natively on the parts of
+// the area that changed, nothing here raises an error, so the key, search
+// and the tracker state are never jumped over.
+static auto pushTrackedFind(lua_State*L,const TrackedArea& area,const char* name,const QueryExtent& extent,
+  int results,const TrackedSearch& search)->int{
+  // the method, the area and every argument after it
+  std::string key(name);
+  for(int value : {area.x, area.y, area.x1, area.y1}){
+    key += ',';
+    key += std::to_string(value);
+  }
+  for(int i = 7, top = lua_gettop(L); i <= top; i++){
+    key += ',';
+    if(lua_type(L, i) == LUA_TSTRING){
+      size_t size = 0;
+      const char* text = lua_tolstring(L, i, &size);
+      key.append(text, size);
+    }else if(lua_isinteger(L, i)){
+      key += std::to_string(lua_tointeger(L, i));
+    }else if(lua_type(L, i) == LUA_TNUMBER){
+      char text[32];
+      snprintf(text, sizeof(text), "%.17g", lua_tonumber(L, i));
+      key += text;
+    }
+  }
+  Point out(-1,-1);
+  int found = area.tracker->find(key, area.bitmap, area.x, area.y, area.x1, area.y1, extent, area.order, search, &out);
+  if(!found){
+    out = Point(-1, -1);
+  }
+  lua_pushinteger(L, out.x);
+  lua_pushinteger(L, out.y);
+  if(results == 3){
+    lua_pushinteger(L, found ? found : -1);
+  }
+  return results;
+}
+
+int trackedFindColor(lua_State*L){
+  TrackedArea area;
+  checkTrackedArea(L, &area);
+  int shift = ensureSimilarityAndToShift(L, 8);
+  Bitmap* bitmap = area.bitmap;
+  int order = area.order;
+  if(lua_isinteger(L, 7)){
+    Color value = checkIntColor(L, 7);
+    return pushTrackedFind(L, area, "findColor", QueryExtent{0, 0, 0, 0}, 2, [&](int x, int y, int x1, int y1, Point* out)->int{
+      Color color = value;
+      return findColor(bitmap, x, y, x1, y1, &color, shift, order, out);
+    });
+  }
+  if(!lua_isstring(L, 7)){
+    luaL_error(L, "Invalid color type");
+  }
+  size_t size = 0;
+  auto *str = lua_tolstring(L, 7, &size);
+  auto decoded = decodeColor(str, size);
+  if(decoded == nullptr){
+    luaL_error(L, "Invalid color string");
+  }
+  std::unique_ptr<ColorComposition, void(*)(ColorComposition*)> color(decoded, freeColorComposition);
+  return pushTrackedFind(L, area, "findColor", QueryExtent{0, 0, 0, 0}, 2, [&](int x, int y, int x1, int y1, Point* out)->int{
+    return visitColor(color.get(), [&](auto c){
+      return findColor(bitmap, x, y, x1, y1, c, shift, order, out);
+    });
+  });
+}
+
+int trackedFindFeature(lua_State*L){
+  TrackedArea area;
+  checkTrackedArea(L, &area);
+  auto sim = ensureSimilarity(L, 8);
+  size_t size = 0;
+  const char* featureString = luaL_checklstring(L, 7, &size);
+  auto feature = getCachedFeature(featureString, size);
+  if(!feature){
+    luaL_error(L, "Invalid feature string");
+  }
+  auto shiftSum = (1-sim)*MAX_COLOR_SHIFT*feature->count;
+  Bitmap* bitmap = area.bitmap;
+  int order = area.order;
+  QueryExtent extent{feature->minX, feature->minY, feature->maxX, feature->maxY};
+  return pushTrackedFind(L, area, "findFeature", extent, 2, [&](int x, int y, int x1, int y1, Point* out)->int{
+    BoundFeature bound(feature.get(), bitmap);
+    bound.orderBySelectivity(bitmap, x, y, x1, y1);
+    return findFeature(bitmap, x, y, x1, y1, &bound, shiftSum, order, out);
+  });
+}
+
+int trackedFindImage(lua_State*L){
+  TrackedArea area;
+  checkTrackedArea(L, &area);
+  auto sim = ensureSimilarity(L, 8);
+  int pyramid = ensurePyramidLevel(L, 10);
+  if(!lua_isstring(L, 7)){
+    luaL_error(L, "Invalid image type");
+  }
+  size_t size = 0;
+  const char* imageNames = lua_tolstring(L, 7, &size);
+  std::vector<ImagePtr> images;
+  if(!loadImages(imageNames, size, images)){
+    images.~vector();
+    luaL_error(L, "Invalid image string");
+  }
+  auto onePointShiftSum = (1-sim)*MAX_COLOR_SHIFT;
+  // the pyramid search answers as the plain one, a match reads the pixels
+  // under the largest template
+  QueryExtent extent{0, 0, 0, 0};
+  std::vector<CommonBitmap*> templates;
+  std::vector<int> shiftSums;
+  for(auto& image : images){
+    extent.right = std::max(extent.right, (int)image->width_ - 1);
+    extent.bottom = std::max(extent.bottom, (int)image->height_ - 1);
+    templates.push_back(image.get());
+    shiftSums.push_back(image->width_*image->height_*onePointShiftSum);
+  }
+  Bitmap* bitmap = area.bitmap;
+  int direction = area.order;
+  return pushTrackedFind(L, area, "findImage", extent, 3, [&](int x, int y, int x1, int y1, Point* out)->int{
+    if(pyramid > 0){
+      return findImagePyramid(bitmap, x, y, x1, y1, templates.data(), shiftSums.data(), templates.size(), pyramid, direction, out);
+    }
+    if(images.size() == 1){
+      return findImage(bitmap, x, y, x1, y1, templates[0], shiftSums[0], direction, out) ? 1 : 0;
+    }
+    return findImage(bitmap, x, y, x1, y1, &images, onePointShiftSum, direction, out);
+  });
+}
+
+// pollSearches() returns the handles of the searches that finished since
+// the last call, in the order they finished. Completions are only queued
+// once a state polls, the first call reports the searches done before it.
+int pollSearches(lua_State*L){
+  auto queue = searchQueue(L);
+  bool first = !queue->isEnabled();
+  queue->enable();
+  auto searches = queue->takeAll();
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &SEARCH_HANDLES_KEY);
+  lua_createtable(L, searches.size(), 0);
+  int count = 0;
+  if(first){
+    lua_pushnil(L);
+    while(lua_next(L, -3)){
+      auto handle = lua::toObject<SearchHandle>(L, -1);
+      if(handle->search->isDone()){
+        // pushed as well when it finished while enabling, reported once
+        lua_rawseti(L, -3, ++count);
+        lua_pushvalue(L, -1);
+        lua_pushnil(L);
+        lua_rawset(L, -5);
+      }else{
+        lua_pop(L, 1);
+      }
+    }
+  }
+  for(auto& search : searches){
+    // handles already collected are gone from the weak table
+    if(lua_rawgetp(L, -2, search.get()) == LUA_TNIL){
+      lua_pop(L, 1);
+      continue;
+    }
+    lua_rawseti(L, -2, ++count);
+    lua_pushnil(L);
+    lua_rawsetp(L, -3, search.get());
+  }
+  return 1;
+}
+
+static auto pushSearchResult(lua_State*L,SearchHandle*handle)->int{
+  auto& search = *handle->search;
+  lua_pushinteger(L, search.point().x);
+  lua_pushinteger(L, search.point().y);
+  if(handle->results == 3){
+    lua_pushinteger(L, search.found() ? search.found() : -1);
+  }
+  return handle->results;
+}
+
+int isSearchDone(lua_State*L){
+  auto handle = luaL_checkObject(SearchHandle, L, 1);
+  lua_pushboolean(L, handle->search->isDone());
+  return 1;
+}
+
+// handle:result() answers as the findX call did, nil while it runs
+int searchResult(lua_State*L){
+  auto handle = luaL_checkObject(SearchHandle, L, 1);
+  if(!handle->search->isDone()){
+    lua_pushnil(L);
+    return 1;
+  }
+  return pushSearchResult(L, handle);
+}
+
+static auto continueAwait(lua_State*L,int status,lua_KContext context)->int{
+  return awaitSearch(L);
+}
+
+// handle:await() answers as handle:result() once the search is done. In a
+// coroutine it yields nothing until then, so a scheduler resumes it after
+// pollSearches() reports the handle. Elsewhere it blocks.
+int awaitSearch(lua_State*L){
+  auto handle = luaL_checkObject(SearchHandle, L, 1);
+  if(!handle->search->isDone()){
+    if(lua_isyieldable(L)){
+      lua_settop(L, 1);
+      return lua_yieldk(L, 0, 0, continueAwait);
+    }
+    handle->search->wait();
+  }
+  return pushSearchResult(L, handle);
+}
+
+// the search still reads the bitmap held by the handle
+int finishSearch(lua_State*L){
+  auto handle = lua::toObject<SearchHandle>(L, 1);
+  if(handle->search){
+    handle->search->wait();
+  }
+  handle->~SearchHandle();
+  return 0;
+}
+
 int cloneImage(lua_State*L){
   auto image = lua::toObject<Bitmap>(L, 1);
   auto x1 = luaL_optinteger(L, 2, 0);
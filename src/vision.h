@@ -2,32 +2,71 @@
 #define __VISION_H__
 #include"vision_color.h"
 #include "vision_feature.h"
+#include "vision_index.h"
+#include "vision_lut.h"
+#include "vision_parallel.h"
+#include "vision_simd.h"
+#include <vector>
 
 namespace vision {
-template<class TColor,class TShift>
+// TPixel is the PixelTraits of the counted bitmap
+template<class TPixel,class TColor,class TShift>
 class ColorCounter
 {
 	TColor mColor;
 	TShift mShift;
 	int count;
+	PixelPredicate mPredicate;
+	bool mVectorized;
 public:
 	ColorCounter(TColor color, TShift shift);
 	bool compare(int x, int y, const unsigned char* color);
+	// counts a rectangle row by row with the SIMD kernel when the color allows
+	void countRect(Bitmap* bitmap, int x, int y, int x1, int y1);
 	int getResult();
 };
 
-template<class TColor,class TShift>
+// TPixel is the PixelTraits of the searched bitmap
+template<class TPixel,class TColor,class TShift>
 class ColorFinder
 {
 	TColor mColor;
 	TShift mShift;
 	Point mPoint;
+	PixelPredicate mPredicate;
+	bool mVectorized;
 public:
 	ColorFinder(TColor color, TShift shift);
 	bool compare(int x, int y, const unsigned char* color);
+	// whether scanRect runs the SIMD row kernel for this bitmap and order
+	bool isVectorized(Bitmap* bitmap, int order);
+	// orderFindColor(bitmap, x, y, x1, y1, order, this), a row at a time
+	bool scanRect(Bitmap* bitmap, int x, int y, int x1, int y1, int order);
 	Point& getResult();
 };
 
+// Collects every hit of TFinder in read order. A hit closer than spacing to
+// an accepted one on both axes is suppressed, the scan stops after maxCount.
+template<class TFinder>
+class AllFinder
+{
+	TFinder* mFinder;
+	std::vector<Point>* mPoints;
+	std::vector<int>* mIndexes;
+	int mMaxCount;
+	int mSpacing;
+	int mX;
+	int mY;
+	int mColumns;
+	int mRows;
+	// one accepted point per spacing sized cell at most, as index+1
+	std::vector<int> mCells;
+public:
+	AllFinder(TFinder* finder, int x, int y, int x1, int y1, int maxCount, int spacing,
+		std::vector<Point>* points, std::vector<int>* indexes = nullptr);
+	bool compare(int x, int y, const unsigned char* color);
+};
+
 template<class TFeature,class TShift>
 class FeatureFinder
 {
@@ -42,20 +81,20 @@ public:
 };
 
 
+// which of several templates a finder matched, finders of one target match the first
+template<class TFinder>
+inline int findResultIndex(TFinder*)
+{
+	return 1;
+}
+
 inline Color getColor(Bitmap* bitmap, int x, int y)
 {
-	Color color;
-	Pixel* pixel = (Pixel*)&color;
 	const unsigned char* c = computeCoordColor(bitmap, x, y);
-	pixel->g = c[1];
-#if UNORDERED_PIXEL
-	pixel->r = c[2];
-	pixel->b = c[0];
-#else
-	pixel->r = c[0];
-	pixel->b = c[2];
-#endif
-	return color;
+	return visitPixelFormat(bitmap->format_, [c](auto pixel){
+		using P = decltype(pixel);
+		return Color((ColorValueType)c[P::red] << 16 | (ColorValueType)c[P::green] << 8 | c[P::blue]);
+	});
 }
 
 
@@ -68,22 +107,35 @@ int compareColor(Bitmap* bitmap, int x, int y, T color, int colorShiftSum);
 
 
 
-template<class TColor,class TShift>
-inline ColorCounter<TColor,TShift>::ColorCounter(TColor color, TShift shift)
+template<class TPixel,class TColor,class TShift>
+inline ColorCounter<TPixel,TColor,TShift>::ColorCounter(TColor color, TShift shift)
 	:mColor(color), mShift(shift), count(0)
 {
+	mVectorized = TPixel::bytes >= 3 && makePixelPredicate(color, shift, TPixel::format, &mPredicate);
 }
 
-template<class TColor,class TShift>
-bool inline ColorCounter<TColor,TShift>::compare(int x, int y, const unsigned char* color)
+template<class TPixel,class TColor,class TShift>
+bool inline ColorCounter<TPixel,TColor,TShift>::compare(int x, int y, const unsigned char* color)
 {
-	if (compareColor(color,mColor, mShift))
+	if (compareColor<TPixel>(color,mColor, mShift))
 		count++;
 	return false;
 }
 
-template<class TColor,class TShift>
-inline int ColorCounter<TColor,TShift>::getResult()
+template<class TPixel,class TColor,class TShift>
+inline void ColorCounter<TPixel,TColor,TShift>::countRect(Bitmap* bitmap, int x, int y, int x1, int y1)
+{
+	if (!mVectorized || bitmap->pixelStride_ != 4)
+	{
+		upDownLeftRightReadColor(bitmap, x, y, x1, y1, this);
+		return;
+	}
+	for (int j = y; j < y1; j++)
+		count += countRowMatches(computeCoordColor(bitmap, x, j), x1 - x, mPredicate);
+}
+
+template<class TPixel,class TColor,class TShift>
+inline int ColorCounter<TPixel,TColor,TShift>::getResult()
 {
 	return count;
 }
@@ -91,16 +143,17 @@ inline int ColorCounter<TColor,TShift>::getResult()
 
 
 
-template<class TColor,class TShift>
-inline ColorFinder<TColor,TShift>::ColorFinder(TColor color, TShift shift)
+template<class TPixel,class TColor,class TShift>
+inline ColorFinder<TPixel,TColor,TShift>::ColorFinder(TColor color, TShift shift)
 	:mColor(color), mShift(shift)
 {
+	mVectorized = TPixel::bytes >= 3 && makePixelPredicate(color, shift, TPixel::format, &mPredicate);
 }
 
-template<class TColor,class TShift>
-inline bool ColorFinder<TColor,TShift>::compare(int x, int y, const unsigned char* color)
+template<class TPixel,class TColor,class TShift>
+inline bool ColorFinder<TPixel,TColor,TShift>::compare(int x, int y, const unsigned char* color)
 {
-	if (compareColor(color,mColor, mShift)) {
+	if (compareColor<TPixel>(color,mColor, mShift)) {
 		mPoint.x = x;
 		mPoint.y = y;
 		return true;
@@ -108,13 +161,96 @@ inline bool ColorFinder<TColor,TShift>::compare(int x, int y, const unsigned cha
 	return false;
 }
 
-template<class TColor,class TShift>
-inline Point& ColorFinder<TColor,TShift>::getResult()
+template<class TPixel,class TColor,class TShift>
+inline bool ColorFinder<TPixel,TColor,TShift>::isVectorized(Bitmap* bitmap, int order)
+{
+	return mVectorized && bitmap->pixelStride_ == 4 && order >= UP_DOWN_LEFT_RIGHT && order <= RIGHT_LEFT_DOWN_UP;
+}
+
+template<class TPixel,class TColor,class TShift>
+inline bool ColorFinder<TPixel,TColor,TShift>::scanRect(Bitmap* bitmap, int x, int y, int x1, int y1, int order)
+{
+	if (!isVectorized(bitmap, order))
+		return blockedOrderFindColor(bitmap, x, y, x1, y1, order, this);
+	if (order <= DOWN_UP_RIGHT_LEFT)
+	{
+		return blockedColumnScan(x, y, x1, y1, order, [this, bitmap](int row, int low, int high, bool reversed){
+			int i = findRowMatch(computeCoordColor(bitmap, low, row), high - low, mPredicate, reversed);
+			if (i < 0)
+				return -1;
+			mPoint.x = low + i;
+			mPoint.y = row;
+			return low + i;
+		});
+	}
+	bool downUp = order == LEFT_RIGHT_DOWN_UP || order == RIGHT_LEFT_DOWN_UP;
+	bool rightLeft = order == RIGHT_LEFT_UP_DOWN || order == RIGHT_LEFT_DOWN_UP;
+	for (int j = 0; j < y1 - y; j++)
+	{
+		int row = downUp ? y1 - 1 - j : y + j;
+		int i = findRowMatch(computeCoordColor(bitmap, x, row), x1 - x, mPredicate, rightLeft);
+		if (i >= 0)
+		{
+			mPoint.x = x + i;
+			mPoint.y = row;
+			return true;
+		}
+	}
+	return false;
+}
+
+template<class TPixel,class TColor,class TShift>
+inline Point& ColorFinder<TPixel,TColor,TShift>::getResult()
 {
 	return mPoint;
 }
 
+template<class TPixel,class TColor,class TShift>
+inline bool scanRect(Bitmap* bitmap, int x, int y, int x1, int y1, int order, ColorFinder<TPixel,TColor,TShift>* finder)
+{
+	return finder->scanRect(bitmap, x, y, x1, y1, order);
+}
+
+
 
+template<class TFinder>
+inline AllFinder<TFinder>::AllFinder(TFinder* finder, int x, int y, int x1, int y1, int maxCount, int spacing,
+	std::vector<Point>* points, std::vector<int>* indexes)
+	:mFinder(finder), mPoints(points), mIndexes(indexes), mMaxCount(maxCount),
+	mSpacing(spacing > 1 ? spacing : 1), mX(x), mY(y)
+{
+	mColumns = (x1 - x) / mSpacing + 1;
+	mRows = (y1 - y) / mSpacing + 1;
+	if(mSpacing > 1)
+		mCells.assign(mColumns * mRows, 0);
+}
+
+template<class TFinder>
+inline bool AllFinder<TFinder>::compare(int x, int y, const unsigned char* color)
+{
+	int cx = (x - mX) / mSpacing;
+	int cy = (y - mY) / mSpacing;
+	if(mSpacing > 1){
+		for(int j = cy > 0 ? cy - 1 : 0; j <= cy + 1 && j < mRows; j++){
+			for(int i = cx > 0 ? cx - 1 : 0; i <= cx + 1 && i < mColumns; i++){
+				int index = mCells[j * mColumns + i];
+				if(index == 0)
+					continue;
+				Point& p = mPoints->at(index - 1);
+				if(abs(p.x - x) < mSpacing && abs(p.y - y) < mSpacing)
+					return false;
+			}
+		}
+	}
+	if(!mFinder->compare(x, y, color))
+		return false;
+	mPoints->emplace_back(x, y);
+	if(mIndexes)
+		mIndexes->push_back(findResultIndex(mFinder));
+	if(mSpacing > 1)
+		mCells[cy * mColumns + cx] = mPoints->size();
+	return (int)mPoints->size() >= mMaxCount;
+}
 
 template<class TFeature,class TShift>
 inline FeatureFinder<TFeature,TShift>::FeatureFinder(
@@ -140,6 +276,12 @@ inline Point& FeatureFinder<TFeature,TShift>::getResult()
 	return mPoint;
 }
 
+template<class TFeature,class TShift>
+inline bool scanRect(Bitmap* bitmap, int x, int y, int x1, int y1, int order, FeatureFinder<TFeature,TShift>* finder)
+{
+	return blockedOrderFindColor(bitmap, x, y, x1, y1, order, finder);
+}
+
 
 
 
@@ -148,22 +290,83 @@ inline Point& FeatureFinder<TFeature,TShift>::getResult()
 template<class TColor,class TShift>
 int getColorCount(Bitmap* bitmap, int x, int y, int x1, int y1, TColor color, TShift shift)
 {
-	ColorCounter<TColor,TShift> counter(color, shift);
-	upDownLeftRightReadColor(bitmap, x, y, x1, y1, &counter);
-	return counter.getResult();
+	return visitPixelFormat(bitmap->format_, [&](auto pixel){
+		return getColorCount<decltype(pixel)>(bitmap, x, y, x1, y1, color, shift);
+	});
+}
+
+template<class TPixel,class TColor,class TShift>
+int getColorCount(Bitmap* bitmap, int x, int y, int x1, int y1, TColor color, TShift shift)
+{
+	ColorCounter<TPixel,TColor,TShift> counter(color, shift);
+	auto index = (x1 - x) * (y1 - y) >= MIN_INDEXED_SCAN_AREA ? colorIndex(bitmap) : nullptr;
+	if (!index)
+	{
+		counter.countRect(bitmap, x, y, x1, y1);
+		return counter.getResult();
+	}
+	// tiles that all match are counted without reading them
+	TileMask mask(index.get(), x, y, x1, y1, color, shift);
+	int count = 0;
+	for (int tileY = y; tileY < y1; tileY = tileY / COLOR_INDEX_TILE * COLOR_INDEX_TILE + COLOR_INDEX_TILE)
+	{
+		int tileY1 = std::min(tileY / COLOR_INDEX_TILE * COLOR_INDEX_TILE + COLOR_INDEX_TILE, y1);
+		for (int tileX = x; tileX < x1; tileX = tileX / COLOR_INDEX_TILE * COLOR_INDEX_TILE + COLOR_INDEX_TILE)
+		{
+			int tileX1 = std::min(tileX / COLOR_INDEX_TILE * COLOR_INDEX_TILE + COLOR_INDEX_TILE, x1);
+			auto state = mask.state(tileX, tileY);
+			if (state == TILE_ALL)
+				count += (tileX1 - tileX) * (tileY1 - tileY);
+			else if (state == TILE_SOME)
+				counter.countRect(bitmap, tileX, tileY, tileX1, tileY1);
+		}
+	}
+	return count + counter.getResult();
+}
+
+// Finds with the color index when the bitmap has one, skipping the tiles
+// that cannot match. Falls back to the parallel scan when too much is left.
+template<class TColor,class TShift,class T1>
+bool indexedOrderFindColor(Bitmap* bitmap, int x, int y, int x1, int y1, TColor color, TShift shift, int order,
+	T1* comparator, bool parallel)
+{
+	auto index = (x1 - x) * (y1 - y) >= MIN_INDEXED_SCAN_AREA ? colorIndex(bitmap) : nullptr;
+	if (!index)
+		return parallel ? parallelOrderFindColor(bitmap, x, y, x1, y1, order, comparator)
+			: scanRect(bitmap, x, y, x1, y1, order, comparator);
+	TileMask mask(index.get(), x, y, x1, y1, color, shift);
+	if (mask.liveTiles() == 0)
+		return false;
+	if (parallel && mask.liveTiles() * COLOR_INDEX_TILE * COLOR_INDEX_TILE >= MIN_PARALLEL_SCAN_AREA &&
+		scanThreadCount() > 1)
+		return parallelOrderFindColor(bitmap, x, y, x1, y1, order, comparator);
+	return maskedOrderFindColor(bitmap, x, y, x1, y1, order, &mask, comparator);
 }
 
 template<class T>
 int compareColor(Bitmap* bitmap, int x, int y, T color, int colorShiftSum)
 {
-	return compareColor(computeCoordColor(bitmap, x, y), color, colorShiftSum);
+	const unsigned char* pixel = computeCoordColor(bitmap, x, y);
+	return visitPixelFormat(bitmap->format_, [&](auto format){
+		return compareColor<decltype(format)>(pixel, color, colorShiftSum);
+	});
 }
 
 template<class TColor,class TShift>
 bool findColor(Bitmap* bitmap, int x, int y, int x1, int y1,TColor color, TShift shift,int order, Point* out)
 {
-	ColorFinder<TColor,TShift> finder(color, shift);
-	bool result = orderFindColor(bitmap, x, y, x1, y1, order, &finder);
+	return visitPixelFormat(bitmap->format_, [&](auto pixel){
+		return findColor<decltype(pixel)>(bitmap, x, y, x1, y1, color, shift, order, out);
+	});
+}
+
+template<class TPixel,class TColor,class TShift>
+bool findColor(Bitmap* bitmap, int x, int y, int x1, int y1,TColor color, TShift shift,int order, Point* out)
+{
+	ColorFinder<TPixel,TColor,TShift> finder(color, shift);
+	// one thread running the row kernel beats the pool running the comparator
+	bool parallel = !finder.isVectorized(bitmap, order);
+	bool result = indexedOrderFindColor(bitmap, x, y, x1, y1, color, shift, order, &finder, parallel);
 	if (result && out)
 	{
 		Point& point = finder.getResult();
@@ -178,7 +381,7 @@ template<class TFeature, class TShift>
 bool findFeature(Bitmap* bitmap, int x, int y, int x1, int y1,TFeature feature, TShift shift,int direction,Point* out)
 {
 	FeatureFinder<TFeature,TShift> finder(bitmap,feature, shift);
-	bool result = orderFindColor(bitmap, x, y, x1, y1, direction, &finder);
+	bool result = parallelOrderFindColor(bitmap, x, y, x1, y1, direction, &finder);
 	if (result && out)
 	{
 		Point& point = finder.getResult();
@@ -188,6 +391,60 @@ bool findFeature(Bitmap* bitmap, int x, int y, int x1, int y1,TFeature feature,
 	return result;
 }
 
+template<class TColor,class TShift>
+int findAllColor(Bitmap* bitmap, int x, int y, int x1, int y1, TColor color, TShift shift, int order,
+	int maxCount, int spacing, std::vector<Point>* out)
+{
+	return visitPixelFormat(bitmap->format_, [&](auto pixel){
+		return findAllColor<decltype(pixel)>(bitmap, x, y, x1, y1, color, shift, order, maxCount, spacing, out);
+	});
+}
+
+template<class TPixel,class TColor,class TShift>
+int findAllColor(Bitmap* bitmap, int x, int y, int x1, int y1, TColor color, TShift shift, int order,
+	int maxCount, int spacing, std::vector<Point>* out)
+{
+	ColorFinder<TPixel,TColor,TShift> finder(color, shift);
+	AllFinder<ColorFinder<TPixel,TColor,TShift>> all(&finder, x, y, x1, y1, maxCount, spacing, out);
+	indexedOrderFindColor(bitmap, x, y, x1, y1, color, shift, order, &all, false);
+	return out->size();
+}
+
+template<class TFeature, class TShift>
+int findAllFeature(Bitmap* bitmap, int x, int y, int x1, int y1, TFeature feature, TShift shift, int order,
+	int maxCount, int spacing, std::vector<Point>* out)
+{
+	FeatureFinder<TFeature,TShift> finder(bitmap, feature, shift);
+	AllFinder<FeatureFinder<TFeature,TShift>> all(&finder, x, y, x1, y1, maxCount, spacing, out);
+	orderFindColor(bitmap, x, y, x1, y1, order, &all);
+	return out->size();
+}
+
+// Compositions of many alternatives scanned over a large area compare each
+// pixel through a ColorLut, one load for most pixels instead of a walk of
+// the alternatives. The answers are the same.
+inline bool findColor(Bitmap* bitmap, int x, int y, int x1, int y1, ColorComposition* color, int shift, int order, Point* out)
+{
+	if (auto lut = colorLut(color, shift, (int64_t)(x1 - x) * (y1 - y)))
+		return findColor<const ColorLut*,int>(bitmap, x, y, x1, y1, lut.get(), shift, order, out);
+	return findColor<ColorComposition*,int>(bitmap, x, y, x1, y1, color, shift, order, out);
+}
+
+inline int getColorCount(Bitmap* bitmap, int x, int y, int x1, int y1, ColorComposition* color, int shift)
+{
+	if (auto lut = colorLut(color, shift, (int64_t)(x1 - x) * (y1 - y)))
+		return getColorCount<const ColorLut*,int>(bitmap, x, y, x1, y1, lut.get(), shift);
+	return getColorCount<ColorComposition*,int>(bitmap, x, y, x1, y1, color, shift);
+}
+
+inline int findAllColor(Bitmap* bitmap, int x, int y, int x1, int y1, ColorComposition* color, int shift, int order,
+	int maxCount, int spacing, std::vector<Point>* out)
+{
+	if (auto lut = colorLut(color, shift, (int64_t)(x1 - x) * (y1 - y)))
+		return findAllColor<const ColorLut*,int>(bitmap, x, y, x1, y1, lut.get(), shift, order, maxCount, spacing, out);
+	return findAllColor<ColorComposition*,int>(bitmap, x, y, x1, y1, color, shift, order, maxCount, spacing, out);
+}
+
 }
 
 
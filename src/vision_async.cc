@@ -0,0 +1,107 @@
+#include "vision_async.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <unordered_map>
+
+namespace vision {
+
+void AsyncSearch::wait(){
+  if(isDone()){
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mMutex);
+  mFinished.wait(lock, [this]{ return isDone(); });
+}
+
+void AsyncSearch::finish(int found, const Point& point){
+  mFound = found;
+  mPoint = point;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    // sequentially consistent with CompletionQueue::enable, a reader that
+    // enables the queue and then finds the search running gets it pushed
+    mDone.store(true);
+  }
+  mFinished.notify_all();
+}
+
+CompletionQueue::~CompletionQueue(){
+  takeAll();
+}
+
+void CompletionQueue::push(SearchPtr search){
+  if(!isEnabled()){
+    return;
+  }
+  auto node = new Node{std::move(search), mHead.load(std::memory_order_relaxed)};
+  while(!mHead.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)){
+  }
+}
+
+auto CompletionQueue::takeAll()->std::vector<SearchPtr>{
+  Node* node = mHead.exchange(nullptr, std::memory_order_acquire);
+  std::vector<SearchPtr> searches;
+  // the list runs from the last pushed to the first
+  while(node != nullptr){
+    searches.push_back(std::move(node->search));
+    Node* next = node->next;
+    delete node;
+    node = next;
+  }
+  std::reverse(searches.begin(), searches.end());
+  return searches;
+}
+
+// how many submitted searches still read each bitmap
+struct Readers{
+  std::mutex mutex;
+  std::condition_variable done;
+  std::unordered_map<const Bitmap*, int> counts;
+};
+
+// never destroyed, pool threads may finish searches while the process exits
+static auto readers()->Readers&{
+  static auto instance = new Readers();
+  return *instance;
+}
+
+void waitForSearches(const Bitmap* bitmap){
+  auto& r = readers();
+  std::unique_lock<std::mutex> lock(r.mutex);
+  r.done.wait(lock, [&]{ return r.counts.find(bitmap) == r.counts.end(); });
+}
+
+auto submitSearch(AsyncJob job, const Bitmap* bitmap, std::shared_ptr<CompletionQueue> queue)->SearchPtr{
+  auto search = std::make_shared<AsyncSearch>();
+  {
+    auto& r = readers();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.counts[bitmap]++;
+  }
+  searchThreadPool()->submit([search, bitmap, queue, job = std::move(job)]{
+    Point point(-1, -1);
+    int found = 0;
+    // a search that threw is reported as not found, a waiter must never hang
+    try{
+      found = job(&point);
+    }catch(...){
+      found = 0;
+    }
+    if(!found){
+      point = Point(-1, -1);
+    }
+    {
+      auto& r = readers();
+      std::lock_guard<std::mutex> lock(r.mutex);
+      if(--r.counts[bitmap] == 0){
+        r.counts.erase(bitmap);
+      }
+      r.done.notify_all();
+    }
+    search->finish(found, point);
+    queue->push(search);
+  });
+  return search;
+}
+
+} // namespace vision
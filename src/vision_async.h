@@ -0,0 +1,85 @@
+#ifndef __VISION_ASYNC_H__
+#define __VISION_ASYNC_H__
+
+#include "Bitmap.h"
+#include "vision_util.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vision {
+
+// A search running on the search pool. The answer is written before done
+// is published, so whoever sees isDone() can read it.
+class AsyncSearch{
+  std::atomic<bool> mDone{false};
+  std::mutex mMutex;
+  std::condition_variable mFinished;
+  int mFound = 0;
+  Point mPoint{-1, -1};
+public:
+  auto isDone() const->bool{
+    return mDone.load();
+  }
+  // the 1-based index of the target that matched, 0 when nothing did
+  auto found() const->int{
+    return mFound;
+  }
+  auto point() const->const Point&{
+    return mPoint;
+  }
+  // blocks the calling thread until the search is done
+  void wait();
+  void finish(int found, const Point& point);
+};
+
+using SearchPtr = std::shared_ptr<AsyncSearch>;
+
+// Searches finished by the pool threads, read by the thread that owns them.
+// A worker pushes with one compare-and-swap and the reader takes the whole
+// list with one exchange, so neither side takes a lock. Nothing is kept
+// before the reader enables the queue, a search finished by then is done
+// before enable() returns or it is pushed.
+class CompletionQueue{
+  struct Node{
+    SearchPtr search;
+    Node* next;
+  };
+  std::atomic<Node*> mHead{nullptr};
+  std::atomic<bool> mEnabled{false};
+public:
+  CompletionQueue() = default;
+  CompletionQueue(const CompletionQueue&) = delete;
+  CompletionQueue& operator=(const CompletionQueue&) = delete;
+  ~CompletionQueue();
+  void enable(){
+    mEnabled.store(true);
+  }
+  auto isEnabled() const->bool{
+    return mEnabled.load();
+  }
+  // drops search while the queue is not enabled
+  void push(SearchPtr search);
+  // the searches pushed since the last call, in the order they finished
+  auto takeAll()->std::vector<SearchPtr>;
+};
+
+// Searches the pixels for a target, returns its 1-based index and writes
+// where it matched to out, 0 when nothing matched
+using AsyncJob = std::function<int(Point* out)>;
+
+// Runs job on the search pool. The search is done once job returns and is
+// pushed to queue right after. job reads the pixels of bitmap, which must
+// stay valid and unchanged until then.
+auto submitSearch(AsyncJob job, const Bitmap* bitmap, std::shared_ptr<CompletionQueue> queue)->SearchPtr;
+
+// blocks until no search submitted for bitmap runs, before its pixels are
+// released or replaced
+void waitForSearches(const Bitmap* bitmap);
+
+} // namespace vision
+
+#endif // __VISION_ASYNC_H__
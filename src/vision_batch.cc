@@ -0,0 +1,109 @@
+#include "vision_batch.h"
+#include "vision.h"
+
+namespace vision {
+
+// calls function with the most specific form of the color of query
+template<class TFunction>
+static auto visitQueryColor(BatchQuery& query, TFunction&& function){
+  ColorComposition* color = query.color;
+  if(color == nullptr){
+    return function(&query.value);
+  }
+  if(color->next == nullptr){
+    switch (color->color.type) {
+      case TColorType::ALONE:
+        return function((Color*)color->color.data);
+      case TColorType::COLOR_GAMUT:
+        return function((ColorGamut*)color->color.data);
+      case TColorType::NOT:
+        return function((ColorNot*)color->color.data);
+      case TColorType::COLOR_GAMUT_NOT:
+        return function((ColorGamutNot*)color->color.data);
+      default:
+        break;
+    }
+  }
+  return function(color);
+}
+
+QueryBatch::~QueryBatch(){
+  for(auto& color : mColors){
+    freeColorComposition(color.second);
+  }
+}
+
+auto QueryBatch::color(const char* str, size_t size)->ColorComposition*{
+  std::string_view key(str, size);
+  auto it = mColors.find(key);
+  if(it != mColors.end()){
+    return it->second;
+  }
+  auto color = decodeColor(str, size);
+  if(color != nullptr){
+    mColors.emplace(key, color);
+  }
+  return color;
+}
+
+auto QueryBatch::feature(const char* str, size_t size)->BoundFeature*{
+  std::string_view key(str, size);
+  auto it = mFeatures.find(key);
+  if(it != mFeatures.end()){
+    return &it->second->bound;
+  }
+  auto packed = getCachedFeature(str, size);
+  if(!packed){
+    return nullptr;
+  }
+  auto feature = new Feature{packed, BoundFeature(packed.get(), mBitmap)};
+  mFeatures.emplace(key, std::unique_ptr<Feature>(feature));
+  return &feature->bound;
+}
+
+template<class P>
+void QueryBatch::runQueries(std::vector<BatchResult>* results){
+  for(size_t i = 0; i < mQueries.size(); i++){
+    auto& query = mQueries[i];
+    auto& result = (*results)[i];
+    switch (query.type) {
+      case BATCH_GET_COLOR:
+        result.color = getColor(mBitmap, query.x, query.y);
+        result.found = true;
+        break;
+      case BATCH_IS_COLOR:{
+        const unsigned char* pixel = computeCoordColor(mBitmap, query.x, query.y);
+        result.found = visitQueryColor(query, [&](auto color){
+          return compareColor<P>(pixel, color, (int)query.shift) != 0;
+        });
+        break;
+      }
+      case BATCH_FIND_COLOR:
+        result.found = visitQueryColor(query, [&](auto color){
+          return findColor<P>(mBitmap, query.x, query.y, query.x1, query.y1, color, (int)query.shift,
+            query.order, &result.point);
+        });
+        break;
+      case BATCH_IS_FEATURE:
+        result.found = isFeature(mBitmap, 0, 0, query.feature, (int)query.shift);
+        break;
+      case BATCH_FIND_FEATURE:
+        query.feature->orderBySelectivity(mBitmap, query.x, query.y, query.x1, query.y1);
+        result.found = findFeature(mBitmap, query.x, query.y, query.x1, query.y1, query.feature, query.shift,
+          query.order, &result.point);
+        break;
+    }
+    if(!result.found){
+      result.point = Point(-1, -1);
+    }
+  }
+}
+
+void QueryBatch::run(std::vector<BatchResult>* results){
+  results->assign(mQueries.size(), BatchResult{false, Point(-1, -1), 0});
+  visitPixelFormat(mBitmap->format_, [&](auto pixel){
+    runQueries<decltype(pixel)>(results);
+  });
+}
+
+} // namespace vision
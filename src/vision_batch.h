@@ -0,0 +1,82 @@
+#ifndef __VISION_BATCH_H__
+#define __VISION_BATCH_H__
+
+#include "vision_color.h"
+#include "vision_feature.h"
+#include "vision_util.h"
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace vision {
+
+enum BatchQueryType:unsigned char{
+  BATCH_GET_COLOR,
+  BATCH_IS_COLOR,
+  BATCH_FIND_COLOR,
+  BATCH_IS_FEATURE,
+  BATCH_FIND_FEATURE,
+};
+
+// One check of a batch, the arguments of the bitmap method of the same name
+struct BatchQuery{
+  BatchQueryType type;
+  int x;
+  int y;
+  int x1;
+  int y1;
+  int order;
+  // per pixel for colors, for the whole feature for features
+  double shift;
+  // the color of an integer color argument, color is nullptr then
+  Color value;
+  ColorComposition* color;
+  BoundFeature* feature;
+};
+
+struct BatchResult{
+  bool found;
+  Point point;
+  Color color;
+};
+
+// The queries of one bitmap:batch call. Color and feature strings that
+// repeat across the queries are decoded and bound once, and the pixel
+// format is dispatched once for all of them.
+class QueryBatch{
+  struct Feature{
+    FeaturePtr packed;
+    BoundFeature bound;
+  };
+  Bitmap* mBitmap;
+  std::unordered_map<std::string_view, ColorComposition*> mColors;
+  std::unordered_map<std::string_view, std::unique_ptr<Feature>> mFeatures;
+  std::vector<BatchQuery> mQueries;
+  template<class P>
+  void runQueries(std::vector<BatchResult>* results);
+public:
+  explicit QueryBatch(Bitmap* bitmap):mBitmap(bitmap){}
+  QueryBatch(const QueryBatch&) = delete;
+  QueryBatch& operator=(const QueryBatch&) = delete;
+  ~QueryBatch();
+  // The decoded color or feature, nullptr when the string is invalid. The
+  // strings must outlive the batch.
+  auto color(const char* str, size_t size)->ColorComposition*;
+  auto feature(const char* str, size_t size)->BoundFeature*;
+  void add(const BatchQuery& query){
+    mQueries.push_back(query);
+  }
+  auto size() const->size_t{
+    return mQueries.size();
+  }
+  auto query(size_t i) const->const BatchQuery&{
+    return mQueries[i];
+  }
+  // results[i] answers query i
+  void run(std::vector<BatchResult>* results);
+};
+
+} // namespace vision
+
+#endif // __VISION_BATCH_H__
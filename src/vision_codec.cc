@@ -0,0 +1,337 @@
+#include "vision_codec.h"
+#include <lodepng.h>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+namespace vision {
+
+// well above an 8K screen and below the 400M pixels the QOI specification
+// allows, a corrupt header cannot make a decoder allocate gigabytes
+static constexpr uint32_t MAX_IMAGE_SIDE = 16384;
+static constexpr uint64_t MAX_IMAGE_PIXELS = 64 * 1024 * 1024;
+// a QOI run chunk is the most pixels one byte can encode
+static constexpr uint64_t QOI_MAX_RUN = 62;
+static constexpr unsigned char QOI_END[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+static constexpr int QOI_HEADER_SIZE = 14;
+
+static auto hasExtension(const char* path, size_t size, const char* extension)->bool{
+  size_t length = strlen(extension);
+  if(size < length){
+    return false;
+  }
+  for(size_t i = 0; i < length; i++){
+    if(tolower((unsigned char)path[size - length + i]) != extension[i]){
+      return false;
+    }
+  }
+  return true;
+}
+
+auto imageFormatOf(const char* path)->ImageFormat{
+  size_t size = strlen(path);
+  if(hasExtension(path, size, ".raw")){
+    return IMAGE_RAW;
+  }
+  if(hasExtension(path, size, ".qoi")){
+    return IMAGE_QOI;
+  }
+  return IMAGE_PNG;
+}
+
+static auto readLittle32(const unsigned char* p)->uint32_t{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void writeLittle32(unsigned char* p, uint32_t v){
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static auto readBig32(const unsigned char* p)->uint32_t{
+  return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void writeBig32(unsigned char* p, uint32_t v){
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static auto checkImageSize(uint32_t width, uint32_t height)->const char*{
+  if(width == 0 || height == 0 || width > MAX_IMAGE_SIDE || height > MAX_IMAGE_SIDE ||
+    (uint64_t)width * height > MAX_IMAGE_PIXELS){
+    return "invalid image size";
+  }
+  return nullptr;
+}
+
+static auto parseRawHeader(const unsigned char* data, size_t size, RawImageHeader* header)->const char*{
+  if(size < sizeof(RawImageHeader)){
+    return "raw image is smaller than its header";
+  }
+  header->magic = readLittle32(data);
+  header->version = readLittle32(data + 4);
+  header->width = readLittle32(data + 8);
+  header->height = readLittle32(data + 12);
+  header->pixelStride = readLittle32(data + 16);
+  header->headerSize = readLittle32(data + 20);
+  if(header->magic != RAW_IMAGE_MAGIC){
+    return "not a raw image";
+  }
+  if(header->version != RAW_IMAGE_VERSION || header->pixelStride != 4 || header->headerSize < sizeof(RawImageHeader)){
+    return "unsupported raw image";
+  }
+  return checkImageSize(header->width, header->height);
+}
+
+auto decodeRaw(const unsigned char* data, size_t size, std::vector<unsigned char>& pixels, unsigned int& width, unsigned int& height)->const char*{
+  RawImageHeader header;
+  if(auto error = parseRawHeader(data, size, &header)){
+    return error;
+  }
+  size_t bytes = (size_t)header.width * header.height * 4;
+  if(size < header.headerSize || size - header.headerSize < bytes){
+    return "raw image is truncated";
+  }
+  pixels.assign(data + header.headerSize, data + header.headerSize + bytes);
+  width = header.width;
+  height = header.height;
+  return nullptr;
+}
+
+auto decodeRawFile(const char* path, std::vector<unsigned char>& pixels, unsigned int& width, unsigned int& height)->const char*{
+  std::unique_ptr<FILE, int(*)(FILE*)> file(fopen(path, "rb"), fclose);
+  if(!file){
+    return "failed to open file for reading";
+  }
+  unsigned char data[sizeof(RawImageHeader)];
+  size_t size = fread(data, 1, sizeof(data), file.get());
+  RawImageHeader header;
+  if(auto error = parseRawHeader(data, size, &header)){
+    return error;
+  }
+  size_t bytes = (size_t)header.width * header.height * 4;
+  if(fseek(file.get(), 0, SEEK_END) != 0){
+    return "failed to read file";
+  }
+  long fileSize = ftell(file.get());
+  if(fileSize < 0 || (size_t)fileSize < header.headerSize || (size_t)fileSize - header.headerSize < bytes){
+    return "raw image is truncated";
+  }
+  // the pixels are read straight into place
+  pixels.resize(bytes);
+  if(fseek(file.get(), header.headerSize, SEEK_SET) != 0 || fread(pixels.data(), 1, bytes, file.get()) != bytes){
+    return "raw image is truncated";
+  }
+  width = header.width;
+  height = header.height;
+  return nullptr;
+}
+
+static inline auto qoiHash(const unsigned char* px)->int{
+  return (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+}
+
+auto decodeQoi(const unsigned char* data, size_t size, std::vector<unsigned char>& pixels, unsigned int& width, unsigned int& height)->const char*{
+  if(size < QOI_HEADER_SIZE + sizeof(QOI_END) || memcmp(data, "qoif", 4) != 0){
+    return "not a QOI image";
+  }
+  uint32_t w = readBig32(data + 4);
+  uint32_t h = readBig32(data + 8);
+  int channels = data[12];
+  if(channels != 3 && channels != 4){
+    return "unsupported QOI image";
+  }
+  if(auto error = checkImageSize(w, h)){
+    return error;
+  }
+  if((uint64_t)w * h > (size - QOI_HEADER_SIZE - sizeof(QOI_END)) * QOI_MAX_RUN){
+    return "QOI image is truncated";
+  }
+  pixels.resize((size_t)w * h * 4);
+  unsigned char index[64 * 4] = {};
+  unsigned char px[4] = {0, 0, 0, 255};
+  size_t p = QOI_HEADER_SIZE;
+  size_t chunksEnd = size - sizeof(QOI_END);
+  int run = 0;
+  for(unsigned char* out = pixels.data(), *end = out + pixels.size(); out < end; out += 4){
+    if(run > 0){
+      run--;
+    }else{
+      if(p >= chunksEnd){
+        return "QOI image is truncated";
+      }
+      int b1 = data[p++];
+      if(b1 == 0xfe){
+        if(p + 3 > chunksEnd){
+          return "QOI image is truncated";
+        }
+        px[0] = data[p];
+        px[1] = data[p + 1];
+        px[2] = data[p + 2];
+        p += 3;
+      }else if(b1 == 0xff){
+        if(p + 4 > chunksEnd){
+          return "QOI image is truncated";
+        }
+        memcpy(px, data + p, 4);
+        p += 4;
+      }else if((b1 & 0xc0) == 0x00){
+        memcpy(px, index + b1 * 4, 4);
+      }else if((b1 & 0xc0) == 0x40){
+        px[0] += ((b1 >> 4) & 0x03) - 2;
+        px[1] += ((b1 >> 2) & 0x03) - 2;
+        px[2] += (b1 & 0x03) - 2;
+      }else if((b1 & 0xc0) == 0x80){
+        if(p >= chunksEnd){
+          return "QOI image is truncated";
+        }
+        int b2 = data[p++];
+        int vg = (b1 & 0x3f) - 32;
+        px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+        px[1] += vg;
+        px[2] += vg - 8 + (b2 & 0x0f);
+      }else{
+        run = b1 & 0x3f;
+      }
+      memcpy(index + qoiHash(px) * 4, px, 4);
+    }
+    memcpy(out, px, 4);
+  }
+  width = w;
+  height = h;
+  return nullptr;
+}
+
+static void encodeRaw(const unsigned char* pixels, unsigned int width, unsigned int height, std::vector<unsigned char>& out){
+  out.resize(sizeof(RawImageHeader) + (size_t)width * height * 4);
+  unsigned char* header = out.data();
+  memset(header, 0, sizeof(RawImageHeader));
+  writeLittle32(header, RAW_IMAGE_MAGIC);
+  writeLittle32(header + 4, RAW_IMAGE_VERSION);
+  writeLittle32(header + 8, width);
+  writeLittle32(header + 12, height);
+  writeLittle32(header + 16, 4);
+  writeLittle32(header + 20, sizeof(RawImageHeader));
+  memcpy(header + sizeof(RawImageHeader), pixels, (size_t)width * height * 4);
+}
+
+static void encodeQoi(const unsigned char* pixels, unsigned int width, unsigned int height, std::vector<unsigned char>& out){
+  size_t count = (size_t)width * height;
+  // worst case is an RGBA chunk per pixel
+  out.resize(QOI_HEADER_SIZE + count * 5 + sizeof(QOI_END));
+  unsigned char* o = out.data();
+  memcpy(o, "qoif", 4);
+  writeBig32(o + 4, width);
+  writeBig32(o + 8, height);
+  o[12] = 4;
+  o[13] = 0;
+  o += QOI_HEADER_SIZE;
+  unsigned char index[64 * 4] = {};
+  unsigned char previous[4] = {0, 0, 0, 255};
+  int run = 0;
+  for(size_t i = 0; i < count; i++){
+    const unsigned char* px = pixels + i * 4;
+    if(memcmp(px, previous, 4) == 0){
+      run++;
+      if(run == 62 || i + 1 == count){
+        *o++ = 0xc0 | (run - 1);
+        run = 0;
+      }
+      continue;
+    }
+    if(run > 0){
+      *o++ = 0xc0 | (run - 1);
+      run = 0;
+    }
+    int hash = qoiHash(px);
+    if(memcmp(index + hash * 4, px, 4) == 0){
+      *o++ = hash;
+    }else{
+      memcpy(index + hash * 4, px, 4);
+      if(px[3] == previous[3]){
+        int vr = (signed char)(px[0] - previous[0]);
+        int vg = (signed char)(px[1] - previous[1]);
+        int vb = (signed char)(px[2] - previous[2]);
+        int vgr = vr - vg;
+        int vgb = vb - vg;
+        if(vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2){
+          *o++ = 0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+        }else if(vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8){
+          *o++ = 0x80 | (vg + 32);
+          *o++ = (vgr + 8) << 4 | (vgb + 8);
+        }else{
+          *o++ = 0xfe;
+          *o++ = px[0];
+          *o++ = px[1];
+          *o++ = px[2];
+        }
+      }else{
+        *o++ = 0xff;
+        memcpy(o, px, 4);
+        o += 4;
+      }
+    }
+    memcpy(previous, px, 4);
+  }
+  memcpy(o, QOI_END, sizeof(QOI_END));
+  o += sizeof(QOI_END);
+  out.resize(o - out.data());
+}
+
+auto packPixels(const Bitmap* bitmap, std::vector<unsigned char>& packed)->const unsigned char*{
+  if(bitmap->format_ == PIXEL_RGBA && bitmap->pixelStride_ == 4 && bitmap->rowShift_ == 4 * (int)bitmap->width_){
+    return bitmap->origin_;
+  }
+  packed.resize((size_t)bitmap->width_ * bitmap->height_ * 4);
+  const int red = channelOffset(bitmap->format_, CHANNEL_RED);
+  const int green = channelOffset(bitmap->format_, CHANNEL_GREEN);
+  const int blue = channelOffset(bitmap->format_, CHANNEL_BLUE);
+  const bool alpha = pixelFormatBytes(bitmap->format_) == 4;
+  for(unsigned int i = 0; i < bitmap->height_; i++){
+    const unsigned char* pixel = bitmap->origin_ + i * bitmap->rowShift_;
+    unsigned char* out = packed.data() + (size_t)i * bitmap->width_ * 4;
+    for(unsigned int j = 0; j < bitmap->width_; j++){
+      out[0] = pixel[red];
+      out[1] = pixel[green];
+      out[2] = pixel[blue];
+      out[3] = alpha ? pixel[3] : 255;
+      pixel += bitmap->pixelStride_;
+      out += 4;
+    }
+  }
+  return packed.data();
+}
+
+auto saveImage(const Bitmap* bitmap, const char* path, ImageFormat format)->const char*{
+  if(bitmap->origin_ == nullptr || bitmap->width_ == 0 || bitmap->height_ == 0){
+    return "image is empty";
+  }
+  std::vector<unsigned char> packed;
+  const unsigned char* pixels = packPixels(bitmap, packed);
+  if(format == IMAGE_PNG){
+    auto error = lodepng::encode(path, pixels, bitmap->width_, bitmap->height_);
+    return error ? lodepng_error_text(error) : nullptr;
+  }
+  std::vector<unsigned char> encoded;
+  if(format == IMAGE_RAW){
+    encodeRaw(pixels, bitmap->width_, bitmap->height_, encoded);
+  }else{
+    encodeQoi(pixels, bitmap->width_, bitmap->height_, encoded);
+  }
+  std::unique_ptr<FILE, int(*)(FILE*)> file(fopen(path, "wb"), fclose);
+  if(!file){
+    return "failed to open file for writing";
+  }
+  if(fwrite(encoded.data(), 1, encoded.size(), file.get()) != encoded.size()){
+    return "failed to write file";
+  }
+  return nullptr;
+}
+
+} // namespace vision
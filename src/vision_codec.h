@@ -0,0 +1,53 @@
+#ifndef __VISION_CODEC_H__
+#define __VISION_CODEC_H__
+
+#include "Bitmap.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vision {
+
+enum ImageFormat{
+  IMAGE_PNG,
+  // header plus the 4-byte pixels exactly as a loaded CommonBitmap holds
+  // them, loading is a single read
+  IMAGE_RAW,
+  // https://qoiformat.org, lossless and an order of magnitude faster to decode than PNG
+  IMAGE_QOI,
+};
+
+constexpr uint32_t RAW_IMAGE_MAGIC = 0x57525653; // "SVRW"
+constexpr uint32_t RAW_IMAGE_VERSION = 1;
+
+// Little endian. Pixels follow at headerSize, which keeps rows 16-byte
+// aligned when the file is mapped.
+struct RawImageHeader{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t pixelStride;
+  uint32_t headerSize;
+  uint32_t reserved[2];
+};
+
+// by extension, .raw and .qoi, anything else is PNG
+auto imageFormatOf(const char* path)->ImageFormat;
+
+// The decoders fill pixels with tight 4-byte pixels and return nullptr, or
+// the reason they failed.
+auto decodeRaw(const unsigned char* data, size_t size, std::vector<unsigned char>& pixels, unsigned int& width, unsigned int& height)->const char*;
+auto decodeRawFile(const char* path, std::vector<unsigned char>& pixels, unsigned int& width, unsigned int& height)->const char*;
+auto decodeQoi(const unsigned char* data, size_t size, std::vector<unsigned char>& pixels, unsigned int& width, unsigned int& height)->const char*;
+
+// Tight 4-byte copy of bitmaps with padded rows or 3-byte pixels, bitmaps
+// that are already tight are returned as is.
+auto packPixels(const Bitmap* bitmap, std::vector<unsigned char>& packed)->const unsigned char*;
+
+// encoded bitmap written to path, nullptr or the reason it failed
+auto saveImage(const Bitmap* bitmap, const char* path, ImageFormat format)->const char*;
+
+} // namespace vision
+
+#endif // __VISION_CODEC_H__
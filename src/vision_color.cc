@@ -186,7 +186,7 @@ auto encodeColor(const ColorNot*color,std::string&out){
   auto data = color->data;
   char str[9];
   sprintf(str,"!%06x",data);
-  out.append(str,8);
+  out.append(str,7);
 }
 
 auto encodeColor(const ColorComposition *color)->std::string{
@@ -67,35 +67,62 @@ struct ColorComposition{
 constexpr int MAX_COLOR_SHIFT = 255*3;
 constexpr int DECODE_COLOR_SHIFT = (sizeof(Color)-3)*8;
 
+// the byte of a color value compared with byte pixelByte of a pixel of format
+inline auto referenceChannel(PixelFormat format,int pixelByte)->int{
+    for(int channel = 0; channel < 3; channel++){
+        if(channelOffset(format,channel) == pixelByte)
+            return colorValueByte(channel);
+    }
+    return colorValueByte(pixelByte);
+}
+
+// a color value with its bytes moved to the pixel byte they are compared
+// with in a pixel of format, alpha cleared. Only for formats with three
+// channel bytes.
+inline auto toPixelOrder(ColorValueType value,PixelFormat format)->uint32_t{
+    auto bytes = (const unsigned char*)&value;
+    uint32_t result = 0;
+    auto out = (unsigned char*)&result;
+    for(int channel = 0; channel < 3; channel++){
+        out[channelOffset(format,channel)] = bytes[colorValueByte(channel)];
+    }
+    return result;
+}
+
+template<class P>
 inline auto computeColorShiftSum(const unsigned char* color,Color * c)->int{
-    return computeColorShiftSum(color,(unsigned char*)c);
+    return computeColorShiftSum<P>(color,(unsigned char*)c);
 }
 
+template<class P>
 inline auto computeColorShiftSum(const unsigned char* color,ColorGamut * c)->int{
-    return computeColorShiftSum(color,(unsigned char*)&c->color,(unsigned char*)&c->shift);
+    return computeColorShiftSum<P>(color,(unsigned char*)&c->color,(unsigned char*)&c->shift);
 }
 
+template<class P>
 inline auto computeColorShiftSum(const unsigned char* color,ColorNot * c)->int{
-    return computeColorShiftSum(color,(unsigned char*)&c->data);
+    return computeColorShiftSum<P>(color,(unsigned char*)&c->data);
 }
 
 
+template<class P>
 inline auto computeColorShiftSum(const unsigned char* color,ColorGamutNot * c)->int{
-    return computeColorGamutNotShiftSum(color,(unsigned char*)&c->color,(unsigned char*)&c->shift);
+    return computeColorGamutNotShiftSum<P>(color,(unsigned char*)&c->color,(unsigned char*)&c->shift);
 }
 
 
+template<class P>
 inline auto computeColorShiftSum(const unsigned char* color,TColorBase *c)->int{
     switch (c->type)
     {
     case TColorType::ALONE:
-        return computeColorShiftSum(color,(Color*)c->data);
+        return computeColorShiftSum<P>(color,(Color*)c->data);
     case TColorType::COLOR_GAMUT:
-        return computeColorShiftSum(color,(ColorGamut*)c->data);
+        return computeColorShiftSum<P>(color,(ColorGamut*)c->data);
     case TColorType::NOT:
-        return computeColorShiftSum(color,(ColorNot*)c->data);
+        return computeColorShiftSum<P>(color,(ColorNot*)c->data);
     case TColorType::COLOR_GAMUT_NOT:
-        return computeColorShiftSum(color,(ColorGamutNot*)c->data);
+        return computeColorShiftSum<P>(color,(ColorGamutNot*)c->data);
     default:
         break;
     }
@@ -103,10 +130,11 @@ inline auto computeColorShiftSum(const unsigned char* color,TColorBase *c)->int{
 }
 
 
+template<class P>
 inline auto computeColorShiftSum(const unsigned char* color,ColorComposition * c)->int{
     int result = MAX_COLOR_SHIFT;
     while(c){
-        int count = computeColorShiftSum(color,&c->color);
+        int count = computeColorShiftSum<P>(color,&c->color);
         if(count<result) result = count;
         if(result == 0) break;
         c = c->next;
@@ -114,45 +142,69 @@ inline auto computeColorShiftSum(const unsigned char* color,ColorComposition * c
     return result;
 }
 
+// one color alternative stored unpacked, shift is unused for ALONE and NOT
+template<class P>
+inline auto computeColorShiftSum(const unsigned char* color,TColorType type,const ColorValueType* c,const ColorValueType* s)->int{
+    switch (type)
+    {
+    case TColorType::ALONE:
+    case TColorType::NOT:
+        return computeColorShiftSum<P>(color,(const unsigned char*)c);
+    case TColorType::COLOR_GAMUT:
+        return computeColorShiftSum<P>(color,(const unsigned char*)c,(const unsigned char*)s);
+    case TColorType::COLOR_GAMUT_NOT:
+        return computeColorGamutNotShiftSum<P>(color,(const unsigned char*)c,(const unsigned char*)s);
+    default:
+        break;
+    }
+    return MAX_COLOR_SHIFT;
+}
+
+template<class P>
 inline auto compareColor(const unsigned char* color,Color * c,int colorShiftSum)->int{
-    return computeColorShiftSum(color,c) <= colorShiftSum;
+    return computeColorShiftSum<P>(color,c) <= colorShiftSum;
 }
 
+template<class P>
 inline auto compareColor(const unsigned char* color,ColorGamut * c,int colorShiftSum)->int{
-    return computeColorShiftSum(color,c) <= colorShiftSum;
+    return computeColorShiftSum<P>(color,c) <= colorShiftSum;
 }
 
+template<class P>
 inline auto compareColor(const unsigned char* color,ColorNot * c,int colorShiftSum)->int{
-    return computeColorShiftSum(color,c) <= colorShiftSum;
+    return computeColorShiftSum<P>(color,c) <= colorShiftSum;
 }
 
+template<class P>
 inline auto compareColor(const unsigned char* color,ColorGamutNot * c,int colorShiftSum)->int{
-    return computeColorShiftSum(color,c) <= colorShiftSum;
+    return computeColorShiftSum<P>(color,c) <= colorShiftSum;
 }
 
+template<class P>
 inline auto compareColor(const unsigned char* color,TColorBase *c,int colorShiftSum)->int{
     switch (c->type)
     {
     case TColorType::ALONE:
-        return compareColor(color,(Color*)c->data,colorShiftSum);
+        return compareColor<P>(color,(Color*)c->data,colorShiftSum);
     case TColorType::COLOR_GAMUT:
-        return compareColor(color,(ColorGamut*)c->data,colorShiftSum);
+        return compareColor<P>(color,(ColorGamut*)c->data,colorShiftSum);
     case TColorType::NOT:
-        return compareColor(color,(ColorNot*)c->data,colorShiftSum);
+        return compareColor<P>(color,(ColorNot*)c->data,colorShiftSum);
     case TColorType::COLOR_GAMUT_NOT:
-        return compareColor(color,(ColorGamutNot*)c->data,colorShiftSum);
+        return compareColor<P>(color,(ColorGamutNot*)c->data,colorShiftSum);
     default:
         break;
     }
     return 0;
 }
 
+template<class P>
 inline auto compareColor(const unsigned char* color,ColorComposition * c,int colorShiftSum)->int{
     int result = 0;
     int index = 0;
     while(c){
         index++;
-        if(compareColor(color,&c->color,colorShiftSum)){
+        if(compareColor<P>(color,&c->color,colorShiftSum)){
             result = index;
             break;
         }
@@ -2,7 +2,9 @@
 
 #include "vision_feature.h"
 #include "vision_color.h"
+#include "vision_parallel.h"
 #include "vision_util.h"
+#include <algorithm>
 #include <cstdlib>
 
 namespace vision {
@@ -91,6 +93,85 @@ namespace vision {
     }
   }
 
+  auto packFeature(const FeatureCompositionRoot *feature, PackedFeature *out)->void{
+    *out = PackedFeature();
+    out->colorStart.push_back(0);
+    for(auto f = feature->data; f != nullptr; f = f->next){
+      if(out->count == 0){
+        out->minX = out->maxX = f->x;
+        out->minY = out->maxY = f->y;
+      }else{
+        if(f->x < out->minX) out->minX = f->x;
+        if(f->x > out->maxX) out->maxX = f->x;
+        if(f->y < out->minY) out->minY = f->y;
+        if(f->y > out->maxY) out->maxY = f->y;
+      }
+      out->count++;
+      out->xs.push_back(f->x);
+      out->ys.push_back(f->y);
+      for(auto c = f->color; c != nullptr; c = c->next){
+        auto data = (const ColorValueType*)c->color.data;
+        out->kinds.push_back(c->color.type);
+        out->colors.push_back(data[0]);
+        switch (c->color.type) {
+          case TColorType::COLOR_GAMUT:
+          case TColorType::COLOR_GAMUT_NOT:
+            out->shifts.push_back(data[1]);
+            break;
+          default:
+            out->shifts.push_back(0);
+            break;
+        }
+      }
+      out->colorStart.push_back(out->kinds.size());
+    }
+  }
+
+  auto decodeFeature(const char *str, int size, PackedFeature *feature)->bool{
+    FeatureCompositionRoot root;
+    if(!decodeFeature(str, size, &root)) return false;
+    packFeature(&root, feature);
+    freeFeatureComposition(&root);
+    return true;
+  }
+
+  BoundFeature::BoundFeature(const PackedFeature *feature, const Bitmap *bitmap)
+    :feature(feature), offsets(feature->count), order(feature->count){
+    for(uint32_t i = 0; i < feature->count; i++){
+      offsets[i] = feature->ys[i] * bitmap->rowShift_ + feature->xs[i] * bitmap->pixelStride_;
+      order[i] = i;
+    }
+  }
+
+  static auto featureCache()->LruCache<PackedFeature>&{
+    static LruCache<PackedFeature> cache(DEFAULT_FEATURE_CACHE_SIZE);
+    return cache;
+  }
+
+  auto getCachedFeature(const char *str, int size)->FeaturePtr{
+    auto &cache = featureCache();
+    std::string_view key(str, size);
+    if(auto feature = cache.get(key)) return feature;
+    auto feature = std::make_shared<PackedFeature>();
+    if(!decodeFeature(str, size, feature.get())){
+      return nullptr;
+    }
+    cache.put(key, feature);
+    return feature;
+  }
+
+  auto featureCacheStats()->CacheStats{
+    return featureCache().stats();
+  }
+
+  void setFeatureCacheSize(size_t size){
+    featureCache().setCapacity(size);
+  }
+
+  void clearFeatureCache(){
+    featureCache().clear();
+  }
+
   auto encodeFeature(FeatureCompositionRoot *feature)->std::string{
     std::string result;
     auto f = feature->data;
@@ -109,11 +190,19 @@ namespace vision {
   }
 
 
-  auto isFeature(Bitmap *bitmap, FeatureCompositionRoot *feature, int shiftSum)->bool{
+  template<class P>
+  static auto isFeatureInFormat(Bitmap *bitmap, int x, int y, FeatureCompositionRoot *feature, int shiftSum)->bool{
     auto f = feature->data;
     int nowShift = 0;
+    int nowX = 0;
+    int nowY = 0;
     while(f != nullptr){
-      nowShift += computeColorShiftSum(computeCoordColor(bitmap, f->x, f->y),f->color);
+      nowX = x+f->x;
+      nowY = y+f->y;
+      if(isInBitmapScope(bitmap, nowX, nowY))
+        nowShift += computeColorShiftSum<P>(computeCoordColor(bitmap, nowX,nowY),f->color);
+      else
+        nowShift += MAX_COLOR_SHIFT;
       if(nowShift>shiftSum){
         return false;
       }
@@ -122,23 +211,232 @@ namespace vision {
     return true;
   }
 
+  auto isFeature(Bitmap *bitmap, FeatureCompositionRoot *feature, int shiftSum)->bool{
+    return isFeature(bitmap, 0, 0, feature, shiftSum);
+  }
+
   auto isFeature(Bitmap *bitmap, int x, int y, FeatureCompositionRoot *feature, int shiftSum)->bool{
-    auto f = feature->data;
+    return visitPixelFormat(bitmap->format_, [&](auto pixel){
+      return isFeatureInFormat<decltype(pixel)>(bitmap, x, y, feature, shiftSum);
+    });
+  }
+
+  template<class P>
+  static inline auto computePointShiftSum(const unsigned char *color, const PackedFeature *feature, uint32_t point)->int{
+    int result = MAX_COLOR_SHIFT;
+    for(uint32_t i = feature->colorStart[point]; i < feature->colorStart[point+1]; i++){
+      int count = computeColorShiftSum<P>(color, feature->kinds[i], &feature->colors[i], &feature->shifts[i]);
+      if(count < result) result = count;
+      if(result == 0) break;
+    }
+    return result;
+  }
+
+  void BoundFeature::orderBySelectivity(Bitmap *bitmap, int x, int y, int x1, int y1){
+    int width = x1 - x;
+    int height = y1 - y;
+    if(width <= 0 || height <= 0 || width * height < MIN_SELECTIVITY_SEARCH_AREA || feature->count < 2){
+      return;
+    }
+    // the expected shift of a point is its shift against the colors of the area
+    std::vector<uint64_t> shifts(feature->count, 0);
+    visitPixelFormat(bitmap->format_, [&](auto pixel){
+      for(int j = 0; j < SELECTIVITY_SAMPLES; j++){
+        int sampleY = y + (2 * j + 1) * height / (2 * SELECTIVITY_SAMPLES);
+        for(int i = 0; i < SELECTIVITY_SAMPLES; i++){
+          int sampleX = x + (2 * i + 1) * width / (2 * SELECTIVITY_SAMPLES);
+          const unsigned char *color = computeCoordColor(bitmap, sampleX, sampleY);
+          for(uint32_t point = 0; point < feature->count; point++){
+            shifts[point] += computePointShiftSum<decltype(pixel)>(color, feature, point);
+          }
+        }
+      }
+    });
+    std::vector<uint64_t> weights(feature->count);
+    for(uint32_t point = 0; point < feature->count; point++){
+      uint32_t cost = feature->colorStart[point + 1] - feature->colorStart[point];
+      weights[point] = shifts[point] / (cost ? cost : 1);
+    }
+    std::stable_sort(order.begin(), order.end(), [&weights](uint32_t a, uint32_t b){
+      return weights[a] > weights[b];
+    });
+  }
+
+  template<class P>
+  static auto isBoundFeatureInFormat(Bitmap *bitmap, int x, int y, const BoundFeature *bound, int shiftSum)->bool{
+    auto feature = bound->feature;
     int nowShift = 0;
-    int nowX = 0;
-    int nowY = 0;
-    while(f != nullptr){
-      nowX = x+f->x;
-      nowY = y+f->y;
+    if(x + feature->minX >= 0 && y + feature->minY >= 0 &&
+      x + feature->maxX < (int)bitmap->width_ && y + feature->maxY < (int)bitmap->height_){
+      const unsigned char *base = computeCoordColor(bitmap, x, y);
+      const int *offsets = bound->offsets.data();
+      for(uint32_t i : bound->order){
+        nowShift += computePointShiftSum<P>(base + offsets[i], feature, i);
+        if(nowShift > shiftSum){
+          return false;
+        }
+      }
+      return true;
+    }
+    for(uint32_t i : bound->order){
+      int nowX = x + feature->xs[i];
+      int nowY = y + feature->ys[i];
       if(isInBitmapScope(bitmap, nowX, nowY))
-        nowShift += computeColorShiftSum(computeCoordColor(bitmap, nowX,nowY),f->color);
+        nowShift += computePointShiftSum<P>(computeCoordColor(bitmap, nowX, nowY), feature, i);
       else
         nowShift += MAX_COLOR_SHIFT;
-      if(nowShift>shiftSum){
+      if(nowShift > shiftSum){
         return false;
       }
-      f = f->next;
     }
     return true;
   }
-}
\ No newline at end of file
+
+  auto isFeature(Bitmap *bitmap, int x, int y, BoundFeature *bound, int shiftSum)->bool{
+    return visitPixelFormat(bitmap->format_, [&](auto pixel){
+      return isBoundFeatureInFormat<decltype(pixel)>(bitmap, x, y, bound, shiftSum);
+    });
+  }
+
+  // the shift one channel of a color alternative adds for a channel value
+  static inline auto channelShift(TColorType kind, int color, int shift, int value)->int{
+    int distance = abs(value - color);
+    switch (kind)
+    {
+    case TColorType::COLOR_GAMUT:
+      return std::max(0, distance - shift);
+    case TColorType::COLOR_GAMUT_NOT:
+      return std::max(0, shift - distance);
+    default:
+      return distance;
+    }
+  }
+
+  FeatureSet::FeatureSet(const Bitmap *bitmap, const std::vector<FeaturePtr> &features, const std::vector<int> &shiftSums)
+    :mWords((int)((features.size() + 63) / 64)), mAlways(mWords, 0){
+    constexpr int levels = 1 << ANCHOR_GRID_BITS;
+    constexpr int levelWidth = 256 / levels;
+    for(size_t i = 0; i < features.size(); i++){
+      const PackedFeature *feature = features[i].get();
+      mPacked.push_back(features[i]);
+      mFeatures.emplace_back(feature, bitmap);
+      mShiftSums.push_back(shiftSums[i]);
+      uint64_t bit = 1ull << (i % 64);
+      if(feature->count == 0){
+        mAlways[i / 64] |= bit;
+        continue;
+      }
+      auto group = std::find_if(mGroups.begin(), mGroups.end(), [&](const AnchorGroup &group){
+        return group.x == feature->xs[0] && group.y == feature->ys[0];
+      });
+      if(group == mGroups.end()){
+        mGroups.push_back(AnchorGroup{feature->xs[0], feature->ys[0],
+          feature->ys[0] * bitmap->rowShift_ + feature->xs[0] * bitmap->pixelStride_,
+          std::vector<uint64_t>(mWords, 0), std::vector<uint64_t>((size_t)ANCHOR_GRID_CELLS * mWords, 0)});
+        group = mGroups.end() - 1;
+      }
+      group->members[i / 64] |= bit;
+      // the smallest anchor shift over the pixels of each cell, the channels add up independently
+      std::vector<int> lowest(ANCHOR_GRID_CELLS, MAX_COLOR_SHIFT);
+      for(uint32_t alternative = feature->colorStart[0]; alternative < feature->colorStart[1]; alternative++){
+        auto color = (const unsigned char *)&feature->colors[alternative];
+        auto shift = (const unsigned char *)&feature->shifts[alternative];
+        int channelLowest[3][levels];
+        for(int channel = 0; channel < 3; channel++){
+          int byte = colorValueByte(channel);
+          for(int level = 0; level < levels; level++){
+            int low = MAX_COLOR_SHIFT;
+            for(int value = level * levelWidth; value < (level + 1) * levelWidth; value++){
+              low = std::min(low, channelShift(feature->kinds[alternative], color[byte], shift[byte], value));
+            }
+            channelLowest[channel][level] = low;
+          }
+        }
+        for(int cell = 0; cell < ANCHOR_GRID_CELLS; cell++){
+          int bound = channelLowest[0][cell >> (2 * ANCHOR_GRID_BITS)] +
+            channelLowest[1][(cell >> ANCHOR_GRID_BITS) & (levels - 1)] + channelLowest[2][cell & (levels - 1)];
+          lowest[cell] = std::min(lowest[cell], bound);
+        }
+      }
+      for(int cell = 0; cell < ANCHOR_GRID_CELLS; cell++){
+        if(lowest[cell] <= shiftSums[i]){
+          group->candidates[(size_t)cell * mWords + i / 64] |= bit;
+        }
+      }
+    }
+  }
+
+  template<class P>
+  auto FeatureSet::match(Bitmap *bitmap, int x, int y) const->int{
+    constexpr int drop = 8 - ANCHOR_GRID_BITS;
+    uint64_t candidates[MAX_FEATURE_SET_SIZE / 64];
+    std::copy(mAlways.begin(), mAlways.end(), candidates);
+    for(auto &group : mGroups){
+      const uint64_t *mask = group.members.data();
+      if(isInBitmapScope(bitmap, x + group.x, y + group.y)){
+        const unsigned char *anchor = computeCoordColor(bitmap, x, y) + group.offset;
+        int cell = (anchor[P::red] >> drop) << (2 * ANCHOR_GRID_BITS) | (anchor[P::green] >> drop) << ANCHOR_GRID_BITS |
+          anchor[P::blue] >> drop;
+        mask = group.candidates.data() + (size_t)cell * mWords;
+      }
+      for(int word = 0; word < mWords; word++){
+        candidates[word] |= mask[word];
+      }
+    }
+    for(int word = 0; word < mWords; word++){
+      for(uint64_t bits = candidates[word]; bits; bits &= bits - 1){
+        int i = word * 64 + __builtin_ctzll(bits);
+        if(isBoundFeatureInFormat<P>(bitmap, x, y, &mFeatures[i], mShiftSums[i])){
+          return i + 1;
+        }
+      }
+    }
+    return 0;
+  }
+
+  template<class P>
+  class FeatureSetFinder{
+    Bitmap *mBitmap;
+    const FeatureSet *mFeatures;
+    Point mPoint;
+    int mIndex;
+  public:
+    FeatureSetFinder(Bitmap *bitmap, const FeatureSet *features)
+      :mBitmap(bitmap), mFeatures(features), mIndex(0){}
+    bool compare(int x, int y, const unsigned char *color){
+      int index = mFeatures->match<P>(mBitmap, x, y);
+      if(index){
+        mPoint.x = x;
+        mPoint.y = y;
+        mIndex = index;
+        return true;
+      }
+      return false;
+    }
+    Point &getResult(){
+      return mPoint;
+    }
+    int getResultIndex(){
+      return mIndex;
+    }
+  };
+
+  // the finder only keeps its last hit, so column orders can run blocked
+  template<class P>
+  static bool scanRect(Bitmap *bitmap, int x, int y, int x1, int y1, int order, FeatureSetFinder<P> *finder){
+    return blockedOrderFindColor(bitmap, x, y, x1, y1, order, finder);
+  }
+
+  auto findFeatures(Bitmap *bitmap, int x, int y, int x1, int y1, FeatureSet *features, int order, Point *out)->int{
+    return visitPixelFormat(bitmap->format_, [&](auto pixel){
+      FeatureSetFinder<decltype(pixel)> finder(bitmap, features);
+      if(!parallelOrderFindColor(bitmap, x, y, x1, y1, order, &finder)){
+        return 0;
+      }
+      if(out){
+        *out = finder.getResult();
+      }
+      return finder.getResultIndex();
+    });
+  }
+}
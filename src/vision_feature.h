@@ -3,7 +3,10 @@
 #define __VISION_FEATURE_H__
 
 #include"vision_color.h"
+#include "lru_cache.h"
 #include <cstdint>
+#include <memory>
+#include <vector>
 
 namespace vision {
 
@@ -25,9 +28,102 @@ auto encodeFeature(FeatureCompositionRoot*feature)->std::string;
 
 void freeFeatureComposition(FeatureCompositionRoot *feature);
 
+// Structure of arrays form of a feature used by the matchers. The color
+// alternatives of point i are [colorStart[i], colorStart[i+1]).
+struct PackedFeature{
+  uint32_t count = 0;
+  int minX = 0;
+  int minY = 0;
+  int maxX = 0;
+  int maxY = 0;
+  std::vector<int16_t> xs;
+  std::vector<int16_t> ys;
+  std::vector<uint32_t> colorStart;
+  std::vector<TColorType> kinds;
+  std::vector<ColorValueType> colors;
+  std::vector<ColorValueType> shifts;
+};
+
+// A packed feature with the point byte offsets precomputed for the
+// rowShift_/pixelStride_ of one bitmap
+struct BoundFeature{
+  const PackedFeature* feature;
+  std::vector<int> offsets;
+  // the order points are evaluated in, string order unless reordered
+  std::vector<uint32_t> order;
+  BoundFeature(const PackedFeature* feature,const Bitmap* bitmap);
+  // Evaluate first the points that are expected to add the most shift per
+  // color alternative, estimated from a sample of the searched area. The
+  // running sum only grows, so any order gives the same answer.
+  void orderBySelectivity(Bitmap* bitmap,int x,int y,int x1,int y1);
+};
+
+// searches smaller than this are not worth sampling
+constexpr int MIN_SELECTIVITY_SEARCH_AREA = 4096;
+// positions sampled per axis when estimating selectivity
+constexpr int SELECTIVITY_SAMPLES = 16;
+
+auto packFeature(const FeatureCompositionRoot* feature,PackedFeature* out)->void;
+auto decodeFeature(const char* str,int size,PackedFeature*feature)->bool;
+
+using FeaturePtr = std::shared_ptr<PackedFeature>;
+constexpr size_t DEFAULT_FEATURE_CACHE_SIZE = 1024;
+
+// decoded features keyed by their string, nullptr when the string is invalid
+auto getCachedFeature(const char* str,int size)->FeaturePtr;
+auto featureCacheStats()->CacheStats;
+void setFeatureCacheSize(size_t size);
+void clearFeatureCache();
+
 
 auto isFeature(Bitmap*bitmap,FeatureCompositionRoot*feature,int shiftSum)->bool;
 auto isFeature(Bitmap *bitmap,int x,int y, FeatureCompositionRoot *feature, int shiftSum)->bool;
+auto isFeature(Bitmap *bitmap,int x,int y, BoundFeature *feature, int shiftSum)->bool;
+
+// the anchor colors are indexed on a grid of 2^ANCHOR_GRID_BITS levels per channel
+constexpr int ANCHOR_GRID_BITS = 4;
+constexpr int ANCHOR_GRID_CELLS = 1 << (3 * ANCHOR_GRID_BITS);
+constexpr size_t MAX_FEATURE_SET_SIZE = 256;
+
+// Features searched for in one pass. The features are grouped by the
+// offset of their first (anchor) point, and per cell of a coarse color grid
+// a group keeps the features whose anchor can stay within their budget for
+// a pixel of that cell. A position runs the full test only for the features
+// its anchor pixels admit.
+class FeatureSet{
+  struct AnchorGroup{
+    int x;
+    int y;
+    int offset;
+    // the features of the group, then ANCHOR_GRID_CELLS masks of mWords words
+    std::vector<uint64_t> members;
+    std::vector<uint64_t> candidates;
+  };
+  std::vector<FeaturePtr> mPacked;
+  std::vector<BoundFeature> mFeatures;
+  std::vector<int> mShiftSums;
+  std::vector<AnchorGroup> mGroups;
+  int mWords;
+  // features without points match everywhere
+  std::vector<uint64_t> mAlways;
+public:
+  // at most MAX_FEATURE_SET_SIZE features bound to bitmap, shiftSums[i] is the budget of features[i]
+  FeatureSet(const Bitmap* bitmap, const std::vector<FeaturePtr>& features, const std::vector<int>& shiftSums);
+  auto size() const->size_t{
+    return mFeatures.size();
+  }
+  auto feature(size_t i)->BoundFeature*{
+    return &mFeatures[i];
+  }
+  // The 1-based index of the first feature that matches at (x, y), 0 when none does
+  template<class P>
+  auto match(Bitmap* bitmap, int x, int y) const->int;
+};
+
+// The first position of [x, x1) * [y, y1) in read order where one of the
+// features matches, the 1-based index of the first feature matching there
+// or 0 when none matches anywhere.
+auto findFeatures(Bitmap* bitmap, int x, int y, int x1, int y1, FeatureSet* features, int order, Point* out)->int;
 
 } // namespace vision
 
@@ -0,0 +1,133 @@
+#include "vision_image.h"
+#include <algorithm>
+#include <vector>
+
+namespace vision {
+
+enum CoarseState:unsigned char{
+  COARSE_UNKNOWN,
+  COARSE_REJECTED,
+  COARSE_ACCEPTED,
+};
+
+struct CoarseCandidates{
+  CommonBitmap* image;
+  ImageTarget target;
+  int relaxedShiftSum;
+  // the coarse template of each phase, resolved before the scan so the
+  // scan never takes the lock of the pyramid cache
+  std::vector<CommonBitmap*> phases;
+  // one grid of coarse screen positions per template phase, positions are
+  // evaluated when the scan first reaches them
+  std::vector<std::vector<CoarseState>> states;
+};
+
+class PyramidFinder{
+  Bitmap* mBitmap;
+  const SumTable* mSums;
+  const LumaPlane* mLuma;
+  Bitmap* mScreen;
+  std::vector<CoarseCandidates>* mCandidates;
+  int mX;
+  int mY;
+  int mLevel;
+  int mScale;
+  Point result;
+  int resultImage = 0;
+
+  bool isCandidate(CoarseCandidates& c, int x, int y){
+    // skip the template columns and rows that come before the first screen block
+    int phaseX = (mScale - (x - mX) % mScale) % mScale;
+    int phaseY = (mScale - (y - mY) % mScale) % mScale;
+    auto coarse = c.phases[phaseY * mScale + phaseX];
+    int cx = (x - mX + phaseX) / mScale;
+    int cy = (y - mY + phaseY) / mScale;
+    if(coarse->width_ == 0 || coarse->height_ == 0 ||
+      cx + coarse->width_ > mScreen->width_ || cy + coarse->height_ > mScreen->height_){
+      return true;
+    }
+    auto& state = c.states[phaseY * mScale + phaseX][cy * mScreen->width_ + cx];
+    if(state == COARSE_UNKNOWN){
+      state = isImage(mScreen, cx, cy, coarse, c.relaxedShiftSum) ? COARSE_ACCEPTED : COARSE_REJECTED;
+    }
+    return state == COARSE_ACCEPTED;
+  }
+public:
+  PyramidFinder(Bitmap* bitmap,const SumTable* sums,const LumaPlane* luma,Bitmap* screen,
+    std::vector<CoarseCandidates>* candidates,int x,int y,int level)
+    :mBitmap(bitmap),mSums(sums),mLuma(luma),mScreen(screen),mCandidates(candidates),mX(x),mY(y),mLevel(level),mScale(1 << level){}
+
+  bool compare(int x, int y, const unsigned char* color){
+    for(size_t i = 0; i < mCandidates->size(); i++){
+      auto& c = mCandidates->at(i);
+      if((mLevel == 0 || isCandidate(c, x, y)) && isImage(mBitmap, x, y, c.target, mSums, mLuma)){
+        result.x = x;
+        result.y = y;
+        resultImage = i + 1;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  Point& getResult(){
+    return result;
+  }
+
+  int getResultImage(){
+    return resultImage;
+  }
+};
+
+auto findImagePyramid(Bitmap* bitmap,int x,int y,int x1,int y1,CommonBitmap** images,const int* shiftSums,
+  int count,int level,int order,Point* out)->int{
+  level = std::clamp(level, 0, MAX_PYRAMID_LEVEL);
+  int scale = 1 << level;
+  int maxWidth = 0;
+  int maxHeight = 0;
+  for(int i = 0; i < count; i++){
+    maxWidth = std::max(maxWidth, (int)images[i]->width_);
+    maxHeight = std::max(maxHeight, (int)images[i]->height_);
+  }
+  // the screen area any template placed in the search rectangle can touch
+  int right = std::min(x1 - 1 + maxWidth, (int)bitmap->width_);
+  int bottom = std::min(y1 - 1 + maxHeight, (int)bitmap->height_);
+  int coarseWidth = std::max(0, (right - x) / scale);
+  int coarseHeight = std::max(0, (bottom - y) / scale);
+  CommonBitmap screen;
+  screen.loadDownsampled(bitmap, x, y, coarseWidth, coarseHeight, scale);
+
+  std::vector<CoarseCandidates> candidates;
+  candidates.reserve(count);
+  for(int i = 0; i < count; i++){
+    candidates.push_back(CoarseCandidates{images[i], ImageTarget(images[i], shiftSums[i]), 0, {}, {}});
+    auto& c = candidates.back();
+    for(int phaseY = 0; phaseY < scale; phaseY++){
+      for(int phaseX = 0; phaseX < scale; phaseX++){
+        c.phases.push_back(images[i]->pyramidLevel(level, phaseX, phaseY));
+      }
+    }
+    auto coarse = c.phases[0];
+    c.relaxedShiftSum = (shiftSums[i] + scale * scale - 1) / (scale * scale) +
+      coarse->width_ * coarse->height_ * PYRAMID_ROUNDING_SHIFT;
+    c.states.resize(scale * scale);
+    for(auto& states:c.states){
+      states.assign(coarseWidth * coarseHeight, COARSE_UNKNOWN);
+    }
+  }
+
+  auto sums = sumTable(bitmap);
+  auto luma = lumaPlane(bitmap);
+  PyramidFinder finder(bitmap, sums.get(), luma.get(), &screen, &candidates, x, y, level);
+  if(!blockedOrderFindColor(bitmap, x, y, x1, y1, order, &finder)){
+    return 0;
+  }
+  if(out){
+    Point& point = finder.getResult();
+    out->x = point.x;
+    out->y = point.y;
+  }
+  return finder.getResultImage();
+}
+
+} // namespace vision
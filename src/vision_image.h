@@ -0,0 +1,89 @@
+#ifndef __VISION_IMAGE_H__
+#define __VISION_IMAGE_H__
+
+#include "CommonBitmap.h"
+#include "vision_integral.h"
+#include "vision_luma.h"
+#include "vision_util.h"
+#include <vector>
+
+namespace vision {
+
+// Sample points are only checked when a few mismatching points exceed the
+// budget, looser budgets make them cost more than they reject.
+constexpr int MAX_SAMPLED_SHIFT_SUM = 384;
+
+// A template with its shift budget and what is needed to reject positions
+// before comparing every pixel
+struct ImageTarget{
+  CommonBitmap* image;
+  int shiftSum;
+  // nullptr when the samples are not worth checking for this budget
+  const std::vector<SamplePoint>* samples;
+  // nullptr when the lumas of the template are not worth checking
+  const unsigned char* luma;
+  ImageTarget(CommonBitmap* image, int shiftSum)
+    :image(image), shiftSum(shiftSum), samples(&image->samplePoints()),
+    luma(image->isLumaPattern() ? image->luma() : nullptr){
+    if(samples->empty() || shiftSum >= MAX_SAMPLED_SHIFT_SUM){
+      samples = nullptr;
+    }
+  }
+};
+
+template<class P, class Q>
+inline auto sampleShiftExceeds(Bitmap* bitmap, int x, int y, const ImageTarget& target)->bool{
+  int sampleShift = 0;
+  for(auto& sample:*target.samples){
+    sampleShift += computePixelShiftSum<P, Q>(computeCoordColor(bitmap, x + sample.x, y + sample.y),
+      computeCoordColor(target.image, sample.x, sample.y));
+    if(sampleShift > target.shiftSum){
+      return true;
+    }
+  }
+  return false;
+}
+
+// isImage behind three exact rejections: the channel sums of the window when
+// the bitmap has a sum table, the running shift of the sample points, then
+// the lumas of the window when the bitmap has a luma plane and the template
+// is a luma pattern. Each only ever sees part of the full shift.
+inline auto isImage(Bitmap* bitmap, int x, int y, const ImageTarget& target, const SumTable* table,
+  const LumaPlane* luma)->bool{
+  auto image = target.image;
+  if(x < 0 || y < 0 || x + image->width_ > bitmap->width_ || y + image->height_ > bitmap->height_){
+    return false;
+  }
+  if(table && imageShiftLowerBound(table, x, y, image) > (uint64_t)target.shiftSum){
+    return false;
+  }
+  if(target.samples && visitPixelFormats(bitmap->format_, image->format_, [&](auto pixel, auto templatePixel){
+    return sampleShiftExceeds<decltype(pixel), decltype(templatePixel)>(bitmap, x, y, target);
+  })){
+    return false;
+  }
+  if(luma && target.luma &&
+    lumaShiftExceeds(luma, x, y, target.luma, image->width_, image->height_, target.shiftSum)){
+    return false;
+  }
+  return isImage(bitmap, x, y, image, target.shiftSum);
+}
+
+// rounding the block averages can move each channel difference by one
+constexpr int PYRAMID_ROUNDING_SHIFT = 3;
+
+// Coarse to fine findImage: the screen and the templates are shrunk by
+// 2^level and a position is verified with isImage at full resolution only
+// when its coarse comparison stays within the relaxed budget
+// shiftSum / 4^level + PYRAMID_ROUNDING_SHIFT per coarse pixel.
+// The template is shrunk at the phase that lines it up with the screen
+// blocks, and averaging never increases the shift, so the coarse test never
+// rejects a real match and the result equals the plain search.
+// shiftSums[i] is the full resolution budget of images[i], returns the
+// 1-based index of the matched image or 0.
+auto findImagePyramid(Bitmap* bitmap,int x,int y,int x1,int y1,CommonBitmap** images,const int* shiftSums,
+  int count,int level,int order,Point* out)->int;
+
+} // namespace vision
+
+#endif // __VISION_IMAGE_H__
@@ -0,0 +1,91 @@
+#include "vision_index.h"
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace vision {
+
+static void scalarTileRange(const Bitmap* bitmap, int x, int y, int x1, int y1, unsigned char* range){
+  unsigned char lo[3] = {255, 255, 255};
+  unsigned char hi[3] = {0, 0, 0};
+  for(int j = y; j < y1; j++){
+    const unsigned char* pixel = bitmap->origin_ + j * bitmap->rowShift_ + x * bitmap->pixelStride_;
+    for(int i = x; i < x1; i++){
+      for(int channel = 0; channel < 3; channel++){
+        lo[channel] = std::min(lo[channel], pixel[channel]);
+        hi[channel] = std::max(hi[channel], pixel[channel]);
+      }
+      pixel += bitmap->pixelStride_;
+    }
+  }
+  std::copy(lo, lo + 3, range);
+  std::copy(hi, hi + 3, range + 4);
+}
+
+#if defined(__SSE2__)
+// full width tiles of 4-byte pixels, four pixels per min/max
+static void sse2TileRange(const Bitmap* bitmap, int x, int y, int y1, unsigned char* range){
+  __m128i lo = _mm_set1_epi8((char)0xFF);
+  __m128i hi = _mm_setzero_si128();
+  for(int j = y; j < y1; j++){
+    const unsigned char* row = bitmap->origin_ + j * bitmap->rowShift_ + x * 4;
+    for(int i = 0; i < COLOR_INDEX_TILE * 4; i += 16){
+      __m128i pixels = _mm_loadu_si128((const __m128i*)(row + i));
+      lo = _mm_min_epu8(lo, pixels);
+      hi = _mm_max_epu8(hi, pixels);
+    }
+  }
+  // fold the four pixels of each register onto the first
+  lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 8));
+  lo = _mm_min_epu8(lo, _mm_srli_si128(lo, 4));
+  hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 8));
+  hi = _mm_max_epu8(hi, _mm_srli_si128(hi, 4));
+  int low = _mm_cvtsi128_si32(lo);
+  int high = _mm_cvtsi128_si32(hi);
+  memcpy(range, &low, 4);
+  memcpy(range + 4, &high, 4);
+}
+#endif
+
+static auto buildColorIndex(Bitmap* bitmap)->std::shared_ptr<ColorIndex>{
+  auto index = std::make_shared<ColorIndex>();
+  index->key = FrameKey::of(bitmap);
+  index->columns = (bitmap->width_ + COLOR_INDEX_TILE - 1) / COLOR_INDEX_TILE;
+  index->rows = (bitmap->height_ + COLOR_INDEX_TILE - 1) / COLOR_INDEX_TILE;
+  index->ranges.resize(index->columns * index->rows * 8);
+  for(int j = 0; j < index->rows; j++){
+    int y = j * COLOR_INDEX_TILE;
+    int y1 = std::min(y + COLOR_INDEX_TILE, (int)bitmap->height_);
+    for(int i = 0; i < index->columns; i++){
+      int x = i * COLOR_INDEX_TILE;
+      int x1 = std::min(x + COLOR_INDEX_TILE, (int)bitmap->width_);
+      unsigned char* range = index->ranges.data() + (j * index->columns + i) * 8;
+#if defined(__SSE2__)
+      if(bitmap->pixelStride_ == 4 && x1 - x == COLOR_INDEX_TILE){
+        sse2TileRange(bitmap, x, y, y1, range);
+        continue;
+      }
+#endif
+      scalarTileRange(bitmap, x, y, x1, y1, range);
+    }
+  }
+  return index;
+}
+
+auto colorIndex(Bitmap* bitmap)->std::shared_ptr<const ColorIndex>{
+  if(!hasFrameCache(bitmap)){
+    return nullptr;
+  }
+  auto index = std::atomic_load(&bitmap->colorIndex_);
+  if(index && index->key == FrameKey::of(bitmap)){
+    return index;
+  }
+  // racing builders compute the same ranges, the last store wins
+  index = buildColorIndex(bitmap);
+  std::atomic_store(&bitmap->colorIndex_, index);
+  return index;
+}
+
+} // namespace vision
@@ -0,0 +1,241 @@
+#ifndef __VISION_INDEX_H__
+#define __VISION_INDEX_H__
+
+#include "vision_color.h"
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+namespace vision {
+
+constexpr int COLOR_INDEX_TILE = 16;
+// searches smaller than this scan faster than they consult the index
+constexpr int MIN_INDEXED_SCAN_AREA = 4 * COLOR_INDEX_TILE * COLOR_INDEX_TILE;
+
+// the pixels a per frame structure was built from
+struct FrameKey{
+  unsigned int generation;
+  const unsigned char* origin;
+  unsigned int width;
+  unsigned int height;
+  int rowShift;
+  int pixelStride;
+  PixelFormat format;
+
+  static auto of(const Bitmap* bitmap)->FrameKey{
+    return FrameKey{bitmap->generation_, bitmap->origin_, bitmap->width_, bitmap->height_,
+      bitmap->rowShift_, bitmap->pixelStride_, bitmap->format_};
+  }
+  bool operator==(const FrameKey& other) const{
+    return generation == other.generation && origin == other.origin && width == other.width &&
+      height == other.height && rowShift == other.rowShift && pixelStride == other.pixelStride &&
+      format == other.format;
+  }
+};
+
+// bitmaps whose pixels are known to be stable until their next invalidate(),
+// the caches keep three channel bytes per pixel
+inline bool hasFrameCache(const Bitmap* bitmap){
+  return bitmap->cacheable_ && bitmap->origin_ != nullptr && bitmap->width_ > 0 && bitmap->height_ > 0 &&
+    pixelFormatBytes(bitmap->format_) >= 3;
+}
+
+// Per tile range of the three channel bytes of one bitmap generation
+struct ColorIndex{
+  FrameKey key;
+  int columns;
+  int rows;
+  // 8 bytes per tile: min of pixel bytes 0..2, unused, max of pixel bytes 0..2, unused
+  std::vector<unsigned char> ranges;
+};
+
+// The index of the current pixels, built on first use after each
+// invalidate(). nullptr for bitmaps that never call invalidate().
+auto colorIndex(Bitmap* bitmap)->std::shared_ptr<const ColorIndex>;
+
+// the smallest and largest shift any pixel of a tile can have
+struct ShiftBounds{
+  int lower;
+  int upper;
+};
+
+inline void channelDistance(const unsigned char* lo, const unsigned char* hi, int channel, int value, int* nearest, int* farthest){
+  int low = lo[channel];
+  int high = hi[channel];
+  *nearest = value < low ? low - value : (value > high ? value - high : 0);
+  *farthest = std::max(abs(low - value), abs(high - value));
+}
+
+// lo and hi are the ranges of the pixel bytes of a tile of a format bitmap
+inline auto tileShiftBounds(const unsigned char* lo, const unsigned char* hi, PixelFormat format, Color* c)->ShiftBounds{
+  auto color = (const unsigned char*)&c->data;
+  ShiftBounds bounds{0, 0};
+  for(int channel = 0; channel < 3; channel++){
+    int nearest, farthest;
+    channelDistance(lo, hi, channel, color[referenceChannel(format, channel)], &nearest, &farthest);
+    bounds.lower += nearest;
+    bounds.upper += farthest;
+  }
+  return bounds;
+}
+
+inline auto tileShiftBounds(const unsigned char* lo, const unsigned char* hi, PixelFormat format, ColorNot* c)->ShiftBounds{
+  return tileShiftBounds(lo, hi, format, (Color*)&c->data);
+}
+
+inline auto tileShiftBounds(const unsigned char* lo, const unsigned char* hi, PixelFormat format, ColorGamut* c)->ShiftBounds{
+  auto color = (const unsigned char*)&c->color;
+  auto shift = (const unsigned char*)&c->shift;
+  ShiftBounds bounds{0, 0};
+  for(int channel = 0; channel < 3; channel++){
+    int reference = referenceChannel(format, channel);
+    int nearest, farthest;
+    channelDistance(lo, hi, channel, color[reference], &nearest, &farthest);
+    bounds.lower += std::max(0, nearest - shift[reference]);
+    bounds.upper += std::max(0, farthest - shift[reference]);
+  }
+  return bounds;
+}
+
+inline auto tileShiftBounds(const unsigned char* lo, const unsigned char* hi, PixelFormat format, ColorGamutNot* c)->ShiftBounds{
+  auto color = (const unsigned char*)&c->color;
+  auto shift = (const unsigned char*)&c->shift;
+  ShiftBounds bounds{0, 0};
+  for(int channel = 0; channel < 3; channel++){
+    int reference = referenceChannel(format, channel);
+    int nearest, farthest;
+    channelDistance(lo, hi, channel, color[reference], &nearest, &farthest);
+    bounds.lower += std::max(0, shift[reference] - farthest);
+    bounds.upper += std::max(0, shift[reference] - nearest);
+  }
+  return bounds;
+}
+
+inline auto tileShiftBounds(const unsigned char* lo, const unsigned char* hi, PixelFormat format, TColorBase* c)->ShiftBounds{
+  switch (c->type)
+  {
+  case TColorType::ALONE:
+    return tileShiftBounds(lo, hi, format, (Color*)c->data);
+  case TColorType::COLOR_GAMUT:
+    return tileShiftBounds(lo, hi, format, (ColorGamut*)c->data);
+  case TColorType::NOT:
+    return tileShiftBounds(lo, hi, format, (ColorNot*)c->data);
+  case TColorType::COLOR_GAMUT_NOT:
+    return tileShiftBounds(lo, hi, format, (ColorGamutNot*)c->data);
+  default:
+    break;
+  }
+  return ShiftBounds{MAX_COLOR_SHIFT, MAX_COLOR_SHIFT};
+}
+
+// a pixel matches a composition when its best alternative does
+inline auto tileShiftBounds(const unsigned char* lo, const unsigned char* hi, PixelFormat format, ColorComposition* c)->ShiftBounds{
+  ShiftBounds bounds{MAX_COLOR_SHIFT, MAX_COLOR_SHIFT};
+  while(c){
+    auto alternative = tileShiftBounds(lo, hi, format, &c->color);
+    bounds.lower = std::min(bounds.lower, alternative.lower);
+    bounds.upper = std::min(bounds.upper, alternative.upper);
+    c = c->next;
+  }
+  return bounds;
+}
+
+enum TileState:unsigned char{
+  TILE_NONE,
+  TILE_SOME,
+  TILE_ALL,
+};
+
+// Which tiles of a search rectangle can hold a matching pixel
+class TileMask
+{
+  int mTileX;
+  int mTileY;
+  int mColumns;
+  int mRows;
+  int mLiveTiles;
+  std::vector<unsigned char> mStates;
+public:
+  template<class TColor>
+  TileMask(const ColorIndex* index, int x, int y, int x1, int y1, TColor color, int shiftSum)
+    :mTileX(x / COLOR_INDEX_TILE), mTileY(y / COLOR_INDEX_TILE), mLiveTiles(0){
+    mColumns = x1 > x ? (x1 - 1) / COLOR_INDEX_TILE - mTileX + 1 : 0;
+    mRows = y1 > y ? (y1 - 1) / COLOR_INDEX_TILE - mTileY + 1 : 0;
+    mStates.resize(mColumns * mRows);
+    for(int j = 0; j < mRows; j++){
+      for(int i = 0; i < mColumns; i++){
+        auto range = index->ranges.data() + ((mTileY + j) * index->columns + mTileX + i) * 8;
+        auto bounds = tileShiftBounds(range, range + 4, index->key.format, color);
+        auto state = bounds.lower > shiftSum ? TILE_NONE : (bounds.upper <= shiftSum ? TILE_ALL : TILE_SOME);
+        mStates[j * mColumns + i] = state;
+        mLiveTiles += state != TILE_NONE;
+      }
+    }
+  }
+  // state of the tile holding pixel (x, y)
+  auto state(int x, int y) const->TileState{
+    return (TileState)mStates[(y / COLOR_INDEX_TILE - mTileY) * mColumns + x / COLOR_INDEX_TILE - mTileX];
+  }
+  bool isColumnLive(int x) const{
+    int i = x / COLOR_INDEX_TILE - mTileX;
+    for(int j = 0; j < mRows; j++){
+      if(mStates[j * mColumns + i] != TILE_NONE)
+        return true;
+    }
+    return false;
+  }
+  bool isRowLive(int y) const{
+    auto row = mStates.data() + (y / COLOR_INDEX_TILE - mTileY) * mColumns;
+    return std::any_of(row, row + mColumns, [](unsigned char state){ return state != TILE_NONE; });
+  }
+  int liveTiles() const{
+    return mLiveTiles;
+  }
+};
+
+// orderFindColor that skips the pixels of TILE_NONE tiles. Every line of the
+// outer loop is walked tile by tile in the inner direction, so the pixels
+// that remain are visited in the same order.
+template<class T1>
+bool maskedOrderFindColor(Bitmap* bitmap, int x, int y, int x1, int y1, int order, const TileMask* mask, T1* comparator)
+{
+  bool columns = order <= DOWN_UP_RIGHT_LEFT;
+  bool outerReversed = columns ? (order == UP_DOWN_RIGHT_LEFT || order == DOWN_UP_RIGHT_LEFT)
+    : (order == LEFT_RIGHT_DOWN_UP || order == RIGHT_LEFT_DOWN_UP);
+  bool innerReversed = columns ? (order == DOWN_UP_LEFT_RIGHT || order == DOWN_UP_RIGHT_LEFT)
+    : (order == RIGHT_LEFT_UP_DOWN || order == RIGHT_LEFT_DOWN_UP);
+  int outerBegin = columns ? x : y;
+  int outerEnd = columns ? x1 : y1;
+  int innerBegin = columns ? y : x;
+  int innerEnd = columns ? y1 : x1;
+  int line = outerReversed ? outerEnd - 1 : outerBegin;
+  while(line >= outerBegin && line < outerEnd){
+    if(!(columns ? mask->isColumnLive(line) : mask->isRowLive(line))){
+      // the whole band of tiles is empty, jump to its far edge
+      int tile = line / COLOR_INDEX_TILE * COLOR_INDEX_TILE;
+      line = outerReversed ? tile - 1 : tile + COLOR_INDEX_TILE;
+      continue;
+    }
+    int segment = innerReversed ? innerEnd - 1 : innerBegin;
+    while(segment >= innerBegin && segment < innerEnd){
+      int tile = segment / COLOR_INDEX_TILE * COLOR_INDEX_TILE;
+      int low = std::max(tile, innerBegin);
+      int high = std::min(tile + COLOR_INDEX_TILE, innerEnd);
+      auto state = columns ? mask->state(line, segment) : mask->state(segment, line);
+      if(state != TILE_NONE){
+        bool hit = columns ? scanRect(bitmap, line, low, line + 1, high, order, comparator)
+          : scanRect(bitmap, low, line, high, line + 1, order, comparator);
+        if(hit)
+          return true;
+      }
+      segment = innerReversed ? low - 1 : high;
+    }
+    line = outerReversed ? line - 1 : line + 1;
+  }
+  return false;
+}
+
+} // namespace vision
+
+#endif // __VISION_INDEX_H__
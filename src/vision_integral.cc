@@ -0,0 +1,68 @@
+#include "vision_integral.h"
+#include <algorithm>
+#include <mutex>
+
+namespace vision {
+
+// A frame sized table is tens of megabytes, so the buffer of the table a
+// new frame replaces is kept for the next one instead of being faulted in again.
+static std::mutex spareMutex;
+static std::vector<uint32_t> spareSums;
+
+static void releaseSumTable(SumTable* table){
+  {
+    std::lock_guard<std::mutex> lock(spareMutex);
+    if(table->sums.capacity() > spareSums.capacity()){
+      spareSums.swap(table->sums);
+    }
+  }
+  delete table;
+}
+
+static auto buildSumTable(Bitmap* bitmap)->std::shared_ptr<SumTable>{
+  std::shared_ptr<SumTable> table(new SumTable(), releaseSumTable);
+  table->key = FrameKey::of(bitmap);
+  table->stride = bitmap->width_ + 1;
+  {
+    std::lock_guard<std::mutex> lock(spareMutex);
+    table->sums.swap(spareSums);
+  }
+  // every entry is written below, the first row and column are the zeros
+  table->sums.resize((size_t)table->stride * (bitmap->height_ + 1) * 3);
+  std::fill(table->sums.begin(), table->sums.begin() + table->stride * 3, 0);
+  const int width = bitmap->width_;
+  const int pixelStride = bitmap->pixelStride_;
+  for(unsigned int i = 0; i < bitmap->height_; i++){
+    const unsigned char* pixel = bitmap->origin_ + i * bitmap->rowShift_;
+    const uint32_t* above = table->sums.data() + (size_t)i * table->stride * 3;
+    uint32_t* row = table->sums.data() + (size_t)(i + 1) * table->stride * 3;
+    row[0] = row[1] = row[2] = 0;
+    // locals, the stores below may alias anything reachable through a char pointer
+    uint32_t sum0 = 0, sum1 = 0, sum2 = 0;
+    for(int j = 3; j <= width * 3; j += 3){
+      sum0 += pixel[0];
+      sum1 += pixel[1];
+      sum2 += pixel[2];
+      row[j] = above[j] + sum0;
+      row[j + 1] = above[j + 1] + sum1;
+      row[j + 2] = above[j + 2] + sum2;
+      pixel += pixelStride;
+    }
+  }
+  return table;
+}
+
+auto sumTable(Bitmap* bitmap)->std::shared_ptr<const SumTable>{
+  if(!hasFrameCache(bitmap)){
+    return nullptr;
+  }
+  auto table = std::atomic_load(&bitmap->sumTable_);
+  if(table && table->key == FrameKey::of(bitmap)){
+    return table;
+  }
+  table = buildSumTable(bitmap);
+  std::atomic_store(&bitmap->sumTable_, table);
+  return table;
+}
+
+} // namespace vision
@@ -0,0 +1,48 @@
+#ifndef __VISION_INTEGRAL_H__
+#define __VISION_INTEGRAL_H__
+
+#include "CommonBitmap.h"
+#include "vision_index.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace vision {
+
+// Summed-area table of the three channel bytes of one bitmap generation.
+// Entries wrap modulo 2^32, window sums stay exact as long as a window
+// holds less than 2^32/255 pixels.
+struct SumTable{
+  FrameKey key;
+  // width + 1 entries of 3 sums per row, height + 1 rows
+  int stride;
+  std::vector<uint32_t> sums;
+
+  // sum of pixel byte over the w*h window at (x, y)
+  auto windowSum(int x, int y, int w, int h, int byte) const->uint32_t{
+    const uint32_t* top = sums.data() + (y * stride + x) * 3 + byte;
+    const uint32_t* bottom = top + h * stride * 3;
+    return bottom[w * 3] - bottom[0] - top[w * 3] + top[0];
+  }
+};
+
+// The table of the current pixels, built on first use after each
+// invalidate(). nullptr for bitmaps that never call invalidate().
+auto sumTable(Bitmap* bitmap)->std::shared_ptr<const SumTable>;
+
+// A lower bound of the isImage shift of image at (x, y): per channel the
+// difference of the sums can only be smaller than the sum of the differences.
+inline auto imageShiftLowerBound(const SumTable* table, int x, int y, const CommonBitmap* image)->uint64_t{
+  const uint64_t* sums = image->channelSums();
+  uint64_t bound = 0;
+  for(int channel = 0; channel < 3; channel++){
+    int64_t difference = (int64_t)table->windowSum(x, y, image->width_, image->height_,
+      channelOffset(table->key.format, channel)) - (int64_t)sums[channel];
+    bound += difference < 0 ? -difference : difference;
+  }
+  return bound;
+}
+
+} // namespace vision
+
+#endif // __VISION_INTEGRAL_H__
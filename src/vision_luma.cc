@@ -0,0 +1,47 @@
+#include "vision_luma.h"
+
+namespace vision {
+
+void computeLuma(const Bitmap* bitmap, unsigned char* out){
+  const int width = bitmap->width_;
+  if(bitmap->pixelStride_ == 4 && pixelFormatBytes(bitmap->format_) >= 3){
+    for(unsigned int i = 0; i < bitmap->height_; i++){
+      computeLumaRow(bitmap->origin_ + i * bitmap->rowShift_, out + (size_t)i * width, width);
+    }
+    return;
+  }
+  visitPixelFormat(bitmap->format_, [&](auto format){
+    using P = decltype(format);
+    for(unsigned int i = 0; i < bitmap->height_; i++){
+      const unsigned char* pixel = bitmap->origin_ + i * bitmap->rowShift_;
+      unsigned char* luma = out + (size_t)i * width;
+      for(int j = 0; j < width; j++){
+        luma[j] = pixelLuma<P>(pixel);
+        pixel += bitmap->pixelStride_;
+      }
+    }
+  });
+}
+
+static auto buildLumaPlane(Bitmap* bitmap)->std::shared_ptr<LumaPlane>{
+  auto plane = std::make_shared<LumaPlane>();
+  plane->key = FrameKey::of(bitmap);
+  plane->luma.resize((size_t)bitmap->width_ * bitmap->height_);
+  computeLuma(bitmap, plane->luma.data());
+  return plane;
+}
+
+auto lumaPlane(Bitmap* bitmap)->std::shared_ptr<const LumaPlane>{
+  if(!hasFrameCache(bitmap)){
+    return nullptr;
+  }
+  auto plane = std::atomic_load(&bitmap->lumaPlane_);
+  if(plane && plane->key == FrameKey::of(bitmap)){
+    return plane;
+  }
+  plane = buildLumaPlane(bitmap);
+  std::atomic_store(&bitmap->lumaPlane_, plane);
+  return plane;
+}
+
+} // namespace vision
@@ -0,0 +1,46 @@
+#ifndef __VISION_LUMA_H__
+#define __VISION_LUMA_H__
+
+#include "vision_index.h"
+#include "vision_simd.h"
+#include <memory>
+#include <vector>
+
+namespace vision {
+
+// (red + 2 * green + blue) / 4 rounded down, the gray byte itself for GRAY8
+template<class P>
+inline auto pixelLuma(const unsigned char* pixel)->int{
+  return (pixel[P::red] + 2 * pixel[P::green] + pixel[P::blue]) >> 2;
+}
+
+// writes the width_ * height_ lumas of bitmap row after row to out
+void computeLuma(const Bitmap* bitmap, unsigned char* out);
+
+// One byte per pixel of one bitmap generation, a quarter of what a full
+// compare reads
+struct LumaPlane{
+  FrameKey key;
+  std::vector<unsigned char> luma;
+
+  auto row(int y) const->const unsigned char*{
+    return luma.data() + (size_t)y * key.width;
+  }
+};
+
+// The plane of the current pixels, built on first use after each
+// invalidate(). nullptr for bitmaps that never call invalidate().
+auto lumaPlane(Bitmap* bitmap)->std::shared_ptr<const LumaPlane>;
+
+// Whether the isImage shift of a template with the given lumas at (x, y) is
+// sure to exceed shiftSum. A luma difference is at most half the channel
+// differences of its pixel and rounding adds at most one, so a pixel whose
+// luma differs by d costs at least 2 * d - 1.
+inline auto lumaShiftExceeds(const LumaPlane* plane, int x, int y, const unsigned char* imageLuma,
+  int width, int height, int shiftSum)->bool{
+  return lumaWindowExceeds(plane->row(y) + x, plane->key.width, imageLuma, width, height, shiftSum);
+}
+
+} // namespace vision
+
+#endif // __VISION_LUMA_H__
@@ -0,0 +1,54 @@
+#include "vision_lut.h"
+#include "lru_cache.h"
+#include <string>
+
+namespace vision {
+
+ColorLut::ColorLut(const ColorComposition* composition, int shiftSum)
+  :shiftSum(shiftSum), cells(COLOR_LUT_CELLS){
+  // a private copy, the lut outlives the composition it was built from
+  auto text = encodeColor(composition);
+  color = decodeColor(text.data(), text.size());
+  constexpr int levels = 1 << COLOR_LUT_BITS;
+  constexpr int width = 256 / levels;
+  for(int cell = 0; cell < COLOR_LUT_CELLS; cell++){
+    // the ranges of a cell laid out as an RGBA pixel
+    int red = cell >> (2 * COLOR_LUT_BITS);
+    int green = (cell >> COLOR_LUT_BITS) & (levels - 1);
+    int blue = cell & (levels - 1);
+    unsigned char lo[4] = {(unsigned char)(red * width), (unsigned char)(green * width), (unsigned char)(blue * width), 0};
+    unsigned char hi[4] = {(unsigned char)(lo[0] + width - 1), (unsigned char)(lo[1] + width - 1),
+      (unsigned char)(lo[2] + width - 1), 0};
+    auto bounds = tileShiftBounds(lo, hi, PIXEL_RGBA, color);
+    cells[cell] = bounds.lower > shiftSum ? TILE_NONE : (bounds.upper <= shiftSum ? TILE_ALL : TILE_SOME);
+  }
+}
+
+ColorLut::~ColorLut(){
+  freeColorComposition(color);
+}
+
+static auto lutCache()->LruCache<ColorLut>&{
+  static LruCache<ColorLut> cache(COLOR_LUT_CACHE_SIZE);
+  return cache;
+}
+
+auto colorLut(ColorComposition* color, int shiftSum, int64_t area)->std::shared_ptr<const ColorLut>{
+  int alternatives = 0;
+  for(auto c = color; c != nullptr; c = c->next){
+    alternatives++;
+  }
+  if(alternatives < MIN_LUT_ALTERNATIVES || area < MIN_LUT_SCAN_AREA){
+    return nullptr;
+  }
+  auto key = encodeColor(color) + '/' + std::to_string(shiftSum);
+  auto &cache = lutCache();
+  if(auto lut = cache.get(key)){
+    return lut;
+  }
+  auto lut = std::make_shared<ColorLut>(color, shiftSum);
+  cache.put(key, lut);
+  return lut;
+}
+
+} // namespace vision
@@ -0,0 +1,58 @@
+#ifndef __VISION_LUT_H__
+#define __VISION_LUT_H__
+
+#include "vision_color.h"
+#include "vision_index.h"
+#include <memory>
+#include <vector>
+
+namespace vision {
+
+// the lut has 2^COLOR_LUT_BITS levels per channel
+constexpr int COLOR_LUT_BITS = 5;
+constexpr int COLOR_LUT_CELLS = 1 << (3 * COLOR_LUT_BITS);
+// compositions of fewer alternatives compare faster than a lut is looked up
+constexpr int MIN_LUT_ALTERNATIVES = 3;
+// building a lut costs about as much as comparing this many pixels
+constexpr int MIN_LUT_SCAN_AREA = 128 * 128;
+constexpr size_t COLOR_LUT_CACHE_SIZE = 64;
+
+// A composition compiled for one shift budget. Per cell of a grid over red,
+// green and blue, whether all, none or only some of the colors of the cell
+// match. Only pixels of TILE_SOME cells run the composition itself.
+struct ColorLut{
+  ColorComposition* color;
+  int shiftSum;
+  std::vector<unsigned char> cells;
+
+  ColorLut(const ColorComposition* composition, int shiftSum);
+  ColorLut(const ColorLut&) = delete;
+  ColorLut& operator=(const ColorLut&) = delete;
+  ~ColorLut();
+};
+
+// The lut of color at shiftSum from a small cache, nullptr when a scan of
+// area pixels is better off comparing color directly
+auto colorLut(ColorComposition* color, int shiftSum, int64_t area)->std::shared_ptr<const ColorLut>;
+
+// shiftSum must be the one the lut was built for, it only decides the
+// pixels of TILE_SOME cells
+template<class P>
+inline auto compareColor(const unsigned char* pixel, const ColorLut* lut, int shiftSum)->int{
+  constexpr int drop = 8 - COLOR_LUT_BITS;
+  int cell = (pixel[P::red] >> drop) << (2 * COLOR_LUT_BITS) | (pixel[P::green] >> drop) << COLOR_LUT_BITS |
+    pixel[P::blue] >> drop;
+  auto state = lut->cells[cell];
+  if(state != TILE_SOME){
+    return state == TILE_ALL;
+  }
+  return compareColor<P>(pixel, lut->color, shiftSum) != 0;
+}
+
+inline auto tileShiftBounds(const unsigned char* lo, const unsigned char* hi, PixelFormat format, const ColorLut* c)->ShiftBounds{
+  return tileShiftBounds(lo, hi, format, c->color);
+}
+
+} // namespace vision
+
+#endif // __VISION_LUT_H__
@@ -0,0 +1,169 @@
+#include "vision_pack.h"
+#include "vision_codec.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace vision {
+
+static auto alignUp(uint64_t offset)->uint64_t{
+  return (offset + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+}
+
+auto writePack(const char* path, std::vector<std::pair<std::string, CommonBitmap*>> images)->const char*{
+  std::sort(images.begin(), images.end(), [](const auto& a, const auto& b){
+    return a.first < b.first;
+  });
+  for(size_t i = 1; i < images.size(); i++){
+    if(images[i].first == images[i - 1].first){
+      return "duplicate image name";
+    }
+  }
+  PackHeader header{PACK_MAGIC, PACK_VERSION, (uint32_t)images.size(), 0, sizeof(PackHeader), 0, 0};
+  std::vector<PackEntry> entries(images.size());
+  std::string names;
+  for(size_t i = 0; i < images.size(); i++){
+    auto image = images[i].second;
+    if(image->origin_ == nullptr || image->width_ == 0 || image->height_ == 0){
+      return "image is empty";
+    }
+    entries[i].nameOffset = names.size();
+    entries[i].nameLength = images[i].first.size();
+    entries[i].width = image->width_;
+    entries[i].height = image->height_;
+    std::copy(image->channelSums(), image->channelSums() + 3, entries[i].channelSums);
+    names += images[i].first;
+  }
+  header.namesOffset = header.indexOffset + entries.size() * sizeof(PackEntry);
+  header.namesSize = names.size();
+  uint64_t offset = alignUp(header.namesOffset + header.namesSize);
+  for(auto& entry:entries){
+    entry.pixelOffset = offset;
+    offset = alignUp(offset + (uint64_t)entry.width * entry.height * 4);
+  }
+
+  std::unique_ptr<FILE, int(*)(FILE*)> file(fopen(path, "wb"), fclose);
+  if(!file){
+    return "failed to open file for writing";
+  }
+  static const unsigned char padding[PACK_ALIGNMENT] = {};
+  uint64_t written = 0;
+  auto write = [&](const void* data, size_t size){
+    written += size;
+    return fwrite(data, 1, size, file.get()) == size;
+  };
+  auto pad = [&](){
+    return write(padding, alignUp(written) - written);
+  };
+  bool ok = write(&header, sizeof(header)) && write(entries.data(), entries.size() * sizeof(PackEntry)) &&
+    write(names.data(), names.size()) && pad();
+  std::vector<unsigned char> packed;
+  for(size_t i = 0; ok && i < images.size(); i++){
+    auto pixels = packPixels(images[i].second, packed);
+    ok = write(pixels, (size_t)entries[i].width * entries[i].height * 4) && pad();
+  }
+  return ok ? nullptr : "failed to write file";
+}
+
+TemplatePack::TemplatePack()
+  :mEntries(nullptr), mNames(nullptr), mCount(0){
+}
+
+auto TemplatePack::name(uint32_t i) const->std::string_view{
+  return std::string_view(mNames + mEntries[i].nameOffset, mEntries[i].nameLength);
+}
+
+auto TemplatePack::open(const char* path)->const char*{
+  auto file = std::make_shared<MappedFile>();
+  if(auto error = file->open(path)){
+    return error;
+  }
+  size_t size = file->size();
+  if(size < sizeof(PackHeader)){
+    return "not a template pack";
+  }
+  PackHeader header;
+  memcpy(&header, file->data(), sizeof(header));
+  if(header.magic != PACK_MAGIC){
+    return "not a template pack";
+  }
+  if(header.version != PACK_VERSION){
+    return "unsupported template pack";
+  }
+  if(header.indexOffset % alignof(PackEntry) != 0 || header.indexOffset > size ||
+    (size - header.indexOffset) / sizeof(PackEntry) < header.count ||
+    header.namesOffset > size || size - header.namesOffset < header.namesSize){
+    return "template pack is truncated";
+  }
+  auto entries = (const PackEntry*)(file->data() + header.indexOffset);
+  auto names = (const char*)file->data() + header.namesOffset;
+  std::string_view previous;
+  for(uint32_t i = 0; i < header.count; i++){
+    auto& entry = entries[i];
+    uint64_t bytes = (uint64_t)entry.width * entry.height * 4;
+    if((uint64_t)entry.nameOffset + entry.nameLength > header.namesSize || entry.width == 0 || entry.height == 0 ||
+      entry.width > INT32_MAX / 4 || entry.pixelOffset > size || size - entry.pixelOffset < bytes){
+      return "template pack is truncated";
+    }
+    std::string_view current(names + entry.nameOffset, entry.nameLength);
+    // lookups are binary searches
+    if(i > 0 && !(previous < current)){
+      return "template pack index is not sorted";
+    }
+    previous = current;
+  }
+  mPath = path;
+  mFile = std::move(file);
+  mEntries = entries;
+  mNames = names;
+  mCount = header.count;
+  std::lock_guard<std::mutex> lock(mMutex);
+  mImages.assign(mCount, nullptr);
+  return nullptr;
+}
+
+auto TemplatePack::find(std::string_view name)->std::shared_ptr<CommonBitmap>{
+  uint32_t low = 0, high = mCount;
+  while(low < high){
+    uint32_t middle = low + (high - low) / 2;
+    if(this->name(middle) < name){
+      low = middle + 1;
+    }else{
+      high = middle;
+    }
+  }
+  if(low == mCount || this->name(low) != name){
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(mMutex);
+  auto& image = mImages[low];
+  if(!image){
+    auto& entry = mEntries[low];
+    image = std::make_shared<CommonBitmap>();
+    image->wrap(mFile->data() + entry.pixelOffset, entry.width, entry.height, mFile, entry.channelSums);
+  }
+  return image;
+}
+
+static std::mutex packsMutex;
+static std::vector<std::shared_ptr<TemplatePack>> packs;
+
+void registerPack(std::shared_ptr<TemplatePack> pack){
+  std::lock_guard<std::mutex> lock(packsMutex);
+  packs.erase(std::remove_if(packs.begin(), packs.end(), [&](const std::shared_ptr<TemplatePack>& other){
+    return other->path() == pack->path();
+  }), packs.end());
+  packs.push_back(std::move(pack));
+}
+
+auto findPackedImage(std::string_view name)->std::shared_ptr<CommonBitmap>{
+  std::lock_guard<std::mutex> lock(packsMutex);
+  for(auto pack = packs.rbegin(); pack != packs.rend(); ++pack){
+    if(auto image = (*pack)->find(name)){
+      return image;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace vision
@@ -0,0 +1,81 @@
+#ifndef __VISION_PACK_H__
+#define __VISION_PACK_H__
+
+#include "CommonBitmap.h"
+#include "MappedFile.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace vision {
+
+constexpr uint32_t PACK_MAGIC = 0x4b505653; // "SVPK"
+constexpr uint32_t PACK_VERSION = 1;
+// pixels of every image start on a cache line
+constexpr int PACK_ALIGNMENT = 64;
+
+// A pack is a PackHeader, count PackEntry sorted by name, the names, then
+// the pixels of every image as a loaded CommonBitmap holds them. Fields
+// are in the byte order of the machine, packs are built for little
+// endian targets.
+struct PackHeader{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint32_t reserved;
+  uint64_t indexOffset;
+  uint64_t namesOffset;
+  uint64_t namesSize;
+};
+
+struct PackEntry{
+  uint64_t pixelOffset;
+  // into the names
+  uint32_t nameOffset;
+  uint32_t nameLength;
+  uint32_t width;
+  uint32_t height;
+  uint64_t channelSums[3];
+};
+
+// Writes images to a pack at path, nullptr or the reason it failed
+auto writePack(const char* path, std::vector<std::pair<std::string, CommonBitmap*>> images)->const char*;
+
+// A mapped pack, its images point into the mapping
+class TemplatePack
+{
+  std::string mPath;
+  std::shared_ptr<MappedFile> mFile;
+  const PackEntry* mEntries;
+  const char* mNames;
+  uint32_t mCount;
+  // built on first use, so repeated lookups share pyramids and samples
+  std::mutex mMutex;
+  std::vector<std::shared_ptr<CommonBitmap>> mImages;
+  auto name(uint32_t i) const->std::string_view;
+public:
+  TemplatePack();
+  // nullptr, or the reason path is not a valid pack
+  auto open(const char* path)->const char*;
+  auto path() const->const std::string&{
+    return mPath;
+  }
+  auto size() const->uint32_t{
+    return mCount;
+  }
+  // nullptr when the pack has no image called name
+  auto find(std::string_view name)->std::shared_ptr<CommonBitmap>;
+};
+
+// Makes the images of pack available to loadImages, replacing a pack
+// opened from the same path. Packs registered later are searched first.
+void registerPack(std::shared_ptr<TemplatePack> pack);
+auto findPackedImage(std::string_view name)->std::shared_ptr<CommonBitmap>;
+
+} // namespace vision
+
+#endif // __VISION_PACK_H__
@@ -0,0 +1,171 @@
+#ifndef __VISION_PARALLEL_H__
+#define __VISION_PARALLEL_H__
+
+#include "ThreadPool.h"
+#include "vision_util.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace vision {
+
+// smaller scans are not worth waking the pool for
+constexpr int MIN_PARALLEL_SCAN_AREA = 64 * 1024;
+// stripes per thread, more stripes balance better and cancel sooner
+constexpr int SCAN_STRIPES_PER_THREAD = 4;
+// comparator calls between two looks at the cancel flag
+constexpr int SCAN_CANCEL_CHECK_INTERVAL = 1024;
+
+// Runs one stripe of a parallel scan, gives up once an earlier stripe hit.
+template<class T1>
+class StripeComparator
+{
+	T1* mComparator;
+	const std::atomic<int>* mFirstHit;
+	int mStripe;
+	int mCalls;
+	bool mCancelled;
+public:
+	StripeComparator(T1* comparator, const std::atomic<int>* firstHit, int stripe)
+		:mComparator(comparator), mFirstHit(firstHit), mStripe(stripe), mCalls(0), mCancelled(false)
+	{}
+	bool compare(int x, int y, const unsigned char* color)
+	{
+		if(++mCalls == SCAN_CANCEL_CHECK_INTERVAL){
+			mCalls = 0;
+			if(mFirstHit->load(std::memory_order_relaxed) < mStripe){
+				mCancelled = true;
+				return true;
+			}
+		}
+		return mComparator->compare(x, y, color);
+	}
+	bool isCancelled()
+	{
+		return mCancelled;
+	}
+};
+
+// The rectangle is cut into stripes along the outer loop of the read order,
+// so every stripe comes entirely before the next one in that order. Stripes
+// are claimed in order by the caller and the pool, and the earliest stripe
+// that hits wins.
+template<class T1>
+class ParallelScan
+{
+	Bitmap* mBitmap;
+	int mX, mY, mX1, mY1;
+	int mOrder;
+	int mStripes;
+	T1 mPrototype;
+	std::vector<std::optional<T1>> mResults;
+	std::atomic<int> mNext;
+	std::atomic<int> mFirstHit;
+	std::atomic<int> mFinished;
+	std::mutex mMutex;
+	std::condition_variable mDone;
+
+	void stripeRect(int stripe, int& x, int& y, int& x1, int& y1)
+	{
+		x = mX; y = mY; x1 = mX1; y1 = mY1;
+		bool columns = mOrder <= DOWN_UP_RIGHT_LEFT;
+		bool reversed = columns ? (mOrder == UP_DOWN_RIGHT_LEFT || mOrder == DOWN_UP_RIGHT_LEFT)
+			: (mOrder == LEFT_RIGHT_DOWN_UP || mOrder == RIGHT_LEFT_DOWN_UP);
+		int length = columns ? mX1 - mX : mY1 - mY;
+		int begin = static_cast<int>(static_cast<long long>(length) * stripe / mStripes);
+		int end = static_cast<int>(static_cast<long long>(length) * (stripe + 1) / mStripes);
+		int& low = columns ? x : y;
+		int& high = columns ? x1 : y1;
+		if(reversed){
+			low = high - end;
+			high = high - begin;
+		}else{
+			high = low + end;
+			low = low + begin;
+		}
+	}
+
+	void scanStripe(int stripe)
+	{
+		int x, y, x1, y1;
+		stripeRect(stripe, x, y, x1, y1);
+		if(x1 <= x || y1 <= y)
+			return;
+		T1 comparator = mPrototype;
+		StripeComparator<T1> stripeComparator(&comparator, &mFirstHit, stripe);
+		if(!orderFindColor(mBitmap, x, y, x1, y1, mOrder, &stripeComparator) || stripeComparator.isCancelled())
+			return;
+		mResults[stripe].emplace(comparator);
+		int first = mFirstHit.load();
+		while(stripe < first && !mFirstHit.compare_exchange_weak(first, stripe)){
+		}
+	}
+public:
+	ParallelScan(Bitmap* bitmap, int x, int y, int x1, int y1, int order, int stripes, const T1& prototype)
+		:mBitmap(bitmap), mX(x), mY(y), mX1(x1), mY1(y1), mOrder(order), mStripes(stripes),
+		mPrototype(prototype), mResults(stripes), mNext(0), mFirstHit(stripes), mFinished(0)
+	{}
+
+	void run()
+	{
+		int stripe;
+		while((stripe = mNext.fetch_add(1)) < mStripes){
+			if(stripe < mFirstHit.load())
+				scanStripe(stripe);
+			if(mFinished.fetch_add(1) + 1 == mStripes){
+				std::lock_guard<std::mutex> lock(mMutex);
+				mDone.notify_all();
+			}
+		}
+	}
+
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mDone.wait(lock, [this]{ return mFinished.load() == mStripes; });
+	}
+
+	bool getResult(T1* comparator)
+	{
+		int first = mFirstHit.load();
+		if(first >= mStripes)
+			return false;
+		*comparator = *mResults[first];
+		return true;
+	}
+};
+
+// orderFindColor spread over scanThreadCount() threads. Returns the same first
+// match as orderFindColor, the comparator must be copyable and only read
+// shared state, its result is copied back from the winning stripe.
+template<class T1>
+bool parallelOrderFindColor(Bitmap* bitmap, int x, int y, int x1, int y1, int readOrder, T1* comparator)
+{
+	int threads = scanThreadCount();
+	bool columns = readOrder <= DOWN_UP_RIGHT_LEFT;
+	int length = columns ? x1 - x : y1 - y;
+	std::shared_ptr<ThreadPool> pool;
+	if(threads > 1 && static_cast<long long>(x1 - x) * (y1 - y) >= MIN_PARALLEL_SCAN_AREA && length > 1)
+		pool = scanThreadPool();
+	if(!pool || readOrder < UP_DOWN_LEFT_RIGHT || readOrder > RIGHT_LEFT_DOWN_UP)
+		return scanRect(bitmap, x, y, x1, y1, readOrder, comparator);
+
+	int stripes = pool->size() + 1;
+	stripes *= SCAN_STRIPES_PER_THREAD;
+	if(stripes > length)
+		stripes = length;
+	// helpers can start after this call returned, so they share ownership
+	auto scan = std::make_shared<ParallelScan<T1>>(bitmap, x, y, x1, y1, readOrder, stripes, *comparator);
+	for(int i = 0; i < pool->size(); i++)
+		pool->submit([scan]{ scan->run(); });
+	scan->run();
+	scan->wait();
+	return scan->getResult(comparator);
+}
+
+} // namespace vision
+
+#endif // __VISION_PARALLEL_H__
@@ -0,0 +1,99 @@
+#ifndef __VISION_PIXEL_H__
+#define __VISION_PIXEL_H__
+
+namespace vision {
+
+// Byte layout of the pixels of a Bitmap. Color values are 0xRRGGBB
+// whatever the layout, only the pixel side of a compare changes.
+enum PixelFormat:unsigned char{
+  PIXEL_RGBA,
+  PIXEL_BGRA,
+  PIXEL_RGB24,
+  PIXEL_GRAY8,
+};
+
+// channels as numbered by the traits below
+constexpr int CHANNEL_RED = 0;
+constexpr int CHANNEL_GREEN = 1;
+constexpr int CHANNEL_BLUE = 2;
+
+template<PixelFormat F>
+struct PixelTraits;
+
+template<>
+struct PixelTraits<PIXEL_RGBA>{
+  static constexpr PixelFormat format = PIXEL_RGBA;
+  static constexpr int bytes = 4;
+  static constexpr int red = 0, green = 1, blue = 2;
+};
+
+template<>
+struct PixelTraits<PIXEL_BGRA>{
+  static constexpr PixelFormat format = PIXEL_BGRA;
+  static constexpr int bytes = 4;
+  static constexpr int red = 2, green = 1, blue = 0;
+};
+
+template<>
+struct PixelTraits<PIXEL_RGB24>{
+  static constexpr PixelFormat format = PIXEL_RGB24;
+  static constexpr int bytes = 3;
+  static constexpr int red = 0, green = 1, blue = 2;
+};
+
+// one byte that stands for all three channels
+template<>
+struct PixelTraits<PIXEL_GRAY8>{
+  static constexpr PixelFormat format = PIXEL_GRAY8;
+  static constexpr int bytes = 1;
+  static constexpr int red = 0, green = 0, blue = 0;
+};
+
+// calls function with the traits of format, so the code behind it is
+// compiled once per format instead of looking the layout up per pixel
+template<class TFunction>
+inline auto visitPixelFormat(PixelFormat format, TFunction&& function){
+  switch (format)
+  {
+  case PIXEL_BGRA:
+    return function(PixelTraits<PIXEL_BGRA>());
+  case PIXEL_RGB24:
+    return function(PixelTraits<PIXEL_RGB24>());
+  case PIXEL_GRAY8:
+    return function(PixelTraits<PIXEL_GRAY8>());
+  case PIXEL_RGBA:
+  default:
+    return function(PixelTraits<PIXEL_RGBA>());
+  }
+}
+
+// the same for a pair, a searched bitmap and a template
+template<class TFunction>
+inline auto visitPixelFormats(PixelFormat format, PixelFormat other, TFunction&& function){
+  return visitPixelFormat(format, [&](auto pixel){
+    return visitPixelFormat(other, [&](auto otherPixel){
+      return function(pixel, otherPixel);
+    });
+  });
+}
+
+inline auto pixelFormatBytes(PixelFormat format)->int{
+  return visitPixelFormat(format, [](auto pixel){ return decltype(pixel)::bytes; });
+}
+
+// byte offset of channel in a pixel of format
+inline auto channelOffset(PixelFormat format, int channel)->int{
+  return visitPixelFormat(format, [channel](auto pixel){
+    using P = decltype(pixel);
+    return channel == CHANNEL_RED ? P::red : (channel == CHANNEL_GREEN ? P::green : P::blue);
+  });
+}
+
+// byte of a 0xRRGGBB color value holding channel
+constexpr auto colorValueByte(int channel)->int{
+  return 2 - channel;
+}
+
+} // namespace vision
+
+#endif // __VISION_PIXEL_H__
@@ -0,0 +1,509 @@
+#include "vision_simd.h"
+#include "vision_util.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if VISION_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+namespace vision {
+
+using RowShiftSumFunction = int (*)(const unsigned char*,const unsigned char*,int);
+
+// red and blue of the template read from each other's byte when swapped
+template<bool SWAPPED>
+using TemplateLayout = PixelTraits<SWAPPED ? PIXEL_BGRA : PIXEL_RGBA>;
+
+template<bool SWAPPED>
+static auto scalarRowShiftSum(const unsigned char* pixels,const unsigned char* templatePixels,int count)->int{
+  int sum = 0;
+  for(int i = 0; i < count; i++){
+    sum += computePixelShiftSum<PixelTraits<PIXEL_RGBA>, TemplateLayout<SWAPPED>>(pixels, templatePixels);
+    pixels += 4;
+    templatePixels += 4;
+  }
+  return sum;
+}
+
+#if defined(__SSE2__)
+// move the template channels to the bytes they are compared with and clear alpha
+template<bool SWAPPED>
+static inline auto alignTemplate(__m128i t)->__m128i{
+  if(!SWAPPED){
+    return _mm_and_si128(t, _mm_set1_epi32(0x00FFFFFF));
+  }
+  const __m128i low = _mm_set1_epi32(0xFF);
+  const __m128i green = _mm_set1_epi32(0xFF00);
+  return _mm_or_si128(_mm_and_si128(t, green),
+    _mm_or_si128(_mm_and_si128(_mm_srli_epi32(t, 16), low), _mm_slli_epi32(_mm_and_si128(t, low), 16)));
+}
+
+template<bool SWAPPED>
+static auto sse2RowShiftSum(const unsigned char* pixels,const unsigned char* templatePixels,int count)->int{
+  const __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+  __m128i sum = _mm_setzero_si128();
+  int i = 0;
+  for(; i + 4 <= count; i += 4){
+    __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pixels + i * 4)), rgb);
+    __m128i b = alignTemplate<SWAPPED>(_mm_loadu_si128((const __m128i*)(templatePixels + i * 4)));
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(a, b));
+  }
+  int result = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+  return result + scalarRowShiftSum<SWAPPED>(pixels + i * 4, templatePixels + i * 4, count - i);
+}
+#endif
+
+#if VISION_SIMD_AVX2
+template<bool SWAPPED>
+__attribute__((target("avx2")))
+static inline auto alignTemplate(__m256i t)->__m256i{
+  if(!SWAPPED){
+    return _mm256_and_si256(t, _mm256_set1_epi32(0x00FFFFFF));
+  }
+  const __m256i low = _mm256_set1_epi32(0xFF);
+  const __m256i green = _mm256_set1_epi32(0xFF00);
+  return _mm256_or_si256(_mm256_and_si256(t, green),
+    _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(t, 16), low), _mm256_slli_epi32(_mm256_and_si256(t, low), 16)));
+}
+
+template<bool SWAPPED>
+__attribute__((target("avx2")))
+static auto avx2RowShiftSum(const unsigned char* pixels,const unsigned char* templatePixels,int count)->int{
+  const __m256i rgb = _mm256_set1_epi32(0x00FFFFFF);
+  __m256i sum = _mm256_setzero_si256();
+  int i = 0;
+  for(; i + 8 <= count; i += 8){
+    __m256i a = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(pixels + i * 4)), rgb);
+    __m256i b = alignTemplate<SWAPPED>(_mm256_loadu_si256((const __m256i*)(templatePixels + i * 4)));
+    sum = _mm256_add_epi64(sum, _mm256_sad_epu8(a, b));
+  }
+  __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  int result = _mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+  return result + scalarRowShiftSum<SWAPPED>(pixels + i * 4, templatePixels + i * 4, count - i);
+}
+#endif
+
+template<bool SWAPPED>
+static auto selectRowShiftSum()->RowShiftSumFunction{
+#if VISION_SIMD_AVX2
+  if(__builtin_cpu_supports("avx2")) return avx2RowShiftSum<SWAPPED>;
+#endif
+#if defined(__SSE2__)
+  return sse2RowShiftSum<SWAPPED>;
+#else
+  return scalarRowShiftSum<SWAPPED>;
+#endif
+}
+
+auto computeRowShiftSum(const unsigned char* pixels,const unsigned char* templatePixels,int count,bool swapped)->int{
+  static const RowShiftSumFunction same = selectRowShiftSum<false>();
+  static const RowShiftSumFunction swappedFunction = selectRowShiftSum<true>();
+  return (swapped ? swappedFunction : same)(pixels, templatePixels, count);
+}
+
+using CountRowFunction = int (*)(const unsigned char*,int,const PixelPredicate&);
+
+template<int MODE>
+static inline auto scalarMatches(const unsigned char* pixel,const PixelPredicate& predicate)->bool{
+  auto color = (const unsigned char*)&predicate.color;
+  auto shift = (const unsigned char*)&predicate.shift;
+  int sum = 0;
+  for(int channel = 0; channel < 3; channel++){
+    int distance = abs(pixel[channel] - color[channel]);
+    if(MODE == PREDICATE_GAMUT){
+      distance = distance > shift[channel] ? distance - shift[channel] : 0;
+    }else if(MODE == PREDICATE_GAMUT_NOT){
+      distance = shift[channel] > distance ? shift[channel] - distance : 0;
+    }
+    sum += distance;
+  }
+  return sum <= predicate.shiftSum;
+}
+
+template<int MODE>
+static auto scalarCountRow(const unsigned char* pixels,int count,const PixelPredicate& predicate)->int{
+  int result = 0;
+  for(int i = 0; i < count; i++){
+    result += scalarMatches<MODE>(pixels + i * 4, predicate);
+  }
+  return result;
+}
+
+template<int MODE>
+static auto scalarFindRow(const unsigned char* pixels,int count,const PixelPredicate& predicate,bool reversed)->int{
+  for(int k = 0; k < count; k++){
+    int i = reversed ? count - 1 - k : k;
+    if(scalarMatches<MODE>(pixels + i * 4, predicate)){
+      return i;
+    }
+  }
+  return -1;
+}
+
+#if defined(__SSE2__)
+// bit i set when pixel i of the register matches
+template<int MODE>
+static inline auto sse2MatchMask(__m128i pixels,__m128i color,__m128i shift,__m128i limit)->int{
+  pixels = _mm_and_si128(pixels, _mm_set1_epi32(0x00FFFFFF));
+  __m128i distance = _mm_or_si128(_mm_subs_epu8(pixels, color), _mm_subs_epu8(color, pixels));
+  if(MODE == PREDICATE_GAMUT){
+    distance = _mm_subs_epu8(distance, shift);
+  }else if(MODE == PREDICATE_GAMUT_NOT){
+    distance = _mm_subs_epu8(shift, distance);
+  }
+  // bytes to 16-bit pairs, then the pairs of each pixel to one 32-bit sum
+  __m128i pairs = _mm_add_epi16(_mm_and_si128(distance, _mm_set1_epi16(0xFF)), _mm_srli_epi16(distance, 8));
+  __m128i sums = _mm_madd_epi16(pairs, _mm_set1_epi16(1));
+  return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(sums, limit)));
+}
+
+template<int MODE>
+static auto sse2CountRow(const unsigned char* pixels,int count,const PixelPredicate& predicate)->int{
+  const __m128i color = _mm_set1_epi32(predicate.color);
+  const __m128i shift = _mm_set1_epi32(predicate.shift);
+  const __m128i limit = _mm_set1_epi32(predicate.shiftSum + 1);
+  int result = 0;
+  int i = 0;
+  for(; i + 4 <= count; i += 4){
+    int mask = sse2MatchMask<MODE>(_mm_loadu_si128((const __m128i*)(pixels + i * 4)), color, shift, limit);
+    result += __builtin_popcount(mask);
+  }
+  return result + scalarCountRow<MODE>(pixels + i * 4, count - i, predicate);
+}
+
+template<int MODE>
+static auto sse2FindRow(const unsigned char* pixels,int count,const PixelPredicate& predicate,bool reversed)->int{
+  const __m128i color = _mm_set1_epi32(predicate.color);
+  const __m128i shift = _mm_set1_epi32(predicate.shift);
+  const __m128i limit = _mm_set1_epi32(predicate.shiftSum + 1);
+  if(!reversed){
+    int i = 0;
+    for(; i + 4 <= count; i += 4){
+      int mask = sse2MatchMask<MODE>(_mm_loadu_si128((const __m128i*)(pixels + i * 4)), color, shift, limit);
+      if(mask){
+        return i + __builtin_ctz(mask);
+      }
+    }
+    int tail = scalarFindRow<MODE>(pixels + i * 4, count - i, predicate, false);
+    return tail < 0 ? -1 : i + tail;
+  }
+  int i = count;
+  for(; i >= 4; i -= 4){
+    int mask = sse2MatchMask<MODE>(_mm_loadu_si128((const __m128i*)(pixels + (i - 4) * 4)), color, shift, limit);
+    if(mask){
+      return i - 4 + 31 - __builtin_clz(mask);
+    }
+  }
+  return scalarFindRow<MODE>(pixels, i, predicate, true);
+}
+#endif
+
+#if VISION_SIMD_AVX2
+template<int MODE>
+__attribute__((target("avx2")))
+static inline auto avx2MatchMask(__m256i pixels,__m256i color,__m256i shift,__m256i limit)->int{
+  pixels = _mm256_and_si256(pixels, _mm256_set1_epi32(0x00FFFFFF));
+  __m256i distance = _mm256_or_si256(_mm256_subs_epu8(pixels, color), _mm256_subs_epu8(color, pixels));
+  if(MODE == PREDICATE_GAMUT){
+    distance = _mm256_subs_epu8(distance, shift);
+  }else if(MODE == PREDICATE_GAMUT_NOT){
+    distance = _mm256_subs_epu8(shift, distance);
+  }
+  __m256i pairs = _mm256_add_epi16(_mm256_and_si256(distance, _mm256_set1_epi16(0xFF)), _mm256_srli_epi16(distance, 8));
+  __m256i sums = _mm256_madd_epi16(pairs, _mm256_set1_epi16(1));
+  return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(limit, sums)));
+}
+
+template<int MODE>
+__attribute__((target("avx2,popcnt")))
+static auto avx2CountRow(const unsigned char* pixels,int count,const PixelPredicate& predicate)->int{
+  const __m256i color = _mm256_set1_epi32(predicate.color);
+  const __m256i shift = _mm256_set1_epi32(predicate.shift);
+  const __m256i limit = _mm256_set1_epi32(predicate.shiftSum + 1);
+  int result = 0;
+  int i = 0;
+  for(; i + 8 <= count; i += 8){
+    int mask = avx2MatchMask<MODE>(_mm256_loadu_si256((const __m256i*)(pixels + i * 4)), color, shift, limit);
+    result += __builtin_popcount(mask);
+  }
+  return result + scalarCountRow<MODE>(pixels + i * 4, count - i, predicate);
+}
+
+template<int MODE>
+__attribute__((target("avx2")))
+static auto avx2FindRow(const unsigned char* pixels,int count,const PixelPredicate& predicate,bool reversed)->int{
+  const __m256i color = _mm256_set1_epi32(predicate.color);
+  const __m256i shift = _mm256_set1_epi32(predicate.shift);
+  const __m256i limit = _mm256_set1_epi32(predicate.shiftSum + 1);
+  if(!reversed){
+    int i = 0;
+    for(; i + 8 <= count; i += 8){
+      int mask = avx2MatchMask<MODE>(_mm256_loadu_si256((const __m256i*)(pixels + i * 4)), color, shift, limit);
+      if(mask){
+        return i + __builtin_ctz(mask);
+      }
+    }
+    int tail = scalarFindRow<MODE>(pixels + i * 4, count - i, predicate, false);
+    return tail < 0 ? -1 : i + tail;
+  }
+  int i = count;
+  for(; i >= 8; i -= 8){
+    int mask = avx2MatchMask<MODE>(_mm256_loadu_si256((const __m256i*)(pixels + (i - 8) * 4)), color, shift, limit);
+    if(mask){
+      return i - 8 + 31 - __builtin_clz(mask);
+    }
+  }
+  return scalarFindRow<MODE>(pixels, i, predicate, true);
+}
+#endif
+
+using FindRowFunction = int (*)(const unsigned char*,int,const PixelPredicate&,bool);
+
+template<int MODE>
+static auto selectFindRow()->FindRowFunction{
+#if VISION_SIMD_AVX2
+  if(__builtin_cpu_supports("avx2")) return avx2FindRow<MODE>;
+#endif
+#if defined(__SSE2__)
+  return sse2FindRow<MODE>;
+#else
+  return scalarFindRow<MODE>;
+#endif
+}
+
+auto findRowMatch(const unsigned char* pixels,int count,const PixelPredicate& predicate,bool reversed)->int{
+  static const FindRowFunction functions[] = {
+    selectFindRow<PREDICATE_DISTANCE>(),
+    selectFindRow<PREDICATE_GAMUT>(),
+    selectFindRow<PREDICATE_GAMUT_NOT>(),
+  };
+  return functions[predicate.mode](pixels, count, predicate, reversed);
+}
+
+template<int MODE>
+static auto selectCountRow()->CountRowFunction{
+#if VISION_SIMD_AVX2
+  if(__builtin_cpu_supports("avx2")) return avx2CountRow<MODE>;
+#endif
+#if defined(__SSE2__)
+  return sse2CountRow<MODE>;
+#else
+  return scalarCountRow<MODE>;
+#endif
+}
+
+auto countRowMatches(const unsigned char* pixels,int count,const PixelPredicate& predicate)->int{
+  static const CountRowFunction functions[] = {
+    selectCountRow<PREDICATE_DISTANCE>(),
+    selectCountRow<PREDICATE_GAMUT>(),
+    selectCountRow<PREDICATE_GAMUT_NOT>(),
+  };
+  return functions[predicate.mode](pixels, count, predicate);
+}
+
+using LumaRowFunction = void (*)(const unsigned char*,unsigned char*,int);
+using LumaWindowFunction = bool (*)(const unsigned char*,int,const unsigned char*,int,int,int);
+
+static void scalarLumaRow(const unsigned char* pixels,unsigned char* luma,int count){
+  for(int i = 0; i < count; i++){
+    luma[i] = (pixels[0] + 2 * pixels[1] + pixels[2]) >> 2;
+    pixels += 4;
+  }
+}
+
+// 2 * |a - b| - 1 summed over the bytes that differ
+static auto scalarLumaBound(const unsigned char* a,const unsigned char* b,int count)->int{
+  int sum = 0;
+  for(int i = 0; i < count; i++){
+    int distance = abs(a[i] - b[i]);
+    if(distance){
+      sum += 2 * distance - 1;
+    }
+  }
+  return sum;
+}
+
+#if !defined(__SSE2__)
+static auto scalarLumaWindow(const unsigned char* window,int stride,const unsigned char* luma,int width,int height,int limit)->bool{
+  int64_t bound = 0;
+  for(int i = 0; i < height; i++){
+    bound += scalarLumaBound(window + (size_t)i * stride, luma + (size_t)i * width, width);
+    if(bound > limit){
+      return true;
+    }
+  }
+  return false;
+}
+#endif
+
+#if defined(__SSE2__)
+// the lumas of four pixels, one per 32-bit lane
+static inline auto sse2Luma(__m128i pixels)->__m128i{
+  const __m128i low = _mm_set1_epi32(0xFF);
+  __m128i outer = _mm_add_epi32(_mm_and_si128(pixels, low), _mm_and_si128(_mm_srli_epi32(pixels, 16), low));
+  __m128i middle = _mm_and_si128(_mm_srli_epi32(pixels, 7), _mm_set1_epi32(0x1FE));
+  return _mm_srli_epi32(_mm_add_epi32(outer, middle), 2);
+}
+
+static void sse2LumaRow(const unsigned char* pixels,unsigned char* luma,int count){
+  int i = 0;
+  for(; i + 16 <= count; i += 16){
+    const __m128i* p = (const __m128i*)(pixels + i * 4);
+    __m128i low = _mm_packs_epi32(sse2Luma(_mm_loadu_si128(p)), sse2Luma(_mm_loadu_si128(p + 1)));
+    __m128i high = _mm_packs_epi32(sse2Luma(_mm_loadu_si128(p + 2)), sse2Luma(_mm_loadu_si128(p + 3)));
+    _mm_storeu_si128((__m128i*)(luma + i), _mm_packus_epi16(low, high));
+  }
+  scalarLumaRow(pixels + i * 4, luma + i, count - i);
+}
+
+static auto sse2LumaWindow(const unsigned char* window,int stride,const unsigned char* luma,int width,int height,int limit)->bool{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  int64_t bound = 0;
+  for(int row = 0; row < height; row++){
+    const unsigned char* a = window + (size_t)row * stride;
+    const unsigned char* b = luma + (size_t)row * width;
+    // twice the distances minus one per byte that differs, the bytes past
+    // a half load are equal
+    __m128i sum = _mm_setzero_si128();
+    int i = 0;
+    for(; i + 16 <= width; i += 16){
+      __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+      __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+      __m128i distance = _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x));
+      sum = _mm_add_epi64(sum, _mm_sub_epi64(_mm_slli_epi64(_mm_sad_epu8(distance, zero), 1),
+        _mm_sad_epu8(_mm_min_epu8(distance, one), zero)));
+    }
+    if(i + 8 <= width){
+      __m128i x = _mm_loadl_epi64((const __m128i*)(a + i));
+      __m128i y = _mm_loadl_epi64((const __m128i*)(b + i));
+      __m128i distance = _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x));
+      sum = _mm_add_epi64(sum, _mm_sub_epi64(_mm_slli_epi64(_mm_sad_epu8(distance, zero), 1),
+        _mm_sad_epu8(_mm_min_epu8(distance, one), zero)));
+      i += 8;
+    }
+    bound += _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)) + scalarLumaBound(a + i, b + i, width - i);
+    if(bound > limit){
+      return true;
+    }
+  }
+  return false;
+}
+#endif
+
+#if VISION_SIMD_AVX2
+__attribute__((target("avx2")))
+static inline auto avx2Luma(__m256i pixels)->__m256i{
+  const __m256i low = _mm256_set1_epi32(0xFF);
+  __m256i outer = _mm256_add_epi32(_mm256_and_si256(pixels, low), _mm256_and_si256(_mm256_srli_epi32(pixels, 16), low));
+  __m256i middle = _mm256_and_si256(_mm256_srli_epi32(pixels, 7), _mm256_set1_epi32(0x1FE));
+  return _mm256_srli_epi32(_mm256_add_epi32(outer, middle), 2);
+}
+
+__attribute__((target("avx2")))
+static void avx2LumaRow(const unsigned char* pixels,unsigned char* luma,int count){
+  // the packs work per 128-bit lane, this puts the groups of four back in order
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  int i = 0;
+  for(; i + 32 <= count; i += 32){
+    const __m256i* p = (const __m256i*)(pixels + i * 4);
+    __m256i low = _mm256_packs_epi32(avx2Luma(_mm256_loadu_si256(p)), avx2Luma(_mm256_loadu_si256(p + 1)));
+    __m256i high = _mm256_packs_epi32(avx2Luma(_mm256_loadu_si256(p + 2)), avx2Luma(_mm256_loadu_si256(p + 3)));
+    __m256i packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(low, high), order);
+    _mm256_storeu_si256((__m256i*)(luma + i), packed);
+  }
+  scalarLumaRow(pixels + i * 4, luma + i, count - i);
+}
+
+#endif
+
+static auto selectLumaRow()->LumaRowFunction{
+#if VISION_SIMD_AVX2
+  if(__builtin_cpu_supports("avx2")) return avx2LumaRow;
+#endif
+#if defined(__SSE2__)
+  return sse2LumaRow;
+#else
+  return scalarLumaRow;
+#endif
+}
+
+// rows of a template are short, the wider registers do not pay for their tails
+static auto selectLumaWindow()->LumaWindowFunction{
+#if defined(__SSE2__)
+  return sse2LumaWindow;
+#else
+  return scalarLumaWindow;
+#endif
+}
+
+void computeLumaRow(const unsigned char* pixels,unsigned char* luma,int count){
+  static const LumaRowFunction function = selectLumaRow();
+  function(pixels, luma, count);
+}
+
+auto lumaWindowExceeds(const unsigned char* window,int stride,const unsigned char* luma,int width,int height,int limit)->bool{
+  static const LumaWindowFunction function = selectLumaWindow();
+  return function(window, stride, luma, width, height, limit);
+}
+
+using BytesDifferFunction = bool (*)(const unsigned char*,const unsigned char*,int);
+
+static auto scalarBytesDiffer(const unsigned char* a,const unsigned char* b,int count)->bool{
+  return memcmp(a, b, count) != 0;
+}
+
+#if defined(__SSE2__)
+// the differences of a tile row are folded into one register and tested once
+static auto sse2BytesDiffer(const unsigned char* a,const unsigned char* b,int count)->bool{
+  __m128i differences = _mm_setzero_si128();
+  int i = 0;
+  for(; i + 16 <= count; i += 16){
+    differences = _mm_or_si128(differences, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)),
+      _mm_loadu_si128((const __m128i*)(b + i))));
+  }
+  if(_mm_movemask_epi8(_mm_cmpeq_epi8(differences, _mm_setzero_si128())) != 0xFFFF){
+    return true;
+  }
+  return scalarBytesDiffer(a + i, b + i, count - i);
+}
+#endif
+
+#if VISION_SIMD_AVX2
+__attribute__((target("avx2")))
+static auto avx2BytesDiffer(const unsigned char* a,const unsigned char* b,int count)->bool{
+  __m256i differences = _mm256_setzero_si256();
+  int i = 0;
+  for(; i + 32 <= count; i += 32){
+    differences = _mm256_or_si256(differences, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)),
+      _mm256_loadu_si256((const __m256i*)(b + i))));
+  }
+  if(!_mm256_testz_si256(differences, differences)){
+    return true;
+  }
+  return scalarBytesDiffer(a + i, b + i, count - i);
+}
+#endif
+
+static auto selectBytesDiffer()->BytesDifferFunction{
+#if VISION_SIMD_AVX2
+  if(__builtin_cpu_supports("avx2")) return avx2BytesDiffer;
+#endif
+#if defined(__SSE2__)
+  return sse2BytesDiffer;
+#else
+  return scalarBytesDiffer;
+#endif
+}
+
+auto bytesDiffer(const unsigned char* a,const unsigned char* b,int count)->bool{
+  static const BytesDifferFunction function = selectBytesDiffer();
+  return function(a, b, count);
+}
+
+} // namespace vision
@@ -0,0 +1,85 @@
+#ifndef __VISION_SIMD_H__
+#define __VISION_SIMD_H__
+
+#include "vision_color.h"
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define VISION_SIMD_AVX2 1
+#else
+#define VISION_SIMD_AVX2 0
+#endif
+
+namespace vision {
+
+// Sum of computePixelShiftSum(pixels[i], templatePixels[i]) over count
+// 4-byte pixels with three channel bytes each. swapped when red and blue
+// trade places between the two layouts, e.g. BGRA against RGBA.
+auto computeRowShiftSum(const unsigned char* pixels,const unsigned char* templatePixels,int count,bool swapped)->int;
+
+enum PredicateMode{
+  // sum of the channel distances, Color and ColorNot
+  PREDICATE_DISTANCE,
+  // sum of the distances beyond the channel shifts, ColorGamut
+  PREDICATE_GAMUT,
+  // sum of the channel shifts not covered by the distances, ColorGamutNot
+  PREDICATE_GAMUT_NOT,
+};
+
+// One color alternative in the byte order of the searched pixel format, so
+// the row kernels compare memory without swizzling every pixel
+struct PixelPredicate{
+  uint32_t color;
+  uint32_t shift;
+  PredicateMode mode;
+  int shiftSum;
+};
+
+inline auto makePixelPredicate(Color* c,int shiftSum,PixelFormat format,PixelPredicate* out)->bool{
+  *out = PixelPredicate{toPixelOrder(c->data, format), 0, PREDICATE_DISTANCE, shiftSum};
+  return true;
+}
+
+inline auto makePixelPredicate(ColorNot* c,int shiftSum,PixelFormat format,PixelPredicate* out)->bool{
+  *out = PixelPredicate{toPixelOrder(c->data, format), 0, PREDICATE_DISTANCE, shiftSum};
+  return true;
+}
+
+inline auto makePixelPredicate(ColorGamut* c,int shiftSum,PixelFormat format,PixelPredicate* out)->bool{
+  *out = PixelPredicate{toPixelOrder(c->color, format), toPixelOrder(c->shift, format), PREDICATE_GAMUT, shiftSum};
+  return true;
+}
+
+inline auto makePixelPredicate(ColorGamutNot* c,int shiftSum,PixelFormat format,PixelPredicate* out)->bool{
+  *out = PixelPredicate{toPixelOrder(c->color, format), toPixelOrder(c->shift, format), PREDICATE_GAMUT_NOT, shiftSum};
+  return true;
+}
+
+// compositions have no single predicate
+template<class TColor>
+inline auto makePixelPredicate(TColor c,int shiftSum,PixelFormat format,PixelPredicate* out)->bool{
+  return false;
+}
+
+// how many of count 4-byte pixels match, same answer as compareColor for
+// the format the predicate was made for
+auto countRowMatches(const unsigned char* pixels,int count,const PixelPredicate& predicate)->int;
+
+// index of the first matching 4-byte pixel, or of the last one when
+// reversed, -1 when none matches
+auto findRowMatch(const unsigned char* pixels,int count,const PixelPredicate& predicate,bool reversed)->int;
+
+// (byte 0 + 2 * byte 1 + byte 2) / 4 of count 4-byte pixels, the luma of
+// every layout that keeps red and blue in bytes 0 and 2
+void computeLumaRow(const unsigned char* pixels,unsigned char* luma,int count);
+
+// Whether sum over the width * height window of max(0, 2 * |a - b| - 1)
+// exceeds limit, window rows are stride bytes apart and the luma rows are tight.
+auto lumaWindowExceeds(const unsigned char* window,int stride,const unsigned char* luma,int width,int height,int limit)->bool;
+
+// whether count bytes of a and b differ anywhere
+auto bytesDiffer(const unsigned char* a,const unsigned char* b,int count)->bool;
+
+} // namespace vision
+
+#endif // __VISION_SIMD_H__
@@ -2,18 +2,10 @@
 #define __VISION_UTIL_H__
 
 #include"Bitmap.h"
+#include <algorithm>
 #include <cmath>
 
 namespace vision {
-#ifdef __ANDROID__
-#define UNORDERED_PIXEL 1
-#endif
-#define UNORDERED_PIXEL 1
-
-static int compareColor(const unsigned char* color, const unsigned char* color1, const unsigned char* shift);
-static int compareColor(const unsigned char* color, const unsigned char* color1, const unsigned char* shift, const unsigned char* shift1);
-static int computeColorShiftSum(const unsigned char* color, const unsigned char* color1);
-static int compareColor(const unsigned char* color, const unsigned char* color1, int colorShiftSum);
 
 #ifdef USE_JEMALLOC
 #include <jemalloc/jemalloc.h>
@@ -98,105 +90,67 @@ inline unsigned char* computeCoordColor(Bitmap* bitmap, int x, int y)
 
 
 
-#if UNORDERED_PIXEL
-inline int compareColor(const unsigned char* color, const unsigned char* color1, const unsigned char* shift)
+// The compares below take a pixel laid out as P and the 0xRRGGBB bytes of
+// a color value (blue first in memory), P is resolved once per search.
+template<class P>
+inline int compareColor(const unsigned char* pixel, const unsigned char* color, const unsigned char* shift)
 {
-	return abs(color1[0] - color[2]) <= shift[0] &&
-		abs(color1[1] - color[1]) <= shift[1] &&
-		abs(color1[2] - color[0]) <= shift[2];
+	return abs(pixel[P::red] - color[2]) <= shift[2] &&
+		abs(pixel[P::green] - color[1]) <= shift[1] &&
+		abs(pixel[P::blue] - color[0]) <= shift[0];
 }
 
-inline int compareColor(const unsigned char* color, const unsigned char* color1, const unsigned char* shift, const unsigned char* shift1)
+template<class P>
+inline int compareColor(const unsigned char* pixel, const unsigned char* color, const unsigned char* shift, const unsigned char* shift1)
 {
-	return abs(color1[0] - color[2]) <= (shift[0]+shift1[0]) &&
-		abs(color1[1] - color[1]) <= (shift[1] + shift1[1]) &&
-		abs(color1[2] - color[0]) <= (shift[2] + shift1[2]);
+	return abs(pixel[P::red] - color[2]) <= (shift[2] + shift1[2]) &&
+		abs(pixel[P::green] - color[1]) <= (shift[1] + shift1[1]) &&
+		abs(pixel[P::blue] - color[0]) <= (shift[0] + shift1[0]);
 }
 
-inline int computeColorShiftSum(const unsigned char* color, const unsigned char* color1)
+template<class P>
+inline int computeColorShiftSum(const unsigned char* pixel, const unsigned char* color)
 {
-	return (abs(color1[0] - color[2]) + abs(color1[1] - color[1]) + abs(color1[2] - color[0]));
+	return abs(pixel[P::red] - color[2]) + abs(pixel[P::green] - color[1]) + abs(pixel[P::blue] - color[0]);
 }
 
-inline int computeColorShiftSum(const unsigned char* color, const unsigned char* color1, const unsigned char* shift)
+template<class P>
+inline int computeColorShiftSum(const unsigned char* pixel, const unsigned char* color, const unsigned char* shift)
 {
 	int r = 0;
-	int c = abs(color1[0] - color[2]) - shift[0];
+	int c = abs(pixel[P::red] - color[2]) - shift[2];
 	if (c > 0) r += c;
-	c = abs(color1[1] - color[1]) - shift[1];
+	c = abs(pixel[P::green] - color[1]) - shift[1];
 	if (c > 0) r += c;
-	c = abs(color1[2] - color[0]) - shift[2];
+	c = abs(pixel[P::blue] - color[0]) - shift[0];
 	if (c > 0) r += c;
 	return r;
 }
 
-
-inline auto computeColorGamutNotShiftSum(const unsigned char* color,const unsigned char* c,const unsigned char* s)->int{
+template<class P>
+inline auto computeColorGamutNotShiftSum(const unsigned char* pixel,const unsigned char* c,const unsigned char* s)->int{
     int r = 0;
-    int count = s[2]-abs(color[0] - c[2]);
+    int count = s[2]-abs(pixel[P::red] - c[2]);
     if(count>0) r+=count;
-    count = s[1]-abs(color[1] - c[1]);
+    count = s[1]-abs(pixel[P::green] - c[1]);
     if(count>0) r+=count;
-    count = s[0]-abs(color[2] - c[0]);
+    count = s[0]-abs(pixel[P::blue] - c[0]);
     if(count>0) r+=count;
     return r;
 }
 
-#else
-inline int compareColor(const unsigned char* color, const unsigned char* color1, const unsigned char* shift)
-{
-	return abs(color1[0] - color[0]) <= shift[0] &&
-		abs(color1[1] - color[1]) <= shift[1] &&
-		abs(color1[2] - color[2]) <= shift[2];
-}
-
-inline int compareColor(const unsigned char* color, const unsigned char* color1, const unsigned char* shift, const unsigned char* shift1)
-{
-	return abs(color1[0] - color[0]) <= (shift[0] + shift1[0]) &&
-		abs(color1[1] - color[1]) <= (shift[1] + shift1[1]) &&
-		abs(color1[2] - color[2]) <= (shift[2] + shift1[2]);
-}
-
-
-
-inline int computeColorShiftSum(const unsigned char* color, const unsigned char* color1)
+template<class P>
+inline int compareColor(const unsigned char* pixel, const unsigned char* color, int colorShiftSum)
 {
-	return (abs(color1[0] - color[0]) + abs(color1[1] - color[1]) + abs(color1[2] - color[2]));
+	return colorShiftSum >= computeColorShiftSum<P>(pixel, color);
 }
 
-inline int computeColorShiftSum(const unsigned char* color, const unsigned char* color1, const unsigned char* shift)
+// a pixel of a bitmap laid out as P against a template pixel laid out as Q
+template<class P, class Q>
+inline int computePixelShiftSum(const unsigned char* pixel, const unsigned char* templatePixel)
 {
-	int r = 0;
-	int c = abs(color1[0] - color[0]) - shift[0];
-	if (c > 0)
-		r += c;
-	c = abs(color1[1] - color[1]) - shift[1];
-	if (c > 0)
-		r += c;
-	c = abs(color1[2] - color[2]) - shift[2];
-	if (c > 0)
-		r += c;
-	return r;
-}
-
-
-inline auto computeColorGamutNotSum(const unsigned char* color,const unsigned char* c,const unsigned char* s)->int{
-    int r = 0;
-    int count = s[0]-abs(color[0] - c[0]);
-    if(count>0) r+=count;
-    count = s[1]-abs(color[1] - c[1]);
-    if(count>0) r+=count;
-    count = s[2]-abs(color[2] - c[2]);
-    if(count>0) r+=count;
-    return r;
-}
-
-
-#endif
-
-inline int compareColor(const unsigned char* color, const unsigned char* color1, int colorShiftSum)
-{
-	return colorShiftSum >= computeColorShiftSum(color, color1);
+	return abs(pixel[P::red] - templatePixel[Q::red]) + abs(pixel[P::green] - templatePixel[Q::green]) +
+		abs(pixel[P::blue] - templatePixel[Q::blue]);
 }
 
 template<class T1>
@@ -222,7 +176,7 @@ template<class T1>
 bool upDownRightLeftReadColor(Bitmap* bitmap, int x, int y, int x1, int y1, T1* comparator)
 {
 	const unsigned char* moveVerticalPointer;
-	const unsigned char* moveLinePointer = bitmap->origin_ + y * bitmap->rowShift_ + x1 * bitmap->pixelStride_;
+	const unsigned char* moveLinePointer = bitmap->origin_ + y * bitmap->rowShift_ + (x1-1) * bitmap->pixelStride_;
 	for (int intx = x1-1; intx >= x; intx--)
 	{
 		moveVerticalPointer = moveLinePointer;
@@ -241,7 +195,7 @@ template<class T1>
 bool downUpLeftRightReadColor(Bitmap* bitmap, int x, int y, int x1, int y1, T1* comparator)
 {
 	const unsigned char* moveVerticalPointer;
-	const unsigned char* moveLinePointer = bitmap->origin_ + y1 * bitmap->rowShift_ + x * bitmap->pixelStride_;
+	const unsigned char* moveLinePointer = bitmap->origin_ + (y1-1) * bitmap->rowShift_ + x * bitmap->pixelStride_;
 	for (int intx = x; intx < x1; intx++)
 	{
 		moveVerticalPointer = moveLinePointer;
@@ -260,7 +214,7 @@ template<class T1>
 bool downUpRightLeftReadColor(Bitmap* bitmap, int x, int y, int x1, int y1, T1* comparator)
 {
 	const unsigned char* moveVerticalPointer;
-	const unsigned char* moveLinePointer = bitmap->origin_ + y1 * bitmap->rowShift_ + x1 * bitmap->pixelStride_;
+	const unsigned char* moveLinePointer = bitmap->origin_ + (y1-1) * bitmap->rowShift_ + (x1-1) * bitmap->pixelStride_;
 	for (int intx = x1-1; intx >= x; intx--)
 	{
 		moveVerticalPointer = moveLinePointer;
@@ -321,7 +275,7 @@ template<class T1>
 bool rightLeftUpDownReadColor(Bitmap* bitmap, int x, int y, int x1, int y1, T1* comparator)
 {
 	const unsigned char* moveLinePointer;
-	const unsigned char* moveVerticalPointer = bitmap->origin_ + y * bitmap->rowShift_ + x1 * bitmap->pixelStride_;
+	const unsigned char* moveVerticalPointer = bitmap->origin_ + y * bitmap->rowShift_ + (x1-1) * bitmap->pixelStride_;
 	for (int inty = y; inty < y1; inty++)
 	{
 		moveLinePointer = moveVerticalPointer;
@@ -340,7 +294,7 @@ template<class T1>
 bool leftRightDownUpReadColor(Bitmap* bitmap, int x, int y, int x1, int y1, T1* comparator)
 {
 	const unsigned char* moveLinePointer;
-	const unsigned char* moveVerticalPointer = bitmap->origin_ + y1 * bitmap->rowShift_ + x * bitmap->pixelStride_;
+	const unsigned char* moveVerticalPointer = bitmap->origin_ + (y1-1) * bitmap->rowShift_ + x * bitmap->pixelStride_;
 	for (int inty = y1-1; inty >= y; inty--)
 	{
 		moveLinePointer = moveVerticalPointer;
@@ -359,7 +313,7 @@ template<class T1>
 bool rightLeftDownUpReadColor(Bitmap* bitmap, int x, int y, int x1, int y1, T1* comparator)
 {
 	const unsigned char* moveLinePointer;
-	const unsigned char* moveVerticalPointer = bitmap->origin_ + y1 * bitmap->rowShift_ + x1 * bitmap->pixelStride_;
+	const unsigned char* moveVerticalPointer = bitmap->origin_ + (y1-1) * bitmap->rowShift_ + (x1-1) * bitmap->pixelStride_;
 	for (int inty = y1-1; inty >= y; inty--)
 	{
 		moveLinePointer = moveVerticalPointer;
@@ -391,6 +345,70 @@ bool orderFindColor(Bitmap* bitmap, int x, int y, int x1, int y1, int readOrder,
 	return false;
 }
 
+// columns per block of a blocked column-major scan, a block row stays in a few cache lines
+constexpr int SCAN_BLOCK_COLUMNS = 64;
+
+// Column-major read order computed row by row inside blocks of
+// SCAN_BLOCK_COLUMNS columns. scanRow(row, x, x1, reversed) returns the first
+// hit of the row in [x, x1) in the outer direction, or -1. After a hit only
+// the columns before it can win, so later rows are cut short there and the
+// last hit of a block is the first hit of the column-major order.
+template<class TRowScan>
+bool blockedColumnScan(int x, int y, int x1, int y1, int readOrder, TRowScan&& scanRow)
+{
+	bool rightLeft = readOrder == UP_DOWN_RIGHT_LEFT || readOrder == DOWN_UP_RIGHT_LEFT;
+	bool downUp = readOrder == DOWN_UP_LEFT_RIGHT || readOrder == DOWN_UP_RIGHT_LEFT;
+	for (int block = 0; block < x1 - x; block += SCAN_BLOCK_COLUMNS)
+	{
+		int low = rightLeft ? std::max(x, x1 - block - SCAN_BLOCK_COLUMNS) : x + block;
+		int high = rightLeft ? x1 - block : std::min(x1, x + block + SCAN_BLOCK_COLUMNS);
+		bool found = false;
+		for (int j = 0; j < y1 - y && low < high; j++)
+		{
+			int row = downUp ? y1 - 1 - j : y + j;
+			int hit = scanRow(row, low, high, rightLeft);
+			if (hit < 0)
+				continue;
+			found = true;
+			if (rightLeft)
+				low = hit + 1;
+			else
+				high = hit;
+		}
+		if (found)
+			return true;
+	}
+	return false;
+}
+
+// orderFindColor with the column-major orders run by blockedColumnScan. The
+// comparator may see positions after the first match, so it must only keep
+// the result of its last hit, like the finders do.
+template<class T1>
+bool blockedOrderFindColor(Bitmap* bitmap, int x, int y, int x1, int y1, int readOrder, T1* comparator)
+{
+	if (readOrder < UP_DOWN_LEFT_RIGHT || readOrder > DOWN_UP_RIGHT_LEFT)
+		return orderFindColor(bitmap, x, y, x1, y1, readOrder, comparator);
+	return blockedColumnScan(x, y, x1, y1, readOrder, [bitmap, comparator](int row, int low, int high, bool reversed){
+		int step = reversed ? -bitmap->pixelStride_ : bitmap->pixelStride_;
+		const unsigned char* pointer = computeCoordColor(bitmap, reversed ? high - 1 : low, row);
+		for (int k = 0; k < high - low; k++, pointer += step)
+		{
+			int column = reversed ? high - 1 - k : low + k;
+			if (comparator->compare(column, row, pointer))
+				return column;
+		}
+		return -1;
+	});
+}
+
+// orderFindColor, finders with a faster scan of their own overload this
+template<class T1>
+inline bool scanRect(Bitmap* bitmap, int x, int y, int x1, int y1, int order, T1* comparator)
+{
+	return orderFindColor(bitmap, x, y, x1, y1, order, comparator);
+}
+
 
 
 inline bool isInBitmapScope(Bitmap* bitmap, int x, int y)
@@ -0,0 +1,82 @@
+#include "ThreadPool.h"
+#include "check.h"
+#include "vision_async.h"
+#include <chrono>
+#include <cstdio>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace vision;
+
+static void testAsync(){
+  using namespace std::chrono;
+  Bitmap bitmap{};
+  // nothing is queued before someone polls
+  {
+    auto queue = std::make_shared<CompletionQueue>();
+    std::vector<SearchPtr> searches;
+    for(int i = 0; i < 50; i++){
+      searches.push_back(submitSearch([](Point*){ return 1; }, &bitmap, queue));
+    }
+    waitForSearches(&bitmap);
+    for(auto& search : searches){
+      CHECK(search->isDone());
+    }
+    CHECK(queue->takeAll().empty());
+  }
+  setSearchThreadCount(3);
+  auto queue = std::make_shared<CompletionQueue>();
+  queue->enable();
+  std::vector<SearchPtr> searches;
+  for(int i = 0; i < 100; i++){
+    searches.push_back(submitSearch([i](Point* point){
+      point->x = i;
+      point->y = -i;
+      return i % 3;
+    }, &bitmap, queue));
+  }
+  searches.push_back(submitSearch([](Point*)->int{ throw 1; }, &bitmap, queue));
+  for(auto& search : searches){
+    search->wait();
+  }
+  for(int i = 0; i < 100; i++){
+    CHECK(searches[i]->found() == i % 3);
+    CHECK(searches[i]->point().x == (i % 3 ? i : -1));
+  }
+  // a throwing search counts as not found
+  CHECK(searches.back()->found() == 0);
+  std::set<AsyncSearch*> seen;
+  while(seen.size() < searches.size()){
+    for(auto& search : queue->takeAll()){
+      CHECK(search->isDone());
+      seen.insert(search.get());
+    }
+  }
+  // waitForSearches only returns once the search stopped reading
+  Bitmap other{};
+  submitSearch([](Point*){
+    std::this_thread::sleep_for(milliseconds(100));
+    return 1;
+  }, &other, queue);
+  auto start = steady_clock::now();
+  waitForSearches(&other);
+  CHECK(steady_clock::now() - start >= milliseconds(50));
+  // resizing the pool leaves queued searches to the old workers
+  for(int i = 0; i < 4; i++){
+    submitSearch([](Point*){
+      std::this_thread::sleep_for(milliseconds(100));
+      return 1;
+    }, &other, queue);
+  }
+  start = steady_clock::now();
+  setSearchThreadCount(1);
+  CHECK(steady_clock::now() - start < milliseconds(50));
+  waitForSearches(&other);
+}
+
+int main(){
+  testAsync();
+  puts("async ok");
+  return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef __VISION_TEST_CHECK_H__
+#define __VISION_TEST_CHECK_H__
+
+#include <cstdio>
+#include <cstdlib>
+
+// unlike assert, also checks in release builds
+#define CHECK(condition) do{\
+  if(!(condition)){\
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);\
+    exit(1);\
+  }\
+}while(0)
+
+#endif // __VISION_TEST_CHECK_H__
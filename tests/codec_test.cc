@@ -0,0 +1,117 @@
+#include "BitmapView.h"
+#include "CommonBitmap.h"
+#include "check.h"
+#include "vision_codec.h"
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace vision;
+
+static auto readFile(const char* path)->std::vector<unsigned char>{
+  std::vector<unsigned char> data;
+  FILE* file = fopen(path, "rb");
+  CHECK(file != nullptr);
+  unsigned char buffer[4096];
+  size_t size;
+  while((size = fread(buffer, 1, sizeof(buffer), file)) > 0){
+    data.insert(data.end(), buffer, buffer + size);
+  }
+  fclose(file);
+  return data;
+}
+
+// pixels with the runs, small steps and repeats every QOI chunk type encodes
+static void fillPixels(std::mt19937& rng, std::vector<unsigned char>& pixels, int width, int height, int stride, int pixelStride){
+  unsigned char last[4] = {0, 0, 0, 255};
+  for(int y = 0; y < height; y++){
+    for(int x = 0; x < width; x++){
+      int mode = rng() % 6;
+      unsigned char* p = &pixels[y * stride + x * pixelStride];
+      for(int c = 0; c < pixelStride; c++){
+        if(mode < 2){
+          p[c] = last[c];
+        }else if(mode == 2){
+          p[c] = last[c] + rng() % 3 - 1;
+        }else if(mode == 3){
+          p[c] = last[c] + rng() % 30 - 15;
+        }else{
+          p[c] = rng();
+        }
+        last[c] = p[c];
+      }
+    }
+  }
+}
+
+static void testRoundTrip(){
+  std::mt19937 rng(3);
+  for(int trial = 0; trial < 40; trial++){
+    int width = 1 + rng() % 70;
+    int height = 1 + rng() % 40;
+    int pixelStride = 3 + rng() % 2;
+    int stride = width * pixelStride + rng() % 5;
+    std::vector<unsigned char> pixels(stride * height);
+    fillPixels(rng, pixels, width, height, stride, pixelStride);
+    BitmapView view(pixels.data(), width, height, stride, pixelStride, pixelStride == 3 ? PIXEL_RGB24 : PIXEL_RGBA);
+    for(auto format : {IMAGE_RAW, IMAGE_QOI}){
+      const char* path = format == IMAGE_RAW ? "codec_test.raw" : "codec_test.QOI";
+      CHECK(imageFormatOf(path) == format);
+      CHECK(saveImage(&view, path, format) == nullptr);
+      CommonBitmap loaded;
+      CHECK(loaded.load(path));
+      CHECK(loaded.width_ == (unsigned)width && loaded.height_ == (unsigned)height);
+      for(int y = 0; y < height; y++){
+        for(int x = 0; x < width; x++){
+          for(int c = 0; c < 4; c++){
+            unsigned char expected = c < pixelStride ? pixels[y * stride + x * pixelStride + c] : 255;
+            CHECK(loaded.origin_[(y * width + x) * 4 + c] == expected);
+          }
+        }
+      }
+      auto data = readFile(path);
+      CommonBitmap decoded;
+      CHECK(decoded.load(data.data(), data.size(), format));
+      CHECK(memcmp(decoded.origin_, loaded.origin_, width * height * 4) == 0);
+      // every cut short of the end marker is rejected
+      for(size_t cut = 0; cut < data.size(); cut += 1 + data.size() / 7){
+        if(format == IMAGE_QOI && cut >= data.size() - 8){
+          continue;
+        }
+        CommonBitmap truncated;
+        CHECK(!truncated.load(data.data(), cut, format));
+      }
+    }
+  }
+}
+
+// headers that promise far more pixels than the data holds fail before allocating
+static void testOversizedHeaders(){
+  std::vector<unsigned char> pixels;
+  unsigned int width = 0;
+  unsigned int height = 0;
+  unsigned char qoi[14 + 16] = {'q', 'o', 'i', 'f', 0, 0, 0x40, 0, 0, 0, 0x40, 0, 4, 0};
+  qoi[sizeof(qoi) - 1] = 1;
+  CHECK(decodeQoi(qoi, sizeof(qoi), pixels, width, height) != nullptr);
+  CHECK(pixels.empty());
+  qoi[6] = 0x7F;
+  CHECK(decodeQoi(qoi, sizeof(qoi), pixels, width, height) != nullptr);
+  CHECK(pixels.empty());
+
+  RawImageHeader header{RAW_IMAGE_MAGIC, RAW_IMAGE_VERSION, 8192, 8192, 4, sizeof(RawImageHeader), {0, 0}};
+  FILE* file = fopen("codec_test_big.raw", "wb");
+  CHECK(file != nullptr);
+  fwrite(&header, sizeof(header), 1, file);
+  fclose(file);
+  CHECK(decodeRawFile("codec_test_big.raw", pixels, width, height) != nullptr);
+  CHECK(pixels.empty());
+  header.width = 100000;
+  CHECK(decodeRaw((const unsigned char*)&header, sizeof(header), pixels, width, height) != nullptr);
+}
+
+int main(){
+  testRoundTrip();
+  testOversizedHeaders();
+  puts("codec ok");
+  return 0;
+}
@@ -0,0 +1,110 @@
+#include "BitmapView.h"
+#include "check.h"
+#include "vision.h"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace vision;
+
+static const int WIDTH = 160;
+static const int HEIGHT = 120;
+
+// whether a comes before b when scanning in the given find order
+static bool before(int order, Point a, Point b){
+  bool columns = order <= 3;
+  bool outerReverse = columns ? (order == 1 || order == 3) : (order == 5 || order == 7);
+  bool innerReverse = columns ? (order == 2 || order == 3) : (order == 6 || order == 7);
+  int outerA = columns ? a.x : a.y, outerB = columns ? b.x : b.y;
+  if(outerA != outerB){
+    return outerReverse ? outerA > outerB : outerA < outerB;
+  }
+  int innerA = columns ? a.y : a.x, innerB = columns ? b.y : b.x;
+  return innerReverse ? innerA > innerB : innerA < innerB;
+}
+
+static auto makePixels(std::mt19937& rng)->std::vector<unsigned char>{
+  std::vector<unsigned char> pixels(WIDTH * HEIGHT * 4);
+  for(int i = 0; i < WIDTH * HEIGHT; i++){
+    int x = i % WIDTH, y = i / WIDTH;
+    pixels[i * 4] = (x / 7 * 40 + rng() % 8) & 255;
+    pixels[i * 4 + 1] = (y / 5 * 30 + rng() % 8) & 255;
+    pixels[i * 4 + 2] = ((x + y) / 9 * 50) & 255;
+    pixels[i * 4 + 3] = rng();
+  }
+  return pixels;
+}
+
+// features picked from the bitmap itself, so a good part of them match
+static auto randomFeature(std::mt19937& rng, const std::vector<unsigned char>& pixels, PixelFormat format, int* points)->std::string{
+  std::string feature;
+  *points = 1 + rng() % 4;
+  int anchorX = rng() % WIDTH, anchorY = rng() % HEIGHT;
+  for(int i = 0; i < *points; i++){
+    int x = i ? std::max(0, std::min(WIDTH - 1, anchorX + (int)(rng() % 9) - 4)) : anchorX;
+    int y = i ? std::max(0, std::min(HEIGHT - 1, anchorY + (int)(rng() % 9) - 4)) : anchorY;
+    const unsigned char* p = &pixels[(y * WIDTH + x) * 4];
+    unsigned r = p[format == PIXEL_BGRA ? 2 : 0], g = p[1], b = p[format == PIXEL_BGRA ? 0 : 2];
+    char buffer[64];
+    switch(rng() % 4){
+      case 0: snprintf(buffer, sizeof(buffer), "%d|%d|%02x%02x%02x", x - anchorX, y - anchorY, r, g, b); break;
+      case 1: snprintf(buffer, sizeof(buffer), "%d|%d|%02x%02x%02x-101010", x - anchorX, y - anchorY, r, g, b); break;
+      case 2: snprintf(buffer, sizeof(buffer), "%d|%d|!%02x%02x%02x-202020", x - anchorX, y - anchorY, (r + 128) & 255, g, b); break;
+      default: snprintf(buffer, sizeof(buffer), "%d|%d|%02x%02x%02x|%02x%02x%02x", x - anchorX, y - anchorY, r, g, b, (r * 3) & 255, g ^ 0x55, b); break;
+    }
+    if(i){
+      feature += ",";
+    }
+    feature += buffer;
+  }
+  return feature;
+}
+
+// findFeatures reports the first match any single findFeature would
+static void testFeatureSet(std::mt19937& rng){
+  auto pixels = makePixels(rng);
+  for(PixelFormat format : {PIXEL_RGBA, PIXEL_BGRA}){
+    BitmapView view(pixels.data(), WIDTH, HEIGHT, WIDTH * 4, 4, format);
+    for(int round = 0; round < 30; round++){
+      int count = 1 + rng() % 30;
+      std::vector<FeaturePtr> features;
+      std::vector<int> shiftSums;
+      for(int i = 0; i < count; i++){
+        int points;
+        auto text = randomFeature(rng, pixels, format, &points);
+        auto feature = getCachedFeature(text.data(), text.size());
+        CHECK(feature != nullptr);
+        shiftSums.push_back(rng() % (60 * points + 1));
+        features.push_back(std::move(feature));
+      }
+      FeatureSet set(&view, features, shiftSums);
+      for(int order = 0; order < 8; order++){
+        int x = rng() % (WIDTH / 2), y = rng() % (HEIGHT / 2);
+        int x1 = x + 1 + rng() % (WIDTH - x), y1 = y + 1 + rng() % (HEIGHT - y);
+        Point point;
+        int index = findFeatures(&view, x, y, x1, y1, &set, order, &point);
+        Point best(-1, -1);
+        int bestIndex = 0;
+        for(int i = 0; i < count; i++){
+          BoundFeature bound(features[i].get(), &view);
+          Point found;
+          if(findFeature(&view, x, y, x1, y1, &bound, shiftSums[i], order, &found) && (!bestIndex || before(order, found, best))){
+            best = found;
+            bestIndex = i + 1;
+          }
+        }
+        CHECK(index == bestIndex);
+        CHECK(!index || (point.x == best.x && point.y == best.y));
+      }
+    }
+  }
+}
+
+int main(){
+  std::mt19937 rng(23);
+  testFeatureSet(rng);
+  puts("features ok");
+  return 0;
+}
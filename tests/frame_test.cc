@@ -0,0 +1,144 @@
+#include "SharedFrameBitmap.h"
+#include "check.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace vision;
+
+static const char* FRAME_PATH = "frame_test.bin";
+static const size_t REGION_SIZE = 16384;
+
+struct Layout{
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  PixelFormat format;
+  uint64_t offset;
+  // every byte of its pixels
+  unsigned char fill;
+};
+
+static const Layout LAYOUTS[2] = {
+  {16, 8, 64, PIXEL_RGBA, 4096, 0x11},
+  {8, 16, 40, PIXEL_BGRA, 8192, 0x22},
+};
+
+// a double buffered region holding the pixels of both layouts
+static void writeFrame(const Layout& layout, uint64_t sequence){
+  std::vector<unsigned char> region(REGION_SIZE, 0);
+  SharedFrameHeader header{SHARED_FRAME_MAGIC, SHARED_FRAME_VERSION, layout.width, layout.height,
+    layout.stride, 4, (uint32_t)layout.format, 0, layout.offset, sequence};
+  memcpy(region.data(), &header, sizeof(header));
+  for(auto& buffer : LAYOUTS){
+    for(uint32_t y = 0; y < buffer.height; y++){
+      memset(&region[buffer.offset + y * buffer.stride], buffer.fill, buffer.width * 4);
+    }
+  }
+  FILE* file = fopen(FRAME_PATH, "wb");
+  CHECK(file != nullptr);
+  CHECK(fwrite(region.data(), 1, region.size(), file) == region.size());
+  fclose(file);
+}
+
+static bool isLayout(const SharedFrameBitmap& frame, const Layout& layout){
+  const unsigned char* last = frame.origin_ + (layout.height - 1) * layout.stride + (layout.width - 1) * 4;
+  return frame.width_ == layout.width && frame.height_ == layout.height &&
+    frame.rowShift_ == (int)layout.stride && frame.format_ == layout.format &&
+    frame.origin_[0] == layout.fill && last[3] == layout.fill;
+}
+
+static void testRefresh(){
+  writeFrame(LAYOUTS[0], 2);
+  SharedFrameBitmap frame;
+  CHECK(frame.open(FRAME_PATH, true));
+  CHECK(isLayout(frame, LAYOUTS[0]) && frame.sequence() == 2);
+  CHECK(!frame.refresh());
+  writeFrame(LAYOUTS[1], 4);
+  CHECK(frame.refresh() && isLayout(frame, LAYOUTS[1]) && frame.sequence() == 4);
+  // a producer still writing the header is not read
+  writeFrame(LAYOUTS[0], 5);
+  CHECK(!frame.refresh() && frame.errorText() != nullptr && frame.width_ == 0);
+  // a region truncated to the end of the frame is mapped again at its
+  // new size, and again when it grows back
+  writeFrame(LAYOUTS[0], 6);
+  CHECK(truncate(FRAME_PATH, LAYOUTS[0].offset + LAYOUTS[0].stride * LAYOUTS[0].height) == 0);
+  CHECK(frame.refresh() && isLayout(frame, LAYOUTS[0]));
+  writeFrame(LAYOUTS[1], 8);
+  CHECK(frame.refresh() && isLayout(frame, LAYOUTS[1]));
+  SharedFrameHeader header{};
+  FILE* file = fopen(FRAME_PATH, "r+b");
+  CHECK(file != nullptr);
+  CHECK(fwrite(&header, sizeof(header), 1, file) == 1);
+  fclose(file);
+  CHECK(!frame.refresh() && frame.errorText() != nullptr && frame.width_ == 0);
+}
+
+// the producer side of the protocol described at SharedFrameHeader
+static void publish(volatile SharedFrameHeader* header, const Layout& layout){
+  uint64_t sequence = header->sequence;
+  header->sequence = sequence + 1;
+  std::atomic_thread_fence(std::memory_order_release);
+  header->width = layout.width;
+  header->height = layout.height;
+  // widen the window a reader can copy half a header in
+  std::this_thread::yield();
+  header->stride = layout.stride;
+  header->format = layout.format;
+  header->offset = layout.offset;
+  std::atomic_thread_fence(std::memory_order_release);
+  header->sequence = sequence + 2;
+}
+
+// refresh never reports the fields of one layout with those of another
+static void testConcurrentRefresh(){
+  writeFrame(LAYOUTS[0], 0);
+  int fd = open(FRAME_PATH, O_RDWR);
+  CHECK(fd >= 0);
+  void* mapping = mmap(nullptr, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  CHECK(mapping != MAP_FAILED);
+  SharedFrameBitmap frame;
+  CHECK(frame.open(FRAME_PATH, true));
+  std::atomic<bool> stop(false);
+  std::thread producer([&](){
+    auto header = (volatile SharedFrameHeader*)mapping;
+    for(int i = 1; !stop.load(); i++){
+      publish(header, LAYOUTS[i % 2]);
+      std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+  });
+  int seen[2] = {0, 0};
+  auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+  while(std::chrono::steady_clock::now() < end){
+    frame.refresh();
+    if(frame.errorText() != nullptr){
+      // the only failure allowed is a header that kept changing
+      CHECK(strcmp(frame.errorText(), "the shared frame header keeps changing") == 0);
+      continue;
+    }
+    CHECK(frame.sequence() % 2 == 0);
+    bool first = isLayout(frame, LAYOUTS[0]);
+    CHECK(first || isLayout(frame, LAYOUTS[1]));
+    seen[first ? 0 : 1]++;
+  }
+  stop = true;
+  producer.join();
+  CHECK(seen[0] > 0 && seen[1] > 0);
+  frame.close();
+  munmap(mapping, REGION_SIZE);
+  close(fd);
+}
+
+int main(){
+  testRefresh();
+  testConcurrentRefresh();
+  remove(FRAME_PATH);
+  puts("frame ok");
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "BitmapView.h"
+#include "check.h"
+#include "vision.h"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace vision;
+
+static const int WIDTH = 160;
+static const int HEIGHT = 120;
+
+static auto makePixels(std::mt19937& rng)->std::vector<unsigned char>{
+  std::vector<unsigned char> pixels(WIDTH * HEIGHT * 4);
+  for(int i = 0; i < WIDTH * HEIGHT; i++){
+    int x = i % WIDTH, y = i / WIDTH;
+    pixels[i * 4] = (x / 7 * 40 + rng() % 8) & 255;
+    pixels[i * 4 + 1] = (y / 5 * 30 + rng() % 8) & 255;
+    pixels[i * 4 + 2] = ((x + y) / 9 * 50) & 255;
+    pixels[i * 4 + 3] = rng();
+  }
+  return pixels;
+}
+
+// the lut searches agree with the per-pixel comparisons in every pixel format
+static void testColorLut(std::mt19937& rng){
+  auto pixels = makePixels(rng);
+  std::vector<unsigned char> rgb(WIDTH * HEIGHT * 3);
+  for(int i = 0; i < WIDTH * HEIGHT; i++){
+    memcpy(&rgb[i * 3], &pixels[i * 4], 3);
+  }
+  BitmapView rgba(pixels.data(), WIDTH, HEIGHT, WIDTH * 4, 4);
+  BitmapView bgra(pixels.data(), WIDTH, HEIGHT, WIDTH * 4, 4, PIXEL_BGRA);
+  BitmapView rgb24(rgb.data(), WIDTH, HEIGHT, WIDTH * 3, 3, PIXEL_RGB24);
+  for(int round = 0; round < 100; round++){
+    std::string text;
+    int count = 1 + rng() % 8;
+    for(int i = 0; i < count; i++){
+      char buffer[40];
+      unsigned color = rng() & 0xffffff, shift = rng() & 0x3f3f3f;
+      switch(rng() % 4){
+        case 0: snprintf(buffer, sizeof(buffer), "%06x", color); break;
+        case 1: snprintf(buffer, sizeof(buffer), "%06x-%06x", color, shift); break;
+        case 2: snprintf(buffer, sizeof(buffer), "!%06x", color); break;
+        default: snprintf(buffer, sizeof(buffer), "!%06x-%06x", color, shift * 2); break;
+      }
+      if(i){
+        text += "|";
+      }
+      text += buffer;
+    }
+    auto color = decodeColor(text.data(), text.size());
+    CHECK(color != nullptr);
+    int shiftSum = rng() % 200, order = rng() % 8;
+    for(Bitmap* bitmap : {(Bitmap*)&rgba, (Bitmap*)&bgra, (Bitmap*)&rgb24}){
+      if(round % 2){
+        bitmap->invalidate();
+      }
+      Point lutPoint, plainPoint;
+      bool lutFound = findColor(bitmap, 0, 0, WIDTH, HEIGHT, color, shiftSum, order, &lutPoint);
+      bool plainFound = findColor<ColorComposition*, int>(bitmap, 0, 0, WIDTH, HEIGHT, color, shiftSum, order, &plainPoint);
+      CHECK(lutFound == plainFound);
+      CHECK(!lutFound || (lutPoint.x == plainPoint.x && lutPoint.y == plainPoint.y));
+      int lutCount = getColorCount(bitmap, 0, 0, WIDTH, HEIGHT, color, shiftSum);
+      int plainCount = getColorCount<ColorComposition*, int>(bitmap, 0, 0, WIDTH, HEIGHT, color, shiftSum);
+      CHECK(lutCount == plainCount);
+      std::vector<Point> lutPoints, plainPoints;
+      findAllColor(bitmap, 0, 0, WIDTH, HEIGHT, color, shiftSum, order, 50, 3, &lutPoints);
+      findAllColor<ColorComposition*, int>(bitmap, 0, 0, WIDTH, HEIGHT, color, shiftSum, order, 50, 3, &plainPoints);
+      CHECK(lutPoints.size() == plainPoints.size());
+      for(size_t i = 0; i < lutPoints.size(); i++){
+        CHECK(lutPoints[i].x == plainPoints[i].x && lutPoints[i].y == plainPoints[i].y);
+      }
+    }
+    freeColorComposition(color);
+  }
+}
+
+int main(){
+  std::mt19937 rng(24);
+  testColorLut(rng);
+  puts("lut ok");
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include "BitmapView.h"
+#include "check.h"
+#include "vision_pack.h"
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace vision;
+
+int main(){
+  std::mt19937 rng(1);
+  const char* names[] = {"a.qoi", "ui/b.raw", "ui/c.qoi", "z.raw"};
+  int widths[] = {3, 17, 40, 1};
+  int heights[] = {5, 9, 2, 1};
+  std::vector<std::vector<unsigned char>> pixels;
+  std::vector<CommonBitmap> images(4);
+  std::vector<std::pair<std::string, CommonBitmap*>> entries;
+  for(int i = 0; i < 4; i++){
+    std::vector<unsigned char> image(widths[i] * heights[i] * 4);
+    for(auto& c : image){
+      c = rng();
+    }
+    BitmapView view(image.data(), widths[i], heights[i], widths[i] * 4, 4);
+    images[i].load(&view, 0, 0, widths[i], heights[i]);
+    entries.emplace_back(names[i], &images[i]);
+    pixels.push_back(std::move(image));
+  }
+  CHECK(writePack("pack_test.svpack", entries) == nullptr);
+
+  auto pack = std::make_shared<TemplatePack>();
+  CHECK(pack->open("pack_test.svpack") == nullptr);
+  CHECK(pack->size() == 4);
+  registerPack(pack);
+  for(int i = 0; i < 4; i++){
+    auto image = findPackedImage(names[i]);
+    CHECK(image != nullptr);
+    CHECK(image->width_ == (unsigned)widths[i] && image->height_ == (unsigned)heights[i]);
+    CHECK((uintptr_t)image->origin_ % PACK_ALIGNMENT == 0);
+    CHECK(memcmp(image->origin_, images[i].origin_, pixels[i].size()) == 0);
+    CHECK(memcmp(image->channelSums(), images[i].channelSums(), sizeof(uint64_t) * 3) == 0);
+    CHECK(findPackedImage(names[i]) == image);
+  }
+  CHECK(findPackedImage("nope.png") == nullptr);
+  CHECK(findPackedImage("ui") == nullptr);
+  // images outlive the pack that mapped them
+  pack.reset();
+  CHECK(findPackedImage("z.raw") != nullptr);
+
+  FILE* file = fopen("pack_test.svpack", "rb");
+  CHECK(file != nullptr);
+  std::vector<unsigned char> data(1 << 16);
+  data.resize(fread(data.data(), 1, data.size(), file));
+  fclose(file);
+  file = fopen("pack_test_truncated.svpack", "wb");
+  CHECK(file != nullptr);
+  fwrite(data.data(), 1, data.size() - 70, file);
+  fclose(file);
+  TemplatePack truncated;
+  CHECK(truncated.open("pack_test_truncated.svpack") != nullptr);
+  puts("pack ok");
+  return 0;
+}
@@ -0,0 +1,163 @@
+// Compares every vector kernel with its scalar version, not only the one the
+// running cpu would pick. The kernels are static, so the file is compiled
+// into this test instead of being linked.
+#include "vision_simd.cc"
+#include "check.h"
+#include <random>
+#include <vector>
+
+using namespace vision;
+
+static bool hasAvx2(){
+#if VISION_SIMD_AVX2
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+// bytes near each other, so distances land on both sides of the budgets
+static auto randomBytes(std::mt19937& rng, size_t size, int base)->std::vector<unsigned char>{
+  std::vector<unsigned char> bytes(size);
+  for(auto& b : bytes){
+    b = rng() % 4 == 0 ? rng() : base + rng() % 40;
+  }
+  return bytes;
+}
+
+template<bool SWAPPED>
+static void testRowShiftSum(std::mt19937& rng){
+  for(int count = 0; count < 70; count++){
+    auto pixels = randomBytes(rng, count * 4, 100);
+    auto templatePixels = randomBytes(rng, count * 4, 110);
+    int expected = scalarRowShiftSum<SWAPPED>(pixels.data(), templatePixels.data(), count);
+#if defined(__SSE2__)
+    CHECK(sse2RowShiftSum<SWAPPED>(pixels.data(), templatePixels.data(), count) == expected);
+#endif
+#if VISION_SIMD_AVX2
+    if(hasAvx2()){
+      CHECK(avx2RowShiftSum<SWAPPED>(pixels.data(), templatePixels.data(), count) == expected);
+    }
+#endif
+    CHECK(computeRowShiftSum(pixels.data(), templatePixels.data(), count, SWAPPED) == expected);
+  }
+}
+
+template<int MODE>
+static void testRowPredicates(std::mt19937& rng){
+  for(int trial = 0; trial < 300; trial++){
+    int count = rng() % 70;
+    auto pixels = randomBytes(rng, count * 4, 100);
+    PixelPredicate predicate{0, 0, (PredicateMode)MODE, (int)(rng() % 120)};
+    auto color = (unsigned char*)&predicate.color;
+    auto shift = (unsigned char*)&predicate.shift;
+    for(int c = 0; c < 3; c++){
+      color[c] = 100 + rng() % 40;
+      shift[c] = rng() % 30;
+    }
+    // predicates keep byte 3 zero, the byte 3 of the pixels is ignored
+    int expected = scalarCountRow<MODE>(pixels.data(), count, predicate);
+    int first = scalarFindRow<MODE>(pixels.data(), count, predicate, false);
+    int last = scalarFindRow<MODE>(pixels.data(), count, predicate, true);
+#if defined(__SSE2__)
+    CHECK(sse2CountRow<MODE>(pixels.data(), count, predicate) == expected);
+    CHECK(sse2FindRow<MODE>(pixels.data(), count, predicate, false) == first);
+    CHECK(sse2FindRow<MODE>(pixels.data(), count, predicate, true) == last);
+#endif
+#if VISION_SIMD_AVX2
+    if(hasAvx2()){
+      CHECK(avx2CountRow<MODE>(pixels.data(), count, predicate) == expected);
+      CHECK(avx2FindRow<MODE>(pixels.data(), count, predicate, false) == first);
+      CHECK(avx2FindRow<MODE>(pixels.data(), count, predicate, true) == last);
+    }
+#endif
+    CHECK(countRowMatches(pixels.data(), count, predicate) == expected);
+    CHECK(findRowMatch(pixels.data(), count, predicate, false) == first);
+    CHECK(findRowMatch(pixels.data(), count, predicate, true) == last);
+  }
+}
+
+static void testLumaRow(std::mt19937& rng){
+  for(int count = 0; count < 100; count++){
+    auto pixels = randomBytes(rng, count * 4, 0);
+    std::vector<unsigned char> expected(count + 1, 0xAB);
+    scalarLumaRow(pixels.data(), expected.data(), count);
+    for(int i = 0; i < count; i++){
+      CHECK(expected[i] == (pixels[i * 4] + 2 * pixels[i * 4 + 1] + pixels[i * 4 + 2]) / 4);
+    }
+    std::vector<unsigned char> luma(count + 1, 0xAB);
+#if defined(__SSE2__)
+    sse2LumaRow(pixels.data(), luma.data(), count);
+    CHECK(luma == expected);
+#endif
+#if VISION_SIMD_AVX2
+    if(hasAvx2()){
+      luma.assign(count + 1, 0xAB);
+      avx2LumaRow(pixels.data(), luma.data(), count);
+      CHECK(luma == expected);
+    }
+#endif
+    luma.assign(count + 1, 0xAB);
+    computeLumaRow(pixels.data(), luma.data(), count);
+    CHECK(luma == expected);
+  }
+}
+
+static void testLumaWindow(std::mt19937& rng){
+  for(int trial = 0; trial < 300; trial++){
+    int width = 1 + rng() % 40;
+    int height = 1 + rng() % 8;
+    int stride = width + rng() % 9;
+    auto window = randomBytes(rng, stride * height, 100);
+    auto luma = randomBytes(rng, width * height, 100);
+    int64_t bound = 0;
+    for(int y = 0; y < height; y++){
+      bound += scalarLumaBound(window.data() + y * stride, luma.data() + y * width, width);
+    }
+    for(int limit : {0, (int)bound - 1, (int)bound, (int)(rng() % (bound + 1))}){
+      bool expected = bound > limit;
+#if defined(__SSE2__)
+      CHECK(sse2LumaWindow(window.data(), stride, luma.data(), width, height, limit) == expected);
+#endif
+      CHECK(lumaWindowExceeds(window.data(), stride, luma.data(), width, height, limit) == expected);
+    }
+  }
+}
+
+static void testBytesDiffer(std::mt19937& rng){
+  for(int count = 0; count < 100; count++){
+    // one spare byte, so even empty rows have a buffer
+    auto a = randomBytes(rng, count + 1, 0);
+    for(int changed = -1; changed < count; changed++){
+      auto b = a;
+      if(changed >= 0){
+        b[changed] ^= 1 << (rng() % 8);
+      }
+      bool expected = changed >= 0;
+      CHECK(scalarBytesDiffer(a.data(), b.data(), count) == expected);
+#if defined(__SSE2__)
+      CHECK(sse2BytesDiffer(a.data(), b.data(), count) == expected);
+#endif
+#if VISION_SIMD_AVX2
+      if(hasAvx2()){
+        CHECK(avx2BytesDiffer(a.data(), b.data(), count) == expected);
+      }
+#endif
+      CHECK(bytesDiffer(a.data(), b.data(), count) == expected);
+    }
+  }
+}
+
+int main(){
+  std::mt19937 rng(7);
+  testRowShiftSum<false>(rng);
+  testRowShiftSum<true>(rng);
+  testRowPredicates<PREDICATE_DISTANCE>(rng);
+  testRowPredicates<PREDICATE_GAMUT>(rng);
+  testRowPredicates<PREDICATE_GAMUT_NOT>(rng);
+  testLumaRow(rng);
+  testLumaWindow(rng);
+  testBytesDiffer(rng);
+  printf("simd ok%s\n", hasAvx2() ? ", avx2 checked" : "");
+  return 0;
+}
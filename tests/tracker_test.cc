@@ -0,0 +1,184 @@
+#include "BitmapView.h"
+#include "CommonBitmap.h"
+#include "FrameTracker.h"
+#include "check.h"
+#include "vision.h"
+#include "vision_image.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace vision;
+
+static const int WIDTH = 192;
+static const int HEIGHT = 144;
+static const int FRAMES = 200;
+
+// a tracked query and the plain search it stands for
+struct Query{
+  std::string key;
+  int x;
+  int y;
+  int x1;
+  int y1;
+  int order;
+  QueryExtent extent;
+  TrackedSearch search;
+};
+
+// blocks of similar colors, so targets match in several places
+static auto makePixels(std::mt19937& rng)->std::vector<unsigned char>{
+  std::vector<unsigned char> pixels(WIDTH * HEIGHT * 4);
+  for(int i = 0; i < WIDTH * HEIGHT; i++){
+    int x = i % WIDTH, y = i / WIDTH;
+    pixels[i * 4] = (x / 12 * 40 + rng() % 4) & 255;
+    pixels[i * 4 + 1] = (y / 10 * 30 + rng() % 4) & 255;
+    pixels[i * 4 + 2] = ((x + y) / 16 * 50) & 255;
+    pixels[i * 4 + 3] = 255;
+  }
+  return pixels;
+}
+
+static auto hexColor(const unsigned char* pixel)->std::string{
+  char text[8];
+  snprintf(text, sizeof(text), "%02x%02x%02x", pixel[0], pixel[1], pixel[2]);
+  return text;
+}
+
+// an area around where the target was taken from
+static void randomArea(std::mt19937& rng, int x, int y, Query* query){
+  query->x = x - rng() % (x + 1);
+  query->y = y - rng() % (y + 1);
+  query->x1 = x + 1 + rng() % (WIDTH - x);
+  query->y1 = y + 1 + rng() % (HEIGHT - y);
+  // every read order and the unordered one, which is not remembered
+  query->order = rng() % 9;
+}
+
+// Changes a few rectangles of the frame, either to noise or back to the
+// first frame, so targets disappear and come back
+static void changeFrame(std::mt19937& rng, std::vector<unsigned char>& pixels, const std::vector<unsigned char>& first){
+  int changes = rng() % 4;
+  for(int i = 0; i < changes; i++){
+    int width = 1 + rng() % 24, height = 1 + rng() % 24;
+    int x = rng() % (WIDTH - width + 1), y = rng() % (HEIGHT - height + 1);
+    bool restore = rng() % 2;
+    for(int row = y; row < y + height; row++){
+      unsigned char* p = &pixels[(row * WIDTH + x) * 4];
+      if(restore){
+        memcpy(p, &first[(row * WIDTH + x) * 4], width * 4);
+        continue;
+      }
+      for(int c = 0; c < width * 4; c++){
+        if(c % 4 != 3){
+          p[c] = rng();
+        }
+      }
+    }
+  }
+}
+
+int main(){
+  std::mt19937 rng(21);
+  auto pixels = makePixels(rng);
+  const auto first = pixels;
+  BitmapView view(pixels.data(), WIDTH, HEIGHT, WIDTH * 4, 4);
+
+  std::vector<std::shared_ptr<ColorComposition>> colors;
+  std::vector<FeaturePtr> features;
+  std::vector<std::unique_ptr<CommonBitmap>> images;
+  std::vector<Query> queries;
+  for(int i = 0; i < 8; i++){
+    int x = rng() % WIDTH, y = rng() % HEIGHT;
+    std::string text = hexColor(&pixels[(y * WIDTH + x) * 4]) + (i % 2 ? "-080808" : "");
+    colors.emplace_back(decodeColor(text.data(), text.size()), freeColorComposition);
+    CHECK(colors.back() != nullptr);
+    auto color = colors.back().get();
+    int shift = i % 3 * 10;
+    Query query;
+    query.key = "color" + std::to_string(i);
+    randomArea(rng, x, y, &query);
+    query.extent = QueryExtent{0, 0, 0, 0};
+    query.search = [&view, color, shift, order = query.order](int x, int y, int x1, int y1, Point* out)->int{
+      return findColor(&view, x, y, x1, y1, color, shift, order, out);
+    };
+    queries.push_back(std::move(query));
+  }
+  for(int i = 0; i < 8; i++){
+    int anchorX = 4 + rng() % (WIDTH - 8), anchorY = 4 + rng() % (HEIGHT - 8);
+    std::string text;
+    for(int point = 0; point < 3; point++){
+      int dx = point ? (int)(rng() % 9) - 4 : 0, dy = point ? (int)(rng() % 9) - 4 : 0;
+      if(point){
+        text += ",";
+      }
+      text += std::to_string(dx) + "|" + std::to_string(dy) + "|" +
+        hexColor(&pixels[((anchorY + dy) * WIDTH + anchorX + dx) * 4]) + "-101010";
+    }
+    auto feature = getCachedFeature(text.data(), text.size());
+    CHECK(feature != nullptr);
+    features.push_back(feature);
+    int shiftSum = i % 2 * 60;
+    Query query;
+    query.key = "feature" + std::to_string(i);
+    randomArea(rng, anchorX, anchorY, &query);
+    query.extent = QueryExtent{feature->minX, feature->minY, feature->maxX, feature->maxY};
+    query.search = [&view, feature, shiftSum, order = query.order](int x, int y, int x1, int y1, Point* out)->int{
+      BoundFeature bound(feature.get(), &view);
+      bound.orderBySelectivity(&view, x, y, x1, y1);
+      return findFeature(&view, x, y, x1, y1, &bound, shiftSum, order, out);
+    };
+    queries.push_back(std::move(query));
+  }
+  for(int i = 0; i < 8; i++){
+    int width = 4 + rng() % 12, height = 4 + rng() % 12;
+    int x = rng() % (WIDTH - width), y = rng() % (HEIGHT - height);
+    images.emplace_back(new CommonBitmap());
+    images.back()->load(&view, x, y, width, height);
+    CommonBitmap* image = images.back().get();
+    int shiftSum = width * height * (i % 2 ? 12 : 0);
+    Query query;
+    query.key = "image" + std::to_string(i);
+    randomArea(rng, x, y, &query);
+    query.extent = QueryExtent{0, 0, width - 1, height - 1};
+    query.search = [&view, image, shiftSum, order = query.order](int x, int y, int x1, int y1, Point* out)->int{
+      CommonBitmap* templates[] = {image};
+      return findImagePyramid(&view, x, y, x1, y1, templates, &shiftSum, 1, 1, order, out);
+    };
+    queries.push_back(std::move(query));
+  }
+
+  FrameTracker tracker(16);
+  int found = 0, remembered = 0;
+  for(int frame = 0; frame < FRAMES; frame++){
+    if(frame){
+      changeFrame(rng, pixels, first);
+    }
+    view.invalidate();
+    int dirty = tracker.update(&view);
+    remembered += dirty == 0;
+    for(auto& query : queries){
+      Point tracked(-1, -1), plain(-1, -1);
+      int trackedFound = tracker.find(query.key, &view, query.x, query.y, query.x1, query.y1,
+        query.extent, query.order, query.search, &tracked);
+      int plainFound = query.search(query.x, query.y, query.x1, query.y1, &plain);
+      CHECK(trackedFound == plainFound);
+      CHECK(!plainFound || (tracked.x == plain.x && tracked.y == plain.y));
+      found += plainFound > 0;
+    }
+  }
+  // enough matches and unchanged frames for the remembered answers to count
+  CHECK(found > FRAMES * (int)queries.size() / 10);
+  CHECK(remembered > 0);
+  // a bitmap other than the tracked frame is searched in full
+  auto other = first;
+  BitmapView otherView(other.data(), WIDTH, HEIGHT, WIDTH * 4, 4);
+  Point point;
+  CHECK(!tracker.find("other", &otherView, 0, 0, WIDTH, HEIGHT, QueryExtent{0, 0, 0, 0}, 0,
+    [](int, int, int, int, Point*){ return 0; }, &point));
+  puts("tracker ok");
+  return 0;
+}
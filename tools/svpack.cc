@@ -0,0 +1,52 @@
+// Compiles a directory of templates into a pack that openPack maps at
+// startup. Images are named by their path relative to the directory, the
+// names loadImages is given.
+//
+//   svpack <directory> <pack>
+#include "CommonBitmap.h"
+#include "vision_codec.h"
+#include "vision_pack.h"
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+
+using namespace vision;
+
+int main(int argc, char** argv){
+  if(argc != 3){
+    fprintf(stderr, "usage: %s <directory> <pack>\n", argv[0]);
+    return 2;
+  }
+  std::filesystem::path root(argv[1]);
+  std::error_code error;
+  std::vector<std::unique_ptr<CommonBitmap>> images;
+  std::vector<std::pair<std::string, CommonBitmap*>> entries;
+  for(auto it = std::filesystem::recursive_directory_iterator(root, error);
+    !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)){
+    if(!it->is_regular_file()){
+      continue;
+    }
+    auto path = it->path().string();
+    auto extension = it->path().extension().string();
+    if(imageFormatOf(path.c_str()) == IMAGE_PNG && extension != ".png" && extension != ".PNG"){
+      continue;
+    }
+    auto image = std::make_unique<CommonBitmap>();
+    if(!image->load(path.c_str())){
+      fprintf(stderr, "%s: %s\n", path.c_str(), image->errorText());
+      return 1;
+    }
+    entries.emplace_back(it->path().lexically_relative(root).generic_string(), image.get());
+    images.push_back(std::move(image));
+  }
+  if(error){
+    fprintf(stderr, "%s: %s\n", argv[1], error.message().c_str());
+    return 1;
+  }
+  if(auto failure = writePack(argv[2], entries)){
+    fprintf(stderr, "%s: %s\n", argv[2], failure);
+    return 1;
+  }
+  printf("%zu images\n", entries.size());
+  return 0;
+}